@@ -1,9 +1,16 @@
 #include "core/Backend.h"
 
 #include "CpuBackend.h"
+#include "JitBackend.h"
 
 auto
 Backend::MakeCpuBackend() -> std::unique_ptr<Backend>
 {
   return std::unique_ptr<Backend>(CpuBackend::Make());
 }
+
+auto
+Backend::MakeJitBackend() -> std::unique_ptr<Backend>
+{
+  return std::unique_ptr<Backend>(JitBackend::Make());
+}
@@ -9,6 +9,16 @@ class Expr;
 
 } // namespace ir
 
+namespace terra {
+
+class CancellationToken;
+
+} // namespace terra
+
+/// The token of the terra library, so that both cancel the same way.
+using CancellationToken = terra::CancellationToken;
+
+class HeightMapExchange;
 class HeightMapObserver;
 
 class Backend
@@ -16,16 +26,43 @@ class Backend
 public:
   static auto MakeCpuBackend() -> std::unique_ptr<Backend>;
 
+  /// @brief Makes a backend that compiles the height expression to native
+  /// code. If no compiler is available, it behaves like the CPU backend.
+  static auto MakeJitBackend() -> std::unique_ptr<Backend>;
+
   virtual ~Backend() = default;
 
   virtual void AddHeightMapObserver(std::unique_ptr<HeightMapObserver>) = 0;
 
-  virtual void ComputeHeightMap() = 0;
+  /// @brief Computes the height map, publishes it to the exchange and then
+  /// notifies the observers.
+  ///
+  /// @param token If not null, the computation stops early once it is
+  /// cancelled. The observers are not notified in that case and the height
+  /// map is left partially updated.
+  ///
+  /// @return False if the computation was cancelled.
+  virtual bool ComputeHeightMap(const CancellationToken* token = nullptr) = 0;
 
   virtual void ComputeSurface() = 0;
 
+  /// @brief Gets the exchange that the height maps are published to. The
+  /// thread calling @ref Backend::ComputeHeightMap is its producer, a
+  /// renderer may be its consumer.
+  virtual auto GetHeightMapExchange() const
+    -> std::shared_ptr<HeightMapExchange> = 0;
+
   virtual void Resize(size_t w, size_t h) = 0;
 
+  /// @brief Sets the number of threads used to compute the height map.
+  ///
+  /// @param threadCount The number of threads to use. If zero, then one
+  /// thread per hardware thread is used, which is also the default.
+  virtual void SetThreadCount(size_t threadCount) = 0;
+
+  /// @brief Copies the height map that was computed last. Must not be called
+  /// while the height map is being computed.
+  ///
   /// @note @p buf must be large enough to fit
   /// the entire height map.
   virtual void ReadHeightMap(float* buf) const = 0;
@@ -1,517 +1,252 @@
 #include "core/CpuBackend.h"
 
+#include "core/HeightMapExchange.h"
 #include "core/HeightMapObserver.h"
-#include "core/IR.h"
+#include "core/Program.h"
+#include "core/ProgramBuilder.h"
 
+#include <terra/cancellation_token.h>
+
+#include <thread_pool.hpp>
+
+#include <algorithm>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <optional>
+#include <thread>
 #include <vector>
 
-#include <math.h>
 #include <stdint.h>
 
 namespace {
 
-struct BuiltinVars final
-{
-  float u;
-  float v;
-};
-
-class FloatExpr
-{
-public:
-  virtual ~FloatExpr() = default;
-
-  virtual float Eval(const BuiltinVars&) const noexcept = 0;
-};
-
-class BinaryFloatExpr : public FloatExpr
+class CpuBackendImpl final : public CpuBackend
 {
 public:
-  BinaryFloatExpr(std::unique_ptr<FloatExpr> l, std::unique_ptr<FloatExpr> r)
-    : mLeft(std::move(l))
-    , mRight(std::move(r))
-  {}
-
-  virtual ~BinaryFloatExpr() = default;
-
-protected:
-  float EvalLeft(const BuiltinVars& builtins) const noexcept
-  {
-    return mLeft->Eval(builtins);
-  }
+  CpuBackendImpl() {}
 
-  float EvalRight(const BuiltinVars& builtins) const noexcept
+  bool ComputeHeightMap(const CancellationToken* token = nullptr) override
   {
-    return mRight->Eval(builtins);
-  }
+    auto& heightMap = mHeightMaps->GetBackBuffer();
 
-private:
-  std::unique_ptr<FloatExpr> mLeft;
+    heightMap.Resize(mWidth, mHeight);
 
-  std::unique_ptr<FloatExpr> mRight;
-};
+    auto* out = heightMap.data.data();
 
-class AddFloatExpr final : public BinaryFloatExpr
-{
-public:
-  using BinaryFloatExpr::BinaryFloatExpr;
+    if (!ComputeHeights(out, token))
+      return false;
 
-  float Eval(const BuiltinVars& builtins) const noexcept override
-  {
-    return EvalLeft(builtins) + EvalRight(builtins);
-  }
-};
+    mHeightMaps->Publish();
 
-class SubFloatExpr final : public BinaryFloatExpr
-{
-public:
-  using BinaryFloatExpr::BinaryFloatExpr;
+    for (auto& observer : mHeightMapObservers)
+      observer->Observe(out, mWidth, mHeight);
 
-  float Eval(const BuiltinVars& builtins) const noexcept override
-  {
-    return EvalLeft(builtins) - EvalRight(builtins);
+    return true;
   }
-};
 
-class MulFloatExpr final : public BinaryFloatExpr
-{
-public:
-  using BinaryFloatExpr::BinaryFloatExpr;
-
-  float Eval(const BuiltinVars& builtins) const noexcept override
+  bool ComputeHeights(float* out,
+                      const CancellationToken* token = nullptr) override
   {
-    return EvalLeft(builtins) * EvalRight(builtins);
-  }
-};
+    std::vector<float> uRow(mWidth);
 
-class DivFloatExpr final : public BinaryFloatExpr
-{
-public:
-  using BinaryFloatExpr::BinaryFloatExpr;
+    for (size_t x = 0; x < mWidth; x++)
+      uRow[x] = (x + 0.5f) / mWidth;
 
-  float Eval(const BuiltinVars& builtins) const noexcept override
-  {
-    return EvalLeft(builtins) / EvalRight(builtins);
-  }
-};
+    auto columns = mHeightMapProgram.EvalColumns(uRow.data(), mWidth);
 
-class FloatLiteral final : public FloatExpr
-{
-public:
-  FloatLiteral(float value)
-    : mValue(value)
-  {}
+    // A few bands per thread, so that a slow band does not leave the
+    // other threads idle at the end.
+    auto bandCount = size_t(mThreadPool->get_thread_count()) * 4;
 
-  float Eval(const BuiltinVars&) const noexcept override { return mValue; }
+    auto rowsPerBand = (mHeight + bandCount - 1) / bandCount;
 
-private:
-  float mValue;
-};
+    rowsPerBand = std::max<size_t>(rowsPerBand, 1);
 
-class UCoordExpr final : public FloatExpr
-{
-public:
-  float Eval(const BuiltinVars& builtinVars) const noexcept override
-  {
-    return builtinVars.u;
-  }
-};
+    std::vector<std::future<void>> bands;
 
-class VCoordExpr final : public FloatExpr
-{
-public:
-  float Eval(const BuiltinVars& builtinVars) const noexcept override
-  {
-    return builtinVars.v;
-  }
-};
+    for (size_t y = 0; y < mHeight; y += rowsPerBand) {
 
-class UnaryFloatExpr : public FloatExpr
-{
-public:
-  UnaryFloatExpr(std::unique_ptr<FloatExpr> innerExpr)
-    : mInnerExpr(std::move(innerExpr))
-  {}
+      auto yEnd = std::min(y + rowsPerBand, mHeight);
 
-protected:
-  float InnerEval(const BuiltinVars& builtins) const noexcept
-  {
-    return mInnerExpr->Eval(builtins);
-  }
-
-private:
-  std::unique_ptr<FloatExpr> mInnerExpr;
-};
-
-class SineExpr final : public UnaryFloatExpr
-{
-public:
-  using UnaryFloatExpr::UnaryFloatExpr;
+      auto band = [this, &uRow, &columns, y, yEnd, out, token]() {
+        ComputeRows(uRow, columns, y, yEnd, out, token);
+      };
 
-  float Eval(const BuiltinVars& builtins) const noexcept override
-  {
-    return sin(InnerEval(builtins));
-  }
-};
+      bands.emplace_back(mThreadPool->submit(band));
+    }
 
-class CosineExpr final : public UnaryFloatExpr
-{
-public:
-  using UnaryFloatExpr::UnaryFloatExpr;
+    for (auto& band : bands)
+      band.wait();
 
-  float Eval(const BuiltinVars& builtins) const noexcept override
-  {
-    return cos(InnerEval(builtins));
+    return !token || !token->IsCancelled();
   }
-};
 
-class TangentExpr final : public UnaryFloatExpr
-{
-public:
-  using UnaryFloatExpr::UnaryFloatExpr;
-
-  float Eval(const BuiltinVars& builtins) const noexcept override
+  void SetHeightProgram(Program program) override
   {
-    return tan(InnerEval(builtins));
+    mHeightMapProgram = std::move(program);
   }
-};
 
-class ArcsineExpr final : public UnaryFloatExpr
-{
-public:
-  using UnaryFloatExpr::UnaryFloatExpr;
+  auto GetThreadPool() -> thread_pool& override { return *mThreadPool; }
 
-  float Eval(const BuiltinVars& builtins) const noexcept override
+  void ComputeSurface() override
   {
-    return asin(InnerEval(builtins));
+    // TODO
   }
-};
-
-class ArccosineExpr final : public UnaryFloatExpr
-{
-public:
-  using UnaryFloatExpr::UnaryFloatExpr;
 
-  float Eval(const BuiltinVars& builtins) const noexcept override
+  auto GetHeightMapExchange() const
+    -> std::shared_ptr<HeightMapExchange> override
   {
-    return acos(InnerEval(builtins));
+    return mHeightMaps;
   }
-};
-
-class ArctangentExpr final : public UnaryFloatExpr
-{
-public:
-  using UnaryFloatExpr::UnaryFloatExpr;
 
-  float Eval(const BuiltinVars& builtins) const noexcept override
+  void Resize(size_t w, size_t h) override
   {
-    return atan(InnerEval(builtins));
-  }
-};
-
-class IntExpr
-{
-public:
-  virtual ~IntExpr() = default;
-
-  virtual int Eval(const BuiltinVars& builtinVars) const noexcept = 0;
-};
-
-class IntToFloatExpr final : public FloatExpr
-{
-public:
-  IntToFloatExpr(std::unique_ptr<IntExpr>&& intExpr)
-    : mIntExpr(std::move(intExpr))
-  {}
+    mWidth = w;
 
-  float Eval(const BuiltinVars& builtinVars) const noexcept override
-  {
-    return mIntExpr->Eval(builtinVars);
+    mHeight = h;
   }
 
-private:
-  std::unique_ptr<IntExpr> mIntExpr;
-};
-
-class IntLiteral final : public IntExpr
-{
-public:
-  IntLiteral(int value)
-    : mValue(value)
-  {}
-
-  int Eval(const BuiltinVars&) const noexcept override { return mValue; }
-
-private:
-  int mValue;
-};
-
-class FloatToInt final : public IntExpr
-{
-public:
-  FloatToInt(std::unique_ptr<FloatExpr>&& floatExpr)
-    : mFloatExpr(std::move(floatExpr))
-  {}
-
-  int Eval(const BuiltinVars& builtinVars) const noexcept override
+  bool UpdateHeightExpr(const ir::Expr* expr) override
   {
-    return mFloatExpr->Eval(builtinVars);
-  }
-
-private:
-  std::unique_ptr<FloatExpr> mFloatExpr;
-};
+    auto program = expr ? BuildProgram(*expr) : std::nullopt;
 
-class IntExprBuilder final : public ir::ExprVisitor
-{
-public:
-  auto TakeResult() -> std::unique_ptr<IntExpr> { return std::move(mExpr); }
+    if (!program) {
+      mHeightMapProgram = Program::MakeConstant(0.0f);
+      return false;
+    }
 
-  void Visit(const ir::FloatLiteralExpr&) override {}
+    mHeightMapProgram = std::move(*program);
 
-  void Visit(const ir::IntLiteralExpr& literalExpr) override
-  {
-    mExpr.reset(new IntLiteral(literalExpr.GetValue()));
+    return true;
   }
 
-  void Visit(const ir::VarRefExpr&) override {}
-
-  void Visit(const ir::IntToFloatExpr&) override {}
-
-  void Visit(const ir::FloatToIntExpr& floatToInt) override;
-
-  void Visit(const ir::UnaryTrigExpr&) override {}
-
-  void Visit(const ir::BinaryExpr& binaryExpr) override
+  bool UpdateColorExpr(const ir::Expr* expr) override
   {
+    (void)expr;
     // TODO
-    (void)binaryExpr;
-  }
-
-private:
-  std::unique_ptr<IntExpr> mExpr;
-};
-
-class FloatExprBuilder final : public ir::ExprVisitor
-{
-public:
-  auto TakeResult() -> std::unique_ptr<FloatExpr>
-  {
-    return std::move(mFloatExpr);
-  }
-
-  void Visit(const ir::VarRefExpr& varRefExpr) override
-  {
-    switch (varRefExpr.GetID()) {
-      case ir::VarRefExpr::ID::CenterUCoord:
-        mFloatExpr.reset(new UCoordExpr());
-        break;
-      case ir::VarRefExpr::ID::CenterVCoord:
-        mFloatExpr.reset(new VCoordExpr());
-        break;
-    }
-  }
-
-  void Visit(const ir::FloatLiteralExpr& floatLiteralExpr) override
-  {
-    mFloatExpr.reset(new FloatLiteral(floatLiteralExpr.GetValue()));
-  }
-
-  void Visit(const ir::IntToFloatExpr& expr) override
-  {
-    IntExprBuilder intExprBuilder;
-
-    expr.GetSourceExpr().Accept(intExprBuilder);
-
-    auto intExpr = intExprBuilder.TakeResult();
-
-    if (!intExpr)
-      return;
-
-    mFloatExpr.reset(new IntToFloatExpr(std::move(intExpr)));
+    return false;
   }
 
-  void Visit(const ir::UnaryTrigExpr& trigExpr) override
+  void SetThreadCount(size_t threadCount) override
   {
-    FloatExprBuilder subBuilder;
-
-    trigExpr.GetInputExpr().Accept(subBuilder);
+    if (!threadCount)
+      threadCount = std::thread::hardware_concurrency();
 
-    auto operand = subBuilder.TakeResult();
-
-    if (!operand)
-      return;
-
-    switch (trigExpr.GetID()) {
-      case ir::UnaryTrigExpr::ID::Sine:
-        mFloatExpr.reset(new SineExpr(std::move(operand)));
-        break;
-      case ir::UnaryTrigExpr::ID::Cosine:
-        mFloatExpr.reset(new CosineExpr(std::move(operand)));
-        break;
-      case ir::UnaryTrigExpr::ID::Tangent:
-        mFloatExpr.reset(new TangentExpr(std::move(operand)));
-        break;
-      case ir::UnaryTrigExpr::ID::Arcsine:
-        mFloatExpr.reset(new ArcsineExpr(std::move(operand)));
-        break;
-      case ir::UnaryTrigExpr::ID::Arccosine:
-        mFloatExpr.reset(new ArccosineExpr(std::move(operand)));
-        break;
-      case ir::UnaryTrigExpr::ID::Arctangent:
-        mFloatExpr.reset(new ArctangentExpr(std::move(operand)));
-        break;
-    }
+    mThreadPool.reset(new thread_pool(ui32(threadCount)));
   }
 
-  void Visit(const ir::IntLiteralExpr&) override {}
-
-  void Visit(const ir::FloatToIntExpr&) override {}
-
-  void Visit(const ir::BinaryExpr& binaryExpr) override
+  void ReadHeightMap(float* buf) const override
   {
-    auto lExpr = BuildSubExpr(binaryExpr.GetLeftExpr());
-    auto rExpr = BuildSubExpr(binaryExpr.GetRightExpr());
-
-    if (!lExpr || !rExpr)
-      return;
+    const auto& heightMap = mHeightMaps->GetPublished();
 
-    switch (binaryExpr.GetID()) {
-      case ir::BinaryExpr::ID::Add:
-        mFloatExpr.reset(new AddFloatExpr(std::move(lExpr), std::move(rExpr)));
-        break;
-      case ir::BinaryExpr::ID::Sub:
-        mFloatExpr.reset(new SubFloatExpr(std::move(lExpr), std::move(rExpr)));
-        break;
-      case ir::BinaryExpr::ID::Mul:
-        mFloatExpr.reset(new MulFloatExpr(std::move(lExpr), std::move(rExpr)));
-        break;
-      case ir::BinaryExpr::ID::Div:
-        mFloatExpr.reset(new DivFloatExpr(std::move(lExpr), std::move(rExpr)));
-        break;
-    }
+    std::copy(heightMap.data.begin(), heightMap.data.end(), buf);
   }
 
-private:
-  static auto BuildSubExpr(const ir::Expr& expr) -> std::unique_ptr<FloatExpr>
+  void AddHeightMapObserver(
+    std::unique_ptr<HeightMapObserver> observer) override
   {
-    FloatExprBuilder builder;
-
-    expr.Accept(builder);
-
-    return builder.TakeResult();
+    mHeightMapObservers.emplace_back(std::move(observer));
   }
 
 private:
-  std::unique_ptr<FloatExpr> mFloatExpr;
-};
-
-void
-IntExprBuilder::Visit(const ir::FloatToIntExpr& floatToInt)
-{
-  FloatExprBuilder floatExprBuilder;
-
-  floatToInt.GetSourceExpr().Accept(floatExprBuilder);
-
-  auto floatExpr = floatExprBuilder.TakeResult();
-
-  if (!floatExpr)
-    return;
-
-  mExpr.reset(new FloatToInt(std::move(floatExpr)));
-}
-
-class CpuBackendImpl final : public CpuBackend
-{
-public:
-  CpuBackendImpl() {}
+  /// The size of the blocks that are checked for a constant height, in
+  /// both directions.
+  static constexpr size_t BlockSize() noexcept { return 64; }
 
-  void ComputeHeightMap() override
+  void ComputeRows(const std::vector<float>& uRow,
+                   const std::vector<float>& columns,
+                   size_t y,
+                   size_t yEnd,
+                   float* out,
+                   const CancellationToken* token)
   {
-    if (!mHeightMapExpr)
-      mHeightMapExpr.reset(new FloatLiteral(0.0));
+    auto registers = mHeightMapProgram.MakeBatchRegisters();
 
-    BuiltinVars builtinVars;
+    for (; y < yEnd; y += BlockSize()) {
 
-    for (size_t i = 0; i < (mWidth * mHeight); i++) {
+      auto blockYEnd = std::min(y + BlockSize(), yEnd);
 
-      size_t x = i % mWidth;
-      size_t y = i / mWidth;
+      for (size_t x = 0; x < mWidth; x += BlockSize()) {
 
-      builtinVars.u = (x + 0.5f) / mWidth;
-      builtinVars.v = (y + 0.5f) / mHeight;
+        // Checked once per block, so that a cancelled computation stops
+        // within a few thousand points on each thread.
+        if (token && token->IsCancelled())
+          return;
 
-      mHeightMap[i] = mHeightMapExpr->Eval(builtinVars);
-    }
-
-    for (auto& observer : mHeightMapObservers)
-      observer->Observe(mHeightMap.data(), mWidth, mHeight);
-  }
+        auto blockXEnd = std::min(x + BlockSize(), mWidth);
 
-  void ComputeSurface() override
-  {
-    // TODO
+        ComputeBlock(
+          uRow, columns, x, blockXEnd, y, blockYEnd, out, registers);
+      }
+    }
   }
 
-  void Resize(size_t w, size_t h) override
+  /// @brief Computes a block of the height map. If the bounds of the height
+  /// over the block show that it is constant, only one point is evaluated and
+  /// the rest of the block is filled with it.
+  void ComputeBlock(const std::vector<float>& uRow,
+                    const std::vector<float>& columns,
+                    size_t x,
+                    size_t xEnd,
+                    size_t y,
+                    size_t yEnd,
+                    float* out,
+                    std::vector<float>& registers)
   {
-    mHeightMap.resize(w * h);
-
-    mWidth = w;
+    auto vCoord = [this](size_t row) { return (row + 0.5f) / mHeight; };
 
-    mHeight = h;
-  }
-
-  bool UpdateHeightExpr(const ir::Expr* expr) override
-  {
-    if (!expr) {
-      mHeightMapExpr = std::unique_ptr<FloatExpr>(new FloatLiteral(0.0f));
-      return false;
-    }
+    // Programs that do not read any columns get an empty vector.
+    const auto* blockColumns = columns.empty() ? nullptr : &columns[x];
 
-    FloatExprBuilder floatExprBuilder;
+    // The coordinates grow with the index, so the end points bound them.
+    ir::Interval u{ uRow[x], uRow[xEnd - 1], false };
 
-    expr->Accept(floatExprBuilder);
+    ir::Interval v{ vCoord(y), vCoord(yEnd - 1), false };
 
-    auto result = floatExprBuilder.TakeResult();
+    auto bounds = mHeightMapProgram.EvalBounds(u, v);
 
-    if (!result) {
-      mHeightMapExpr = std::unique_ptr<FloatExpr>(new FloatLiteral(0.0f));
-      return false;
-    }
+    if (bounds.IsConstant()) {
 
-    mHeightMapExpr = std::move(result);
+      // Evaluated rather than taken from the bounds, so that the sign of a
+      // zero matches the other blocks.
+      float value = 0;
 
-    return true;
-  }
+      mHeightMapProgram.EvalRow(uRow.data() + x,
+                                vCoord(y),
+                                blockColumns,
+                                mWidth,
+                                &value,
+                                1,
+                                registers.data());
 
-  bool UpdateColorExpr(const ir::Expr* expr) override
-  {
-    (void)expr;
-    // TODO
-    return false;
-  }
+      for (size_t row = y; row < yEnd; row++) {
+        auto* line = out + (row * mWidth);
+        std::fill(line + x, line + xEnd, value);
+      }
 
-  void ReadHeightMap(float* buf) const override
-  {
-    for (size_t i = 0; i < mHeightMap.size(); i++)
-      buf[i] = mHeightMap[i];
-  }
+      return;
+    }
 
-  void AddHeightMapObserver(
-    std::unique_ptr<HeightMapObserver> observer) override
-  {
-    mHeightMapObservers.emplace_back(std::move(observer));
+    for (size_t row = y; row < yEnd; row++) {
+      mHeightMapProgram.EvalRow(uRow.data() + x,
+                                vCoord(row),
+                                blockColumns,
+                                mWidth,
+                                out + (row * mWidth) + x,
+                                xEnd - x,
+                                registers.data());
+    }
   }
 
 private:
+  std::unique_ptr<thread_pool> mThreadPool{ new thread_pool() };
+
   std::vector<std::unique_ptr<HeightMapObserver>> mHeightMapObservers;
 
-  std::unique_ptr<FloatExpr> mHeightMapExpr;
+  Program mHeightMapProgram = Program::MakeConstant(0.0f);
 
-  std::vector<float> mHeightMap;
+  std::shared_ptr<HeightMapExchange> mHeightMaps{ new HeightMapExchange() };
 
   size_t mWidth = 0;
 
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "core/Backend.h"
+#include "core/Program.h"
+
+class thread_pool;
 
 class CpuBackend : public Backend
 {
@@ -8,4 +11,19 @@ public:
   static auto Make() -> CpuBackend*;
 
   virtual ~CpuBackend() = default;
+
+  /// @brief Computes the height map into @p out, one row after another,
+  /// without publishing it or notifying the observers.
+  ///
+  /// @return False if the computation was cancelled.
+  virtual bool ComputeHeights(float* out,
+                              const CancellationToken* token = nullptr) = 0;
+
+  /// @brief Sets the program of the height map, for callers that have
+  /// already built it from the height expression.
+  virtual void SetHeightProgram(Program program) = 0;
+
+  /// @return The pool that the height map is computed on. It is replaced by
+  /// @ref Backend::SetThreadCount.
+  virtual auto GetThreadPool() -> thread_pool& = 0;
 };
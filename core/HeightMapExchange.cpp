@@ -0,0 +1,90 @@
+#include "core/HeightMapExchange.h"
+
+#include <algorithm>
+
+#include <string.h>
+
+namespace {
+
+/// @return True if the values of a tile are the same in both height maps.
+/// Bits are compared rather than values, so that NaN is not a change.
+bool
+TileIsEqual(const HeightMap& a, const HeightMap& b, size_t x, size_t y)
+{
+  auto tileW = std::min(HeightMap::TileSize(), a.w - x);
+  auto tileH = std::min(HeightMap::TileSize(), a.h - y);
+
+  for (auto row = y; row < (y + tileH); row++) {
+
+    const auto* rowA = &a.data[(row * a.w) + x];
+    const auto* rowB = &b.data[(row * b.w) + x];
+
+    if (memcmp(rowA, rowB, tileW * sizeof(float)) != 0)
+      return false;
+  }
+
+  return true;
+}
+
+/// Gives @p heightMap the versions of @p previous for the tiles that did not
+/// change, and @p version for the others.
+void
+UpdateTileVersions(HeightMap& heightMap,
+                   const HeightMap& previous,
+                   uint64_t version)
+{
+  auto tilesPerRow = heightMap.TilesPerRow();
+
+  auto tileCount = tilesPerRow * heightMap.TilesPerColumn();
+
+  heightMap.tileVersions.resize(tileCount);
+
+  auto comparable = (&heightMap != &previous) &&
+                    (heightMap.w == previous.w) &&
+                    (heightMap.h == previous.h) &&
+                    (previous.tileVersions.size() == tileCount);
+
+  for (size_t i = 0; i < tileCount; i++) {
+
+    auto x = (i % tilesPerRow) * HeightMap::TileSize();
+    auto y = (i / tilesPerRow) * HeightMap::TileSize();
+
+    if (comparable && TileIsEqual(heightMap, previous, x, y))
+      heightMap.tileVersions[i] = previous.tileVersions[i];
+    else
+      heightMap.tileVersions[i] = version;
+  }
+}
+
+} // namespace
+
+void
+HeightMapExchange::Publish()
+{
+  mVersion++;
+
+  UpdateTileVersions(mBuffers[mBack], mBuffers[mPublished], mVersion);
+
+  mPublished = mBack;
+
+  // Releases the height map to the consumer, and acquires the buffer the
+  // consumer may have just stopped reading.
+  auto order = std::memory_order_acq_rel;
+
+  auto previous = mMiddle.exchange(mBack | NewFlag(), order);
+
+  mBack = previous & IndexMask();
+}
+
+bool
+HeightMapExchange::Acquire() noexcept
+{
+  if (!(mMiddle.load(std::memory_order_relaxed) & NewFlag()))
+    return false;
+
+  auto previous = mMiddle.exchange(mFront, std::memory_order_acq_rel);
+
+  mFront = previous & IndexMask();
+
+  return true;
+}
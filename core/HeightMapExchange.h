@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// A height map of @ref HeightMap::w by @ref HeightMap::h values.
+struct HeightMap final
+{
+  std::vector<float> data;
+
+  size_t w = 0;
+
+  size_t h = 0;
+
+  /// For each tile, row by row, the number of the publication in which its
+  /// values last changed. Set by @ref HeightMapExchange::Publish.
+  std::vector<uint64_t> tileVersions;
+
+  /// The number of values along each side of a tile. Tiles on the right and
+  /// bottom edges may be smaller.
+  static constexpr size_t TileSize() noexcept { return 64; }
+
+  auto TilesPerRow() const noexcept -> size_t
+  {
+    return (w + TileSize() - 1) / TileSize();
+  }
+
+  auto TilesPerColumn() const noexcept -> size_t
+  {
+    return (h + TileSize() - 1) / TileSize();
+  }
+
+  /// Changes the size. The values are left unspecified.
+  void Resize(size_t width, size_t height)
+  {
+    data.resize(width * height);
+    w = width;
+    h = height;
+  }
+};
+
+/// @brief Hands complete height maps from the thread that computes them to
+/// the thread that renders them, without copying and without either thread
+/// waiting for the other.
+///
+/// @details There are three buffers: the producer writes to the back buffer,
+/// the consumer reads from the front buffer and the third one holds the
+/// latest height map that was published. Publishing and acquiring swap a
+/// buffer with the third one in a single atomic operation. If the producer
+/// publishes again before the consumer acquires, the older height map is
+/// simply reused as the next back buffer.
+///
+/// There may only be one producer thread and one consumer thread.
+class HeightMapExchange final
+{
+public:
+  /// Called by the producer.
+  ///
+  /// @return The buffer to compute the next height map into. It may contain
+  /// an older height map of any size.
+  auto GetBackBuffer() noexcept -> HeightMap& { return mBuffers[mBack]; }
+
+  /// @brief Makes the back buffer available to the consumer and replaces it
+  /// with one the consumer is not using. Called by the producer.
+  ///
+  /// @details The tiles of the back buffer that differ from the height map
+  /// published last get a new version, so the consumer can tell which parts
+  /// changed since the last height map it acquired, even if it skipped some.
+  void Publish();
+
+  /// Called by the producer.
+  ///
+  /// @return The height map that was published last. The consumer may be
+  /// reading it as well, so it must not be modified.
+  auto GetPublished() const noexcept -> const HeightMap&
+  {
+    return mBuffers[mPublished];
+  }
+
+  /// @brief Makes the latest height map the front buffer, if one was
+  /// published since the last call. Called by the consumer.
+  ///
+  /// @return True if the front buffer changed.
+  bool Acquire() noexcept;
+
+  /// Called by the consumer.
+  ///
+  /// @return The height map acquired last, which is empty if none was.
+  auto GetFrontBuffer() const noexcept -> const HeightMap&
+  {
+    return mBuffers[mFront];
+  }
+
+private:
+  /// Set in @ref HeightMapExchange::mMiddle when the buffer it refers to has
+  /// not been acquired yet.
+  static constexpr uint8_t NewFlag() noexcept { return 4; }
+
+  static constexpr uint8_t IndexMask() noexcept { return 3; }
+
+  std::array<HeightMap, 3> mBuffers;
+
+  /// Only accessed by the producer.
+  uint8_t mBack = 0;
+
+  /// Only accessed by the producer.
+  uint8_t mPublished = 0;
+
+  /// The number of publications so far. Only accessed by the producer.
+  uint64_t mVersion = 0;
+
+  /// Only accessed by the consumer.
+  uint8_t mFront = 1;
+
+  /// The index of the buffer in between, along with @ref NewFlag.
+  std::atomic<uint8_t> mMiddle{ 2 };
+};
@@ -8,5 +8,11 @@ class HeightMapObserver
 public:
   virtual ~HeightMapObserver() = default;
 
+  /// Called from the thread computing the height map, once it has been
+  /// published to the backend's @ref HeightMapExchange.
+  ///
+  /// @param data The published height map, which is only guaranteed to stay
+  /// valid during the call. Renderers on other threads should acquire it from
+  /// the exchange instead.
   virtual void Observe(const float* data, size_t w, size_t h) = 0;
 };
@@ -0,0 +1,744 @@
+#include "core/JitBackend.h"
+
+#include "core/CpuBackend.h"
+#include "core/HeightMapExchange.h"
+#include "core/HeightMapObserver.h"
+#include "core/Program.h"
+#include "core/ProgramBuilder.h"
+
+#include <terra/cancellation_token.h>
+
+#include <thread_pool.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+namespace fs = std::filesystem;
+
+/// Evaluates the instructions that only depend on u, see
+/// @ref Program::EvalColumns.
+using ColumnsFunc = void (*)(const float* u, float* columns, size_t n);
+
+/// Evaluates a row of points, see @ref Program::EvalRow.
+using RowFunc = void (*)(const float* u,
+                         float v,
+                         const float* columns,
+                         float* out,
+                         size_t n);
+
+/// @return A C literal with exactly the same value.
+auto
+FormatFloat(float value) -> std::string
+{
+  if (isnan(value))
+    return "NAN";
+
+  if (isinf(value))
+    return (value < 0) ? "-INFINITY" : "INFINITY";
+
+  char buf[64];
+
+  snprintf(buf, sizeof(buf), "%af", double(value));
+
+  return buf;
+}
+
+auto
+FormatInstruction(const Program::Instruction& inst) -> std::string
+{
+  auto reg = [](uint32_t index) { return "r" + std::to_string(index); };
+
+  auto binary = [&](const char* op) {
+    return reg(inst.dst) + " = " + reg(inst.lhs) + op + reg(inst.rhs) + ";";
+  };
+
+  auto unary = [&](const char* func) {
+    return reg(inst.dst) + " = " + func + "(" + reg(inst.lhs) + ");";
+  };
+
+  switch (inst.op) {
+    case Program::Opcode::Add:
+      return binary(" + ");
+    case Program::Opcode::Sub:
+      return binary(" - ");
+    case Program::Opcode::Mul:
+      return binary(" * ");
+    case Program::Opcode::Div:
+      return binary(" / ");
+    case Program::Opcode::Sine:
+      return unary("sinf");
+    case Program::Opcode::Cosine:
+      return unary("cosf");
+    case Program::Opcode::Tangent:
+      return unary("tanf");
+    case Program::Opcode::Arcsine:
+      return unary("asinf");
+    case Program::Opcode::Arccosine:
+      return unary("acosf");
+    case Program::Opcode::Arctangent:
+      return unary("atanf");
+    case Program::Opcode::Truncate:
+      return unary("truncf");
+  }
+
+  return "";
+}
+
+/// @brief Lowers a program to C, one local variable per register.
+///
+/// @details The generated functions mirror @ref Program::EvalColumns and
+/// @ref Program::EvalRow, so that the values that only depend on u or v are
+/// still computed once per column or row. The float versions of the math
+/// functions are the ones the interpreter calls, so the results match.
+auto
+GenerateSource(const Program& program) -> std::string
+{
+  const auto& instructions = program.GetInstructions();
+
+  const auto& constants = program.GetConstants();
+
+  const auto& columnRegs = program.GetColumnRegs();
+
+  std::ostringstream stream;
+
+  auto declareRegisters = [&]() {
+    for (size_t i = 0; i < program.GetRegisterCount(); i++) {
+
+      auto isConstant = (i >= 2) && ((i - 2) < constants.size());
+
+      auto value = isConstant ? FormatFloat(constants[i - 2]) : "0";
+
+      stream << "  float r" << i << " = " << value << ";\n";
+    }
+  };
+
+  auto emit = [&](size_t begin, size_t end, const char* indent) {
+    for (size_t i = begin; i < end; i++)
+      stream << indent << FormatInstruction(instructions[i]) << "\n";
+  };
+
+  stream << "#include <math.h>\n";
+  stream << "#include <stddef.h>\n";
+  stream << "\n";
+  stream << "void mapgen_columns(const float* u, float* columns, size_t n)\n";
+  stream << "{\n";
+
+  declareRegisters();
+
+  stream << "  for (size_t i = 0; i < n; i++) {\n";
+  stream << "    r0 = u[i];\n";
+
+  emit(0, program.GetColumnEnd(), "    ");
+
+  for (size_t i = 0; i < columnRegs.size(); i++)
+    stream << "    columns[" << i << " * n + i] = r" << columnRegs[i] << ";\n";
+
+  stream << "  }\n";
+  stream << "}\n";
+  stream << "\n";
+  stream << "void mapgen_row(const float* u, float v, const float* columns, "
+            "float* out, size_t n)\n";
+  stream << "{\n";
+
+  declareRegisters();
+
+  stream << "  r1 = v;\n";
+
+  emit(0, program.GetConstantEnd(), "  ");
+
+  emit(program.GetColumnEnd(), program.GetRowEnd(), "  ");
+
+  stream << "  for (size_t i = 0; i < n; i++) {\n";
+  stream << "    r0 = u[i];\n";
+
+  for (size_t i = 0; i < columnRegs.size(); i++)
+    stream << "    r" << columnRegs[i] << " = columns[" << i << " * n + i];\n";
+
+  emit(program.GetRowEnd(), instructions.size(), "    ");
+
+  stream << "    out[i] = r" << program.GetResultReg() << ";\n";
+  stream << "  }\n";
+  stream << "}\n";
+
+  return stream.str();
+}
+
+/// FNV-1a, which unlike std::hash is the same across runs.
+auto
+Hash(const std::string& str) noexcept -> uint64_t
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  for (auto c : str) {
+    hash ^= uint8_t(c);
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+/// @return The compiler from the CC environment variable, or "cc" if it is
+/// not set.
+auto
+GetCompiler() -> std::string
+{
+  const char* compiler = getenv("CC");
+
+  return (compiler && *compiler) ? compiler : "cc";
+}
+
+/// Contraction into fused multiply-adds would change the results.
+auto
+CompilerFlags() -> std::string
+{
+  return "-O2 -fPIC -shared -ffp-contract=off";
+}
+
+#ifndef _WIN32
+
+/// @return True if @p path is of file type @p type, is owned by the current
+/// user and cannot be written by anyone else. Symbolic links are not
+/// followed.
+bool
+IsPrivate(const fs::path& path, mode_t type)
+{
+  struct stat info;
+
+  if (lstat(path.c_str(), &info) != 0)
+    return false;
+
+  return ((info.st_mode & S_IFMT) == type) && (info.st_uid == geteuid()) &&
+         !(info.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+/// @return The directory that compiled objects are cached in, which is in
+/// the cache directory of the user, or an empty path if there is no such
+/// directory or if it is not private to the user.
+auto
+GetCacheDirectory() -> fs::path
+{
+  fs::path base;
+
+  const char* cacheHome = getenv("XDG_CACHE_HOME");
+
+  const char* home = getenv("HOME");
+
+  if (cacheHome && (cacheHome[0] == '/'))
+    base = cacheHome;
+  else if (home && (home[0] == '/'))
+    base = fs::path(home) / ".cache";
+  else
+    return fs::path();
+
+  std::error_code errorCode;
+
+  fs::create_directories(base, errorCode);
+
+  auto dir = base / "mapgen-jit";
+
+  if ((mkdir(dir.c_str(), 0700) != 0) && (errno != EEXIST))
+    return fs::path();
+
+  return IsPrivate(dir, S_IFDIR) ? dir : fs::path();
+}
+
+/// @return A new directory in the temporary directory that only the current
+/// user can access, or an empty path if it could not be created.
+auto
+MakePrivateTempDirectory() -> fs::path
+{
+  std::error_code errorCode;
+
+  auto pattern = (fs::temp_directory_path(errorCode) / "mapgen-jit-XXXXXX");
+
+  if (errorCode)
+    return fs::path();
+
+  auto buf = pattern.string();
+
+  // Created with mode 0700.
+  if (!mkdtemp(&buf[0]))
+    return fs::path();
+
+  return buf;
+}
+
+auto
+ReadFile(const fs::path& path) -> std::string
+{
+  std::ifstream file(path, std::ios::binary);
+
+  return std::string(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+}
+
+/// @brief Compiles @p source into a shared object. The source is written to
+/// @p basePath with a ".c" extension and the object gets a ".so" extension.
+///
+/// @return False if the source could not be compiled, in which case neither
+/// file is left behind.
+bool
+Compile(const std::string& source, const fs::path& basePath)
+{
+  auto sourcePath = fs::path(basePath).concat(".c");
+
+  auto objectPath = fs::path(basePath).concat(".so");
+
+  std::ofstream(sourcePath, std::ios::binary) << source;
+
+  std::ostringstream command;
+  command << GetCompiler() << " " << CompilerFlags();
+  command << " -o \"" << objectPath.string() << "\"";
+  command << " \"" << sourcePath.string() << "\"";
+  command << " -lm > /dev/null 2>&1";
+
+  if (system(command.str().c_str()) == 0)
+    return true;
+
+  std::error_code errorCode;
+
+  fs::remove(sourcePath, errorCode);
+
+  fs::remove(objectPath, errorCode);
+
+  return false;
+}
+
+#endif // _WIN32
+
+class Kernel final
+{
+public:
+  /// @return Null if the program could not be compiled or loaded.
+  static auto Load(const Program& program) -> std::unique_ptr<Kernel>;
+
+  ~Kernel()
+  {
+#ifndef _WIN32
+    dlclose(mHandle);
+#endif
+  }
+
+  /// @return The number of values computed per column.
+  auto GetColumnCount() const noexcept -> size_t { return mColumnCount; }
+
+  void EvalColumns(const float* u, float* columns, size_t n) const noexcept
+  {
+    mColumnsFunc(u, columns, n);
+  }
+
+  void EvalRow(const float* u,
+               float v,
+               const float* columns,
+               float* out,
+               size_t n) const noexcept
+  {
+    mRowFunc(u, v, columns, out, n);
+  }
+
+private:
+  Kernel() = default;
+
+#ifndef _WIN32
+  /// @return Null if the object could not be loaded.
+  static auto Open(const fs::path& path, const Program& program)
+    -> std::unique_ptr<Kernel>;
+#endif
+
+  void* mHandle = nullptr;
+
+  ColumnsFunc mColumnsFunc = nullptr;
+
+  RowFunc mRowFunc = nullptr;
+
+  size_t mColumnCount = 0;
+};
+
+auto
+Kernel::Load(const Program& program) -> std::unique_ptr<Kernel>
+{
+#ifdef _WIN32
+  (void)program;
+  return nullptr;
+#else
+  auto source = GenerateSource(program);
+
+  std::ostringstream name;
+  name << std::hex << Hash(GetCompiler() + CompilerFlags() + source);
+
+  std::error_code errorCode;
+
+  auto cacheDir = GetCacheDirectory();
+
+  if (cacheDir.empty()) {
+
+    // Without a cache, the object is compiled in a directory of its own,
+    // which is removed once the object is loaded.
+    auto dir = MakePrivateTempDirectory();
+
+    if (dir.empty())
+      return nullptr;
+
+    std::unique_ptr<Kernel> kernel;
+
+    if (Compile(source, dir / "kernel"))
+      kernel = Open(dir / "kernel.so", program);
+
+    fs::remove_all(dir, errorCode);
+
+    return kernel;
+  }
+
+  auto sourcePath = cacheDir / (name.str() + ".c");
+
+  auto objectPath = cacheDir / (name.str() + ".so");
+
+  // The source is kept next to the object, so that an object of another
+  // source with the same hash is never loaded.
+  if (!IsPrivate(objectPath, S_IFREG) || !IsPrivate(sourcePath, S_IFREG) ||
+      (ReadFile(sourcePath) != source)) {
+
+    // Compiled under a name of its own and then renamed, so that other
+    // processes never load a partially written object. The source is
+    // renamed last, since it is what vouches for the object. The counter
+    // keeps compilations on other threads out of the way.
+    static std::atomic<unsigned> compileCount{ 0 };
+
+    auto tmpName = name.str() + "." + std::to_string(getpid()) + "." +
+                   std::to_string(compileCount++);
+
+    auto tmpPath = cacheDir / tmpName;
+
+    if (!Compile(source, tmpPath))
+      return nullptr;
+
+    fs::rename(fs::path(tmpPath).concat(".so"), objectPath, errorCode);
+
+    if (!errorCode)
+      fs::rename(fs::path(tmpPath).concat(".c"), sourcePath, errorCode);
+
+    if (errorCode) {
+      fs::remove(fs::path(tmpPath).concat(".so"), errorCode);
+      fs::remove(fs::path(tmpPath).concat(".c"), errorCode);
+      return nullptr;
+    }
+  }
+
+  return Open(objectPath, program);
+#endif
+}
+
+#ifndef _WIN32
+
+auto
+Kernel::Open(const fs::path& path, const Program& program)
+  -> std::unique_ptr<Kernel>
+{
+  auto* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+  if (!handle)
+    return nullptr;
+
+  std::unique_ptr<Kernel> kernel(new Kernel());
+
+  kernel->mHandle = handle;
+
+  kernel->mColumnCount = program.GetColumnRegs().size();
+
+  kernel->mColumnsFunc = (ColumnsFunc)dlsym(handle, "mapgen_columns");
+
+  kernel->mRowFunc = (RowFunc)dlsym(handle, "mapgen_row");
+
+  if (!kernel->mColumnsFunc || !kernel->mRowFunc)
+    return nullptr;
+
+  return kernel;
+}
+
+#endif // _WIN32
+
+/// A kernel that is compiled on a thread of its own, so that a slow
+/// compiler holds up neither the caller nor the computation. The job is
+/// shared with the thread, so a backend that is destroyed or given a new
+/// expression can leave it to finish on its own.
+struct CompileJob final
+{
+  std::mutex mutex;
+
+  std::condition_variable finished;
+
+  bool done = false;
+
+  std::unique_ptr<Kernel> kernel;
+};
+
+class JitBackendImpl final : public JitBackend
+{
+public:
+  bool ComputeHeightMap(const CancellationToken* token = nullptr) override
+  {
+    StartCompile();
+
+    TakeKernel(/* wait = */ false);
+
+    auto& heightMap = mHeightMaps->GetBackBuffer();
+
+    heightMap.Resize(mWidth, mHeight);
+
+    auto* out = heightMap.data.data();
+
+    auto done = mKernel ? ComputeWithKernel(out, token)
+                        : mFallback->ComputeHeights(out, token);
+
+    if (!done)
+      return false;
+
+    mHeightMaps->Publish();
+
+    for (auto& observer : mHeightMapObservers)
+      observer->Observe(out, mWidth, mHeight);
+
+    return true;
+  }
+
+  void ComputeSurface() override { mFallback->ComputeSurface(); }
+
+  bool IsCompiled() const noexcept override { return mKernel != nullptr; }
+
+  bool WaitForCompile() override
+  {
+    StartCompile();
+
+    TakeKernel(/* wait = */ true);
+
+    return IsCompiled();
+  }
+
+  auto GetHeightMapExchange() const
+    -> std::shared_ptr<HeightMapExchange> override
+  {
+    return mHeightMaps;
+  }
+
+  void Resize(size_t w, size_t h) override
+  {
+    mFallback->Resize(w, h);
+
+    mWidth = w;
+
+    mHeight = h;
+  }
+
+  bool UpdateHeightExpr(const ir::Expr* expr) override
+  {
+    // Called from the UI thread, so the program is only built here and
+    // compiled by the next computation.
+    mKernel.reset();
+
+    mCompileJob.reset();
+
+    mPendingProgram.reset();
+
+    auto program = expr ? BuildProgram(*expr) : std::nullopt;
+
+    if (!program) {
+      mFallback->SetHeightProgram(Program::MakeConstant(0.0f));
+      return false;
+    }
+
+    mPendingProgram = *program;
+
+    // The fallback computes the height map until the kernel is loaded, or
+    // for good if the compiler fails.
+    mFallback->SetHeightProgram(std::move(*program));
+
+    return true;
+  }
+
+  bool UpdateColorExpr(const ir::Expr* expr) override
+  {
+    return mFallback->UpdateColorExpr(expr);
+  }
+
+  void SetThreadCount(size_t threadCount) override
+  {
+    mFallback->SetThreadCount(threadCount);
+  }
+
+  void ReadHeightMap(float* buf) const override
+  {
+    const auto& heightMap = mHeightMaps->GetPublished();
+
+    std::copy(heightMap.data.begin(), heightMap.data.end(), buf);
+  }
+
+  void AddHeightMapObserver(
+    std::unique_ptr<HeightMapObserver> observer) override
+  {
+    mHeightMapObservers.emplace_back(std::move(observer));
+  }
+
+private:
+  /// Starts compiling the pending program, if there is one.
+  void StartCompile()
+  {
+    if (!mPendingProgram)
+      return;
+
+    auto job = std::make_shared<CompileJob>();
+
+    std::thread([job, program = std::move(*mPendingProgram)]() {
+      auto kernel = Kernel::Load(program);
+
+      std::lock_guard<std::mutex> lock(job->mutex);
+
+      job->kernel = std::move(kernel);
+
+      job->done = true;
+
+      job->finished.notify_all();
+    }).detach();
+
+    mPendingProgram.reset();
+
+    mCompileJob = std::move(job);
+  }
+
+  /// @brief Takes the kernel of the running compilation once it is done.
+  ///
+  /// @param wait Whether to wait for the compilation to finish.
+  void TakeKernel(bool wait)
+  {
+    if (!mCompileJob)
+      return;
+
+    std::unique_lock<std::mutex> lock(mCompileJob->mutex);
+
+    if (wait)
+      mCompileJob->finished.wait(lock, [this] { return mCompileJob->done; });
+
+    if (!mCompileJob->done)
+      return;
+
+    mKernel = std::move(mCompileJob->kernel);
+
+    lock.unlock();
+
+    mCompileJob.reset();
+  }
+
+  bool ComputeWithKernel(float* out, const CancellationToken* token)
+  {
+    std::vector<float> uRow(mWidth);
+
+    for (size_t x = 0; x < mWidth; x++)
+      uRow[x] = (x + 0.5f) / mWidth;
+
+    std::vector<float> columns(mKernel->GetColumnCount() * mWidth);
+
+    mKernel->EvalColumns(uRow.data(), columns.data(), mWidth);
+
+    // Shares the pool of the fallback, so that there is only one set of
+    // threads to size.
+    auto& threadPool = mFallback->GetThreadPool();
+
+    // A few bands per thread, so that a slow band does not leave the
+    // other threads idle at the end.
+    auto bandCount = size_t(threadPool.get_thread_count()) * 4;
+
+    auto rowsPerBand = (mHeight + bandCount - 1) / bandCount;
+
+    rowsPerBand = std::max<size_t>(rowsPerBand, 1);
+
+    std::vector<std::future<void>> bands;
+
+    for (size_t y = 0; y < mHeight; y += rowsPerBand) {
+
+      auto yEnd = std::min(y + rowsPerBand, mHeight);
+
+      auto band = [this, &uRow, &columns, y, yEnd, out, token]() {
+        for (size_t row = y; row < yEnd; row++) {
+
+          if (token && token->IsCancelled())
+            return;
+
+          mKernel->EvalRow(uRow.data(),
+                           (row + 0.5f) / mHeight,
+                           columns.data(),
+                           out + (row * mWidth),
+                           mWidth);
+        }
+      };
+
+      bands.emplace_back(threadPool.submit(band));
+    }
+
+    for (auto& band : bands)
+      band.wait();
+
+    return !token || !token->IsCancelled();
+  }
+
+private:
+  std::unique_ptr<CpuBackend> mFallback{ CpuBackend::Make() };
+
+  std::unique_ptr<Kernel> mKernel;
+
+  /// The program to compile on the next computation.
+  std::optional<Program> mPendingProgram;
+
+  std::shared_ptr<CompileJob> mCompileJob;
+
+  std::vector<std::unique_ptr<HeightMapObserver>> mHeightMapObservers;
+
+  std::shared_ptr<HeightMapExchange> mHeightMaps{ new HeightMapExchange() };
+
+  size_t mWidth = 0;
+
+  size_t mHeight = 0;
+};
+
+} // namespace
+
+auto
+JitBackend::Make() -> JitBackend*
+{
+  return new JitBackendImpl();
+}
+
+bool
+JitBackend::HasCompiler()
+{
+#ifdef _WIN32
+  return false;
+#else
+  auto command = GetCompiler() + " --version > /dev/null 2>&1";
+
+  return system(command.c_str()) == 0;
+#endif
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "core/Backend.h"
+
+/// @brief Compiles the height expression to native code with the system C
+/// compiler and loads it as a shared object.
+///
+/// @details The compiler is taken from the CC environment variable, or "cc"
+/// if it is not set. Compiled expressions are cached in the "mapgen-jit"
+/// directory of the user's cache directory, along with their source, which
+/// is compared before an object is loaded again. The expression is compiled
+/// on a thread of its own, started by the first computation after it is
+/// updated. Until the object is loaded, or if the expression cannot be
+/// compiled, the height map is computed by the CPU backend instead.
+class JitBackend : public Backend
+{
+public:
+  static auto Make() -> JitBackend*;
+
+  /// @return True if the compiler can be run.
+  static bool HasCompiler();
+
+  virtual ~JitBackend() = default;
+
+  /// @return True if the height expression was compiled and loaded, false
+  /// if the CPU backend computes the height map instead.
+  virtual bool IsCompiled() const noexcept = 0;
+
+  /// @brief Starts compiling the height expression, if it is not compiled
+  /// yet, and waits for it to finish.
+  ///
+  /// @return True if the height expression was compiled and loaded.
+  virtual bool WaitForCompile() = 0;
+};
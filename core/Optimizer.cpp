@@ -0,0 +1,489 @@
+#include "core/Optimizer.h"
+
+#include <functional>
+#include <limits>
+#include <unordered_map>
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace ir {
+
+namespace {
+
+auto
+AsFloatLiteral(const Expr& expr) -> const FloatLiteralExpr*
+{
+  return dynamic_cast<const FloatLiteralExpr*>(&expr);
+}
+
+auto
+AsIntLiteral(const Expr& expr) -> const IntLiteralExpr*
+{
+  return dynamic_cast<const IntLiteralExpr*>(&expr);
+}
+
+bool
+IsFloatLiteral(const Expr& expr, float value)
+{
+  const auto* literal = AsFloatLiteral(expr);
+
+  return literal && (literal->GetValue() == value);
+}
+
+/// The functions here must match the ones used to evaluate expressions, so
+/// that folding does not change the result.
+float
+EvalTrig(UnaryTrigExpr::ID id, float x)
+{
+  switch (id) {
+    case UnaryTrigExpr::ID::Sine:
+      return sin(x);
+    case UnaryTrigExpr::ID::Cosine:
+      return cos(x);
+    case UnaryTrigExpr::ID::Tangent:
+      return tan(x);
+    case UnaryTrigExpr::ID::Arcsine:
+      return asin(x);
+    case UnaryTrigExpr::ID::Arccosine:
+      return acos(x);
+    case UnaryTrigExpr::ID::Arctangent:
+      return atan(x);
+  }
+
+  return x;
+}
+
+float
+EvalBinary(BinaryExpr::ID id, float l, float r)
+{
+  switch (id) {
+    case BinaryExpr::ID::Add:
+      return l + r;
+    case BinaryExpr::ID::Sub:
+      return l - r;
+    case BinaryExpr::ID::Mul:
+      return l * r;
+    case BinaryExpr::ID::Div:
+      return l / r;
+  }
+
+  return l;
+}
+
+auto
+EvalBinary(BinaryExpr::ID id, int l, int r) -> std::optional<int>
+{
+  int64_t result = 0;
+
+  switch (id) {
+    case BinaryExpr::ID::Add:
+      result = int64_t(l) + r;
+      break;
+    case BinaryExpr::ID::Sub:
+      result = int64_t(l) - r;
+      break;
+    case BinaryExpr::ID::Mul:
+      result = int64_t(l) * r;
+      break;
+    case BinaryExpr::ID::Div:
+      if (r == 0)
+        return {};
+      result = int64_t(l) / r;
+      break;
+  }
+
+  if ((result < std::numeric_limits<int>::min()) ||
+      (result > std::numeric_limits<int>::max()))
+    return {};
+
+  return int(result);
+}
+
+class Simplifier final : public ExprVisitor
+{
+public:
+  Simplifier(ExprArena& arena)
+    : mArena(arena)
+  {}
+
+  auto Run(const Expr& expr) -> const Expr&
+  {
+    auto it = mSimplified.find(&expr);
+
+    if (it != mSimplified.end())
+      return *it->second;
+
+    expr.Accept(*this);
+
+    mSimplified.emplace(&expr, mResult);
+
+    return *mResult;
+  }
+
+  void Visit(const VarRefExpr& expr) override { mResult = &expr; }
+
+  void Visit(const IntLiteralExpr& expr) override { mResult = &expr; }
+
+  void Visit(const FloatLiteralExpr& expr) override { mResult = &expr; }
+
+  void Visit(const FloatToIntExpr& expr) override
+  {
+    const auto* literal = AsFloatLiteral(Run(expr.GetSourceExpr()));
+
+    mResult = &expr;
+
+    if (!literal)
+      return;
+
+    auto value = truncf(literal->GetValue());
+
+    // Converting values that do not fit is undefined, so they are left for
+    // the evaluator to deal with.
+    if (!(value >= float(std::numeric_limits<int>::min())) ||
+        !(value < -float(std::numeric_limits<int>::min())))
+      return;
+
+    mResult = &mArena.Make<IntLiteralExpr>(int(value));
+  }
+
+  void Visit(const IntToFloatExpr& expr) override
+  {
+    const auto* literal = AsIntLiteral(Run(expr.GetSourceExpr()));
+
+    mResult = &expr;
+
+    if (literal)
+      mResult = &mArena.Make<FloatLiteralExpr>(float(literal->GetValue()));
+  }
+
+  void Visit(const UnaryTrigExpr& expr) override
+  {
+    const auto& input = Run(expr.GetInputExpr());
+
+    if (const auto* literal = AsFloatLiteral(input)) {
+      auto value = EvalTrig(expr.GetID(), literal->GetValue());
+      mResult = &mArena.Make<FloatLiteralExpr>(value);
+    } else if (&input == &expr.GetInputExpr()) {
+      mResult = &expr;
+    } else {
+      mResult = &mArena.Make<UnaryTrigExpr>(expr.GetID(), input);
+    }
+  }
+
+  void Visit(const BinaryExpr& expr) override
+  {
+    const auto& l = Run(expr.GetLeftExpr());
+    const auto& r = Run(expr.GetRightExpr());
+
+    mResult = SimplifyBinary(expr, l, r);
+  }
+
+private:
+  auto SimplifyBinary(const BinaryExpr& expr, const Expr& l, const Expr& r)
+    -> const Expr*
+  {
+    auto id = expr.GetID();
+
+    const auto* lFloat = AsFloatLiteral(l);
+    const auto* rFloat = AsFloatLiteral(r);
+
+    if (lFloat && rFloat) {
+      auto value = EvalBinary(id, lFloat->GetValue(), rFloat->GetValue());
+      return &mArena.Make<FloatLiteralExpr>(value);
+    }
+
+    const auto* lInt = AsIntLiteral(l);
+    const auto* rInt = AsIntLiteral(r);
+
+    if (lInt && rInt) {
+      if (auto value = EvalBinary(id, lInt->GetValue(), rInt->GetValue()))
+        return &mArena.Make<IntLiteralExpr>(*value);
+    }
+
+    if (GetType(expr) == Type::Float) {
+      if (const auto* identity = SimplifyIdentity(id, l, r))
+        return identity;
+    }
+
+    if ((id == BinaryExpr::ID::Div) && rFloat) {
+
+      auto reciprocal = 1.0f / rFloat->GetValue();
+
+      // Zero, infinite and subnormal reciprocals would change the result.
+      if (isnormal(reciprocal)) {
+        const auto& rExpr = mArena.Make<FloatLiteralExpr>(reciprocal);
+        return &mArena.Make<BinaryExpr>(BinaryExpr::ID::Mul, l, rExpr);
+      }
+    }
+
+    if ((&l == &expr.GetLeftExpr()) && (&r == &expr.GetRightExpr()))
+      return &expr;
+
+    return &mArena.Make<BinaryExpr>(id, l, r);
+  }
+
+  /// Same as @ref Expr::GetType, but remembers the type of every node, since
+  /// the type of a binary expression depends on its entire subtree.
+  auto GetType(const Expr& expr) -> std::optional<Type>
+  {
+    auto it = mTypes.find(&expr);
+
+    if (it != mTypes.end())
+      return it->second;
+
+    std::optional<Type> type;
+
+    if (const auto* binaryExpr = dynamic_cast<const BinaryExpr*>(&expr)) {
+
+      auto lType = GetType(binaryExpr->GetLeftExpr());
+      auto rType = GetType(binaryExpr->GetRightExpr());
+
+      if (lType && rType && (*lType == *rType))
+        type = lType;
+
+    } else {
+      type = expr.GetType();
+    }
+
+    mTypes.emplace(&expr, type);
+
+    return type;
+  }
+
+  static auto SimplifyIdentity(BinaryExpr::ID id,
+                               const Expr& l,
+                               const Expr& r) -> const Expr*
+  {
+    switch (id) {
+      case BinaryExpr::ID::Add:
+        if (IsFloatLiteral(l, 0.0f))
+          return &r;
+        if (IsFloatLiteral(r, 0.0f))
+          return &l;
+        break;
+      case BinaryExpr::ID::Sub:
+        if (IsFloatLiteral(r, 0.0f))
+          return &l;
+        break;
+      case BinaryExpr::ID::Mul:
+        if (IsFloatLiteral(l, 1.0f))
+          return &r;
+        if (IsFloatLiteral(r, 1.0f))
+          return &l;
+        break;
+      case BinaryExpr::ID::Div:
+        if (IsFloatLiteral(r, 1.0f))
+          return &l;
+        break;
+    }
+
+    return nullptr;
+  }
+
+private:
+  ExprArena& mArena;
+
+  /// Nodes reachable from several parents are only simplified once.
+  std::unordered_map<const Expr*, const Expr*> mSimplified;
+
+  std::unordered_map<const Expr*, std::optional<Type>> mTypes;
+
+  const Expr* mResult = nullptr;
+};
+
+/// Identifies a node by its kind and the addresses of its (already interned)
+/// operands, so that two nodes with equal keys are structurally equal.
+struct NodeKey final
+{
+  enum class Kind
+  {
+    VarRef,
+    IntLiteral,
+    FloatLiteral,
+    FloatToInt,
+    IntToFloat,
+    UnaryTrig,
+    Binary
+  };
+
+  Kind kind;
+
+  /// The ID of the node, or the bits of its value for literals.
+  uint32_t data = 0;
+
+  const Expr* lhs = nullptr;
+
+  const Expr* rhs = nullptr;
+
+  bool operator==(const NodeKey& other) const noexcept
+  {
+    return (kind == other.kind) && (data == other.data) &&
+           (lhs == other.lhs) && (rhs == other.rhs);
+  }
+};
+
+struct NodeKeyHash final
+{
+  size_t operator()(const NodeKey& key) const noexcept
+  {
+    auto hash = std::hash<uint32_t>()((uint32_t(key.kind) << 24) ^ key.data);
+
+    for (const auto* operand : { key.lhs, key.rhs })
+      hash = (hash * 31) ^ std::hash<const Expr*>()(operand);
+
+    return hash;
+  }
+};
+
+class Interner final : public ExprVisitor
+{
+public:
+  Interner(ExprArena& arena)
+    : mArena(arena)
+  {}
+
+  auto Run(const Expr& expr) -> const Expr&
+  {
+    auto it = mInterned.find(&expr);
+
+    if (it != mInterned.end())
+      return *it->second;
+
+    expr.Accept(*this);
+
+    mInterned.emplace(&expr, mResult);
+
+    return *mResult;
+  }
+
+  void Visit(const VarRefExpr& expr) override
+  {
+    Unique(expr, { NodeKey::Kind::VarRef, uint32_t(expr.GetID()) });
+  }
+
+  void Visit(const IntLiteralExpr& expr) override
+  {
+    Unique(expr, { NodeKey::Kind::IntLiteral, Bits(expr.GetValue()) });
+  }
+
+  void Visit(const FloatLiteralExpr& expr) override
+  {
+    // Compared bitwise, so that 0 and -0 stay distinct.
+    Unique(expr, { NodeKey::Kind::FloatLiteral, Bits(expr.GetValue()) });
+  }
+
+  void Visit(const FloatToIntExpr& expr) override
+  {
+    const auto& source = Run(expr.GetSourceExpr());
+
+    Unique(expr, { NodeKey::Kind::FloatToInt, 0, &source });
+  }
+
+  void Visit(const IntToFloatExpr& expr) override
+  {
+    const auto& source = Run(expr.GetSourceExpr());
+
+    Unique(expr, { NodeKey::Kind::IntToFloat, 0, &source });
+  }
+
+  void Visit(const UnaryTrigExpr& expr) override
+  {
+    const auto& input = Run(expr.GetInputExpr());
+
+    NodeKey key{ NodeKey::Kind::UnaryTrig, uint32_t(expr.GetID()), &input };
+
+    if (Find(key))
+      return;
+
+    if (&input == &expr.GetInputExpr())
+      mResult = &expr;
+    else
+      mResult = &mArena.Make<UnaryTrigExpr>(expr.GetID(), input);
+
+    mNodes.emplace(key, mResult);
+  }
+
+  void Visit(const BinaryExpr& expr) override
+  {
+    const auto& l = Run(expr.GetLeftExpr());
+    const auto& r = Run(expr.GetRightExpr());
+
+    NodeKey key{ NodeKey::Kind::Binary, uint32_t(expr.GetID()), &l, &r };
+
+    if (Find(key))
+      return;
+
+    if ((&l == &expr.GetLeftExpr()) && (&r == &expr.GetRightExpr()))
+      mResult = &expr;
+    else
+      mResult = &mArena.Make<BinaryExpr>(expr.GetID(), l, r);
+
+    mNodes.emplace(key, mResult);
+  }
+
+private:
+  template<typename ValueType>
+  static auto Bits(ValueType value) noexcept -> uint32_t
+  {
+    static_assert(sizeof(value) == sizeof(uint32_t));
+
+    uint32_t bits = 0;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    return bits;
+  }
+
+  bool Find(const NodeKey& key)
+  {
+    auto it = mNodes.find(key);
+
+    if (it == mNodes.end())
+      return false;
+
+    mResult = it->second;
+
+    return true;
+  }
+
+  /// Used for nodes that can be kept as they are, because their operands
+  /// cannot be replaced.
+  void Unique(const Expr& expr, const NodeKey& key)
+  {
+    if (!Find(key))
+      mResult = mNodes.emplace(key, &expr).first->second;
+  }
+
+private:
+  ExprArena& mArena;
+
+  std::unordered_map<NodeKey, const Expr*, NodeKeyHash> mNodes;
+
+  /// Maps the nodes that have been visited to their interned node, so that
+  /// nodes reachable from several parents are only visited once.
+  std::unordered_map<const Expr*, const Expr*> mInterned;
+
+  const Expr* mResult = nullptr;
+};
+
+} // namespace
+
+auto
+Simplify(const Expr& expr, ExprArena& arena) -> const Expr&
+{
+  Simplifier simplifier(arena);
+
+  return simplifier.Run(expr);
+}
+
+auto
+Intern(const Expr& expr, ExprArena& arena) -> const Expr&
+{
+  Interner interner(arena);
+
+  return interner.Run(expr);
+}
+
+} // namespace ir
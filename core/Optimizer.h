@@ -0,0 +1,52 @@
+#pragma once
+
+#include "core/IR.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace ir {
+
+/// @brief Owns the expressions created by an optimization pass.
+///
+/// @details Subexpressions that a pass leaves unchanged are not copied, so the
+/// result of a pass may reference the input expression. Both the arena and the
+/// input expression have to outlive the result.
+class ExprArena final
+{
+public:
+  template<typename ExprType, typename... Args>
+  auto Make(Args&&... args) -> const ExprType&
+  {
+    auto* expr = new ExprType(std::forward<Args>(args)...);
+
+    mExprs.emplace_back(expr);
+
+    return *expr;
+  }
+
+private:
+  std::vector<std::unique_ptr<Expr>> mExprs;
+};
+
+/// @brief Folds subexpressions that only depend on literals and removes
+/// arithmetic identities, such as multiplying by one or adding zero. Division
+/// by a constant is replaced by multiplication with its reciprocal.
+///
+/// @note Casts are only folded when their operand folds to a literal. Since a
+/// cast owns its operand, other simplifications below a cast are skipped.
+auto
+Simplify(const Expr& expr, ExprArena& arena) -> const Expr&;
+
+/// @brief Merges structurally equal subexpressions (hash-consing), turning the
+/// expression tree into a DAG in which every distinct subexpression appears
+/// exactly once. Evaluators can then compute each node once and reuse the
+/// result for every parent, by keying on the node address.
+///
+/// @note Since a cast owns its operand, equal casts are merged with each other
+/// but their operands are not shared with the rest of the expression.
+auto
+Intern(const Expr& expr, ExprArena& arena) -> const Expr&;
+
+} // namespace ir
@@ -0,0 +1,528 @@
+#include "core/Program.h"
+
+#include <terra/simd.h>
+
+#include <algorithm>
+#include <limits>
+
+#include <string.h>
+
+#include <math.h>
+
+namespace simd = terra::simd;
+
+namespace {
+
+bool
+IsUnary(Program::Opcode op) noexcept
+{
+  switch (op) {
+    case Program::Opcode::Add:
+    case Program::Opcode::Sub:
+    case Program::Opcode::Mul:
+    case Program::Opcode::Div:
+      return false;
+    case Program::Opcode::Sine:
+    case Program::Opcode::Cosine:
+    case Program::Opcode::Tangent:
+    case Program::Opcode::Arcsine:
+    case Program::Opcode::Arccosine:
+    case Program::Opcode::Arctangent:
+    case Program::Opcode::Truncate:
+      break;
+  }
+
+  return true;
+}
+
+enum : uint8_t
+{
+  dependsOnNothing = 0,
+  dependsOnU = 1,
+  dependsOnV = 2
+};
+
+} // namespace
+
+auto
+Program::MakeConstant(float value) -> Program
+{
+  Program program;
+
+  program.Finish(program.AddConstant(value));
+
+  return program;
+}
+
+auto
+Program::AddConstant(float value) -> uint32_t
+{
+  for (size_t i = 0; i < mConstants.size(); i++) {
+    // Compared bitwise, so that 0 and -0 (or NaNs) stay distinct.
+    if (memcmp(&mConstants[i], &value, sizeof(value)) == 0)
+      return mConstantRegs[i];
+  }
+
+  mConstants.emplace_back(value);
+
+  mConstantRegs.emplace_back(mVirtualRegCount);
+
+  return mVirtualRegCount++;
+}
+
+auto
+Program::Emit(Opcode op, uint32_t lhs, uint32_t rhs) -> uint32_t
+{
+  if (IsUnary(op))
+    rhs = lhs;
+
+  mInstructions.emplace_back(Instruction{ op, mVirtualRegCount, lhs, rhs });
+
+  return mVirtualRegCount++;
+}
+
+void
+Program::Finish(uint32_t resultReg)
+{
+  constexpr uint32_t unassigned = uint32_t(-1);
+
+  constexpr size_t neverRead = size_t(-1);
+
+  // Order the instructions by the variables they depend on: first the ones
+  // that only depend on constants, then u, then v and finally both. Each group
+  // only reads from itself and the groups before it, so a stable partition
+  // keeps every operand defined before it is read.
+  std::vector<uint8_t> dependencies(mVirtualRegCount, dependsOnNothing);
+
+  dependencies[UReg()] = dependsOnU;
+  dependencies[VReg()] = dependsOnV;
+
+  for (const auto& inst : mInstructions)
+    dependencies[inst.dst] = dependencies[inst.lhs] | dependencies[inst.rhs];
+
+  auto constantEnd = std::stable_partition(
+    mInstructions.begin(), mInstructions.end(), [&](const Instruction& inst) {
+      return dependencies[inst.dst] == dependsOnNothing;
+    });
+
+  auto columnEnd = std::stable_partition(
+    constantEnd, mInstructions.end(), [&](const Instruction& inst) {
+      return dependencies[inst.dst] == dependsOnU;
+    });
+
+  auto rowEnd = std::stable_partition(
+    columnEnd, mInstructions.end(), [&](const Instruction& inst) {
+      return !(dependencies[inst.dst] & dependsOnU);
+    });
+
+  mConstantEnd = size_t(constantEnd - mInstructions.begin());
+
+  mColumnEnd = size_t(columnEnd - mInstructions.begin());
+
+  mRowEnd = size_t(rowEnd - mInstructions.begin());
+
+  std::vector<uint32_t> physRegs(mVirtualRegCount, unassigned);
+
+  physRegs[UReg()] = UReg();
+  physRegs[VReg()] = VReg();
+
+  for (size_t i = 0; i < mConstantRegs.size(); i++)
+    physRegs[mConstantRegs[i]] = uint32_t(2 + i);
+
+  // The index of the instruction that reads each temporary last.
+  std::vector<size_t> lastReads(mVirtualRegCount, neverRead);
+
+  // The index of the instruction that writes each temporary.
+  std::vector<size_t> writes(mVirtualRegCount, neverRead);
+
+  std::vector<bool> isTemporary(mVirtualRegCount, false);
+
+  for (size_t i = 0; i < mInstructions.size(); i++) {
+    lastReads[mInstructions[i].lhs] = i;
+    lastReads[mInstructions[i].rhs] = i;
+    writes[mInstructions[i].dst] = i;
+    isTemporary[mInstructions[i].dst] = true;
+  }
+
+  lastReads[resultReg] = mInstructions.size();
+
+  // The values computed once per column or row that are read by the last
+  // group. Since the last group runs several times, they stay live until the
+  // end of the program.
+  std::vector<uint32_t> columnRegs;
+
+  std::vector<uint32_t> rowRegs;
+
+  auto hoist = [&](uint32_t reg) {
+    if (!isTemporary[reg] || (writes[reg] >= mRowEnd))
+      return;
+
+    if (lastReads[reg] == mInstructions.size() + 1)
+      return;
+
+    lastReads[reg] = mInstructions.size() + 1;
+
+    if ((writes[reg] >= mConstantEnd) && (writes[reg] < mColumnEnd))
+      columnRegs.emplace_back(reg);
+    else
+      rowRegs.emplace_back(reg);
+  };
+
+  for (size_t i = mRowEnd; i < mInstructions.size(); i++) {
+    hoist(mInstructions[i].lhs);
+    hoist(mInstructions[i].rhs);
+  }
+
+  hoist(resultReg);
+
+  uint32_t nextReg = uint32_t(2 + mConstants.size());
+
+  std::vector<uint32_t> freeRegs;
+
+  for (size_t i = 0; i < mInstructions.size(); i++) {
+
+    auto& inst = mInstructions[i];
+
+    auto lhs = inst.lhs;
+    auto rhs = inst.rhs;
+
+    inst.lhs = physRegs[lhs];
+    inst.rhs = physRegs[rhs];
+
+    // Operands are read before the destination is written, so a register
+    // freed here may be reused as the destination of this instruction.
+    for (auto operand : { lhs, rhs }) {
+      if (isTemporary[operand] && (lastReads[operand] == i)) {
+        freeRegs.emplace_back(physRegs[operand]);
+        lastReads[operand] = neverRead;
+      }
+
+      if (lhs == rhs)
+        break;
+    }
+
+    auto dst = inst.dst;
+
+    if (freeRegs.empty()) {
+      physRegs[dst] = nextReg++;
+    } else {
+      physRegs[dst] = freeRegs.back();
+      freeRegs.pop_back();
+    }
+
+    inst.dst = physRegs[dst];
+
+    // Results that are never read can be overwritten right away.
+    if (lastReads[dst] == neverRead)
+      freeRegs.emplace_back(physRegs[dst]);
+  }
+
+  mResultReg = physRegs[resultReg];
+
+  mRegisterCount = nextReg;
+
+  mColumnRegs.clear();
+
+  for (auto reg : columnRegs)
+    mColumnRegs.emplace_back(physRegs[reg]);
+
+  mRowRegs.clear();
+
+  for (auto reg : rowRegs)
+    mRowRegs.emplace_back(physRegs[reg]);
+}
+
+auto
+Program::MakeRegisters() const -> std::vector<float>
+{
+  std::vector<float> registers(mRegisterCount);
+
+  for (size_t i = 0; i < mConstants.size(); i++)
+    registers[2 + i] = mConstants[i];
+
+  return registers;
+}
+
+float
+Program::Eval(float u, float v, float* r) const noexcept
+{
+  r[UReg()] = u;
+  r[VReg()] = v;
+
+  for (const auto& inst : mInstructions) {
+    switch (inst.op) {
+      case Opcode::Add:
+        r[inst.dst] = r[inst.lhs] + r[inst.rhs];
+        break;
+      case Opcode::Sub:
+        r[inst.dst] = r[inst.lhs] - r[inst.rhs];
+        break;
+      case Opcode::Mul:
+        r[inst.dst] = r[inst.lhs] * r[inst.rhs];
+        break;
+      case Opcode::Div:
+        r[inst.dst] = r[inst.lhs] / r[inst.rhs];
+        break;
+      case Opcode::Sine:
+        r[inst.dst] = sin(r[inst.lhs]);
+        break;
+      case Opcode::Cosine:
+        r[inst.dst] = cos(r[inst.lhs]);
+        break;
+      case Opcode::Tangent:
+        r[inst.dst] = tan(r[inst.lhs]);
+        break;
+      case Opcode::Arcsine:
+        r[inst.dst] = asin(r[inst.lhs]);
+        break;
+      case Opcode::Arccosine:
+        r[inst.dst] = acos(r[inst.lhs]);
+        break;
+      case Opcode::Arctangent:
+        r[inst.dst] = atan(r[inst.lhs]);
+        break;
+      case Opcode::Truncate:
+        r[inst.dst] = truncf(r[inst.lhs]);
+        break;
+    }
+  }
+
+  return r[mResultReg];
+}
+
+auto
+Program::MakeBatchRegisters() const -> std::vector<float>
+{
+  std::vector<float> registers(mRegisterCount * BatchSize());
+
+  for (size_t i = 0; i < mConstants.size(); i++)
+    simd::Fill(mConstants[i], &registers[(2 + i) * BatchSize()], BatchSize());
+
+  return registers;
+}
+
+void
+Program::EvalBatch(const float* u,
+                   const float* v,
+                   float* out,
+                   size_t n,
+                   float* registers) const noexcept
+{
+  auto reg = [registers](uint32_t index) {
+    return registers + (index * BatchSize());
+  };
+
+  for (size_t offset = 0; offset < n; offset += BatchSize()) {
+
+    auto count = std::min(n - offset, BatchSize());
+
+    memcpy(reg(UReg()), u + offset, count * sizeof(float));
+    memcpy(reg(VReg()), v + offset, count * sizeof(float));
+
+    Run(0, mInstructions.size(), registers, count);
+
+    memcpy(out + offset, reg(mResultReg), count * sizeof(float));
+  }
+}
+
+auto
+Program::EvalColumns(const float* u, size_t n) const -> std::vector<float>
+{
+  std::vector<float> columns(mColumnRegs.size() * n);
+
+  if (columns.empty())
+    return columns;
+
+  auto registers = MakeBatchRegisters();
+
+  auto reg = [&registers](uint32_t index) {
+    return registers.data() + (index * BatchSize());
+  };
+
+  for (size_t offset = 0; offset < n; offset += BatchSize()) {
+
+    auto count = std::min(n - offset, BatchSize());
+
+    memcpy(reg(UReg()), u + offset, count * sizeof(float));
+
+    Run(0, mColumnEnd, registers.data(), count);
+
+    for (size_t i = 0; i < mColumnRegs.size(); i++) {
+      auto* column = &columns[(i * n) + offset];
+      memcpy(column, reg(mColumnRegs[i]), count * sizeof(float));
+    }
+  }
+
+  return columns;
+}
+
+void
+Program::EvalRow(const float* u,
+                 float v,
+                 const float* columns,
+                 size_t columnStride,
+                 float* out,
+                 size_t n,
+                 float* registers) const noexcept
+{
+  auto reg = [registers](uint32_t index) {
+    return registers + (index * BatchSize());
+  };
+
+  // Every point has the same value for the instructions that do not depend
+  // on u, so they are evaluated for one element and then broadcast.
+  reg(VReg())[0] = v;
+
+  Run(0, mConstantEnd, registers, 1);
+
+  Run(mColumnEnd, mRowEnd, registers, 1);
+
+  for (auto rowReg : mRowRegs)
+    simd::Fill(reg(rowReg)[0], reg(rowReg), BatchSize());
+
+  simd::Fill(v, reg(VReg()), BatchSize());
+
+  for (size_t offset = 0; offset < n; offset += BatchSize()) {
+
+    auto count = std::min(n - offset, BatchSize());
+
+    memcpy(reg(UReg()), u + offset, count * sizeof(float));
+
+    for (size_t i = 0; i < mColumnRegs.size(); i++) {
+      const auto* column = columns + (i * columnStride) + offset;
+      memcpy(reg(mColumnRegs[i]), column, count * sizeof(float));
+    }
+
+    Run(mRowEnd, mInstructions.size(), registers, count);
+
+    memcpy(out + offset, reg(mResultReg), count * sizeof(float));
+  }
+}
+
+auto
+Program::EvalBounds(const ir::Interval& u, const ir::Interval& v) const
+  -> ir::Interval
+{
+  using BinaryID = ir::BinaryExpr::ID;
+
+  using TrigID = ir::UnaryTrigExpr::ID;
+
+  std::vector<ir::Interval> r(mRegisterCount);
+
+  r[UReg()] = u;
+  r[VReg()] = v;
+
+  auto inf = std::numeric_limits<float>::infinity();
+
+  for (size_t i = 0; i < mConstants.size(); i++) {
+
+    auto value = mConstants[i];
+
+    if (isnan(value))
+      r[2 + i] = ir::Interval{ -inf, inf, true };
+    else
+      r[2 + i] = ir::Interval{ value, value, false };
+  }
+
+  for (const auto& inst : mInstructions) {
+
+    const auto& lhs = r[inst.lhs];
+    const auto& rhs = r[inst.rhs];
+
+    ir::Interval result;
+
+    switch (inst.op) {
+      case Opcode::Add:
+        result = ir::GetBinaryBounds(BinaryID::Add, lhs, rhs);
+        break;
+      case Opcode::Sub:
+        result = ir::GetBinaryBounds(BinaryID::Sub, lhs, rhs);
+        break;
+      case Opcode::Mul:
+        result = ir::GetBinaryBounds(BinaryID::Mul, lhs, rhs);
+        break;
+      case Opcode::Div:
+        result = ir::GetBinaryBounds(BinaryID::Div, lhs, rhs);
+        break;
+      case Opcode::Sine:
+        result = ir::GetTrigBounds(TrigID::Sine, lhs);
+        break;
+      case Opcode::Cosine:
+        result = ir::GetTrigBounds(TrigID::Cosine, lhs);
+        break;
+      case Opcode::Tangent:
+        result = ir::GetTrigBounds(TrigID::Tangent, lhs);
+        break;
+      case Opcode::Arcsine:
+        result = ir::GetTrigBounds(TrigID::Arcsine, lhs);
+        break;
+      case Opcode::Arccosine:
+        result = ir::GetTrigBounds(TrigID::Arccosine, lhs);
+        break;
+      case Opcode::Arctangent:
+        result = ir::GetTrigBounds(TrigID::Arctangent, lhs);
+        break;
+      case Opcode::Truncate:
+        result = ir::GetTruncateBounds(lhs);
+        break;
+    }
+
+    r[inst.dst] = result;
+  }
+
+  return r[mResultReg];
+}
+
+void
+Program::Run(size_t begin, size_t end, float* registers, size_t n) const
+  noexcept
+{
+  auto reg = [registers](uint32_t index) {
+    return registers + (index * BatchSize());
+  };
+
+  for (size_t i = begin; i < end; i++) {
+
+    const auto& inst = mInstructions[i];
+
+    auto* dst = reg(inst.dst);
+    auto* lhs = reg(inst.lhs);
+    auto* rhs = reg(inst.rhs);
+
+    switch (inst.op) {
+      case Opcode::Add:
+        simd::Add(lhs, rhs, dst, n);
+        break;
+      case Opcode::Sub:
+        simd::Sub(lhs, rhs, dst, n);
+        break;
+      case Opcode::Mul:
+        simd::Mul(lhs, rhs, dst, n);
+        break;
+      case Opcode::Div:
+        simd::Div(lhs, rhs, dst, n);
+        break;
+      case Opcode::Sine:
+        simd::Sine(lhs, dst, n);
+        break;
+      case Opcode::Cosine:
+        simd::Cosine(lhs, dst, n);
+        break;
+      case Opcode::Tangent:
+        simd::Tangent(lhs, dst, n);
+        break;
+      case Opcode::Arcsine:
+        simd::Arcsine(lhs, dst, n);
+        break;
+      case Opcode::Arccosine:
+        simd::Arccosine(lhs, dst, n);
+        break;
+      case Opcode::Arctangent:
+        simd::Arctangent(lhs, dst, n);
+        break;
+      case Opcode::Truncate:
+        simd::Truncate(lhs, dst, n);
+        break;
+    }
+  }
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "core/Bounds.h"
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief A flat, register based program that evaluates a float expression.
+///
+/// @details The register file starts with the builtin variables, followed by
+/// the constants, followed by the temporaries. Temporaries get reused once
+/// their last reader has executed, so the register file stays small even for
+/// large expressions.
+///
+/// The instructions are ordered by the variables they depend on: first the
+/// ones that only depend on u, then the ones that only depend on v and
+/// finally the ones that depend on both. When evaluating a grid, the first
+/// group only has to run once per column and the second once per row, see
+/// @ref Program::EvalColumns and @ref Program::EvalRow.
+class Program final
+{
+public:
+  enum class Opcode : uint8_t
+  {
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Sine,
+    Cosine,
+    Tangent,
+    Arcsine,
+    Arccosine,
+    Arctangent,
+    Truncate
+  };
+
+  struct Instruction final
+  {
+    Opcode op;
+
+    uint32_t dst;
+
+    uint32_t lhs;
+
+    uint32_t rhs;
+  };
+
+  static constexpr uint32_t UReg() noexcept { return 0; }
+
+  static constexpr uint32_t VReg() noexcept { return 1; }
+
+  /// @return A program that always evaluates to @p value.
+  static auto MakeConstant(float value) -> Program;
+
+  /// @return The register containing @p value.
+  auto AddConstant(float value) -> uint32_t;
+
+  /// @brief Appends an instruction that writes to a new register.
+  ///
+  /// @param rhs Ignored by unary operations.
+  ///
+  /// @return The register that the result is written to.
+  auto Emit(Opcode op, uint32_t lhs, uint32_t rhs = 0) -> uint32_t;
+
+  /// @brief Marks the register containing the final value and assigns
+  /// physical registers to the temporaries. Must be called after the last
+  /// instruction is emitted.
+  void Finish(uint32_t resultReg);
+
+  auto GetInstructions() const noexcept -> const std::vector<Instruction>&
+  {
+    return mInstructions;
+  }
+
+  auto GetRegisterCount() const noexcept -> size_t { return mRegisterCount; }
+
+  /// The constants are loaded into the registers following the builtin
+  /// variables, in this order.
+  auto GetConstants() const noexcept -> const std::vector<float>&
+  {
+    return mConstants;
+  }
+
+  auto GetResultReg() const noexcept -> uint32_t { return mResultReg; }
+
+  /// @return The end of the instructions that only depend on constants.
+  auto GetConstantEnd() const noexcept -> size_t { return mConstantEnd; }
+
+  /// @return The end of the instructions that only depend on u.
+  auto GetColumnEnd() const noexcept -> size_t { return mColumnEnd; }
+
+  /// @return The end of the instructions that only depend on v.
+  auto GetRowEnd() const noexcept -> size_t { return mRowEnd; }
+
+  /// @return The registers that @ref Program::EvalColumns computes for each
+  /// column, in the order they are laid out.
+  auto GetColumnRegs() const noexcept -> const std::vector<uint32_t>&
+  {
+    return mColumnRegs;
+  }
+
+  /// @return The registers computed once per row that are read by the
+  /// instructions depending on both u and v.
+  auto GetRowRegs() const noexcept -> const std::vector<uint32_t>&
+  {
+    return mRowRegs;
+  }
+
+  /// @return A register file with the constants loaded. One register file is
+  /// needed per thread that calls @ref Program::Eval.
+  auto MakeRegisters() const -> std::vector<float>;
+
+  float Eval(float u, float v, float* registers) const noexcept;
+
+  /// The number of elements held by each register in a batch register file.
+  static constexpr size_t BatchSize() noexcept { return 64; }
+
+  /// @return A register file for @ref Program::EvalBatch, with the constants
+  /// loaded into every element.
+  auto MakeBatchRegisters() const -> std::vector<float>;
+
+  /// @brief Evaluates @p n points, running each instruction over a span of up
+  /// to @ref Program::BatchSize points at a time.
+  void EvalBatch(const float* u,
+                 const float* v,
+                 float* out,
+                 size_t n,
+                 float* registers) const noexcept;
+
+  /// @brief Evaluates the instructions that only depend on u.
+  ///
+  /// @return The values that @ref Program::EvalRow needs from each of the
+  /// @p n columns.
+  auto EvalColumns(const float* u, size_t n) const -> std::vector<float>;
+
+  /// @brief Evaluates a row of @p n points that share the same v coordinate.
+  /// The instructions that only depend on v run once for the entire row.
+  ///
+  /// @param columns The result of @ref Program::EvalColumns for the same @p u,
+  /// offset by the index of the first column to evaluate.
+  ///
+  /// @param columnStride The number of columns that were passed to
+  /// @ref Program::EvalColumns.
+  ///
+  /// @param registers A register file from @ref Program::MakeBatchRegisters.
+  void EvalRow(const float* u,
+               float v,
+               const float* columns,
+               size_t columnStride,
+               float* out,
+               size_t n,
+               float* registers) const noexcept;
+
+  /// @brief Finds conservative bounds of the result over a rectangle of
+  /// coordinates, running each instruction once on intervals. See
+  /// @ref ir::BoundsAnalysis for how the bounds relate to the result.
+  auto EvalBounds(const ir::Interval& u, const ir::Interval& v) const
+    -> ir::Interval;
+
+private:
+  /// Runs the instructions in [begin, end) over @p n elements of each
+  /// register.
+  void Run(size_t begin, size_t end, float* registers, size_t n) const
+    noexcept;
+
+private:
+  std::vector<float> mConstants;
+
+  /// Before @ref Program::Finish is called, every constant and temporary gets
+  /// a virtual register in the order it was added. This maps each constant to
+  /// its virtual register.
+  std::vector<uint32_t> mConstantRegs;
+
+  std::vector<Instruction> mInstructions;
+
+  uint32_t mVirtualRegCount = 2;
+
+  uint32_t mResultReg = 0;
+
+  size_t mRegisterCount = 2;
+
+  /// The end of the instructions that only depend on constants. These are
+  /// part of both the column and the row instructions.
+  size_t mConstantEnd = 0;
+
+  /// The end of the instructions that only depend on u.
+  size_t mColumnEnd = 0;
+
+  /// The end of the instructions that do not depend on u.
+  size_t mRowEnd = 0;
+
+  /// The registers computed once per column that are read afterwards.
+  std::vector<uint32_t> mColumnRegs;
+
+  /// The registers computed once per row that are read afterwards.
+  std::vector<uint32_t> mRowRegs;
+};
@@ -0,0 +1,225 @@
+#include "core/ProgramBuilder.h"
+
+#include "core/IR.h"
+#include "core/Optimizer.h"
+
+#include <unordered_map>
+
+#include <stdint.h>
+
+namespace {
+
+/// The register holding the value of each node that has been built, so that a
+/// node reachable from several parents is only evaluated once.
+using RegisterMap = std::unordered_map<const ir::Expr*, uint32_t>;
+
+template<typename Builder>
+auto
+BuildExpr(const ir::Expr& expr, Program& program, RegisterMap& registers)
+  -> std::optional<uint32_t>
+{
+  auto it = registers.find(&expr);
+
+  if (it != registers.end())
+    return it->second;
+
+  Builder builder(program, registers);
+
+  expr.Accept(builder);
+
+  auto reg = builder.GetResult();
+
+  if (reg)
+    registers.emplace(&expr, *reg);
+
+  return reg;
+}
+
+class IntExprBuilder final : public ir::ExprVisitor
+{
+public:
+  IntExprBuilder(Program& program, RegisterMap& registers)
+    : mProgram(program)
+    , mRegisters(registers)
+  {}
+
+  /// @return The register holding the result, if the expression was valid.
+  auto GetResult() const noexcept -> std::optional<uint32_t> { return mReg; }
+
+  void Visit(const ir::FloatLiteralExpr&) override {}
+
+  void Visit(const ir::IntLiteralExpr& literalExpr) override
+  {
+    // Integers are kept in float registers. The only way to produce a
+    // non-literal integer is by truncating a float, so this is exact.
+    mReg = mProgram.AddConstant(float(literalExpr.GetValue()));
+  }
+
+  void Visit(const ir::VarRefExpr&) override {}
+
+  void Visit(const ir::IntToFloatExpr&) override {}
+
+  void Visit(const ir::FloatToIntExpr& floatToInt) override;
+
+  void Visit(const ir::UnaryTrigExpr&) override {}
+
+  void Visit(const ir::BinaryExpr& binaryExpr) override
+  {
+    // TODO
+    (void)binaryExpr;
+  }
+
+private:
+  Program& mProgram;
+
+  RegisterMap& mRegisters;
+
+  std::optional<uint32_t> mReg;
+};
+
+class FloatExprBuilder final : public ir::ExprVisitor
+{
+public:
+  FloatExprBuilder(Program& program, RegisterMap& registers)
+    : mProgram(program)
+    , mRegisters(registers)
+  {}
+
+  /// @return The register holding the result, if the expression was valid.
+  auto GetResult() const noexcept -> std::optional<uint32_t> { return mReg; }
+
+  void Visit(const ir::VarRefExpr& varRefExpr) override
+  {
+    switch (varRefExpr.GetID()) {
+      case ir::VarRefExpr::ID::CenterUCoord:
+        mReg = Program::UReg();
+        break;
+      case ir::VarRefExpr::ID::CenterVCoord:
+        mReg = Program::VReg();
+        break;
+    }
+  }
+
+  void Visit(const ir::FloatLiteralExpr& floatLiteralExpr) override
+  {
+    mReg = mProgram.AddConstant(floatLiteralExpr.GetValue());
+  }
+
+  void Visit(const ir::IntToFloatExpr& expr) override
+  {
+    const auto& sourceExpr = expr.GetSourceExpr();
+
+    mReg = BuildExpr<IntExprBuilder>(sourceExpr, mProgram, mRegisters);
+  }
+
+  void Visit(const ir::UnaryTrigExpr& trigExpr) override
+  {
+    auto operand = BuildSubExpr(trigExpr.GetInputExpr());
+
+    if (!operand)
+      return;
+
+    switch (trigExpr.GetID()) {
+      case ir::UnaryTrigExpr::ID::Sine:
+        mReg = mProgram.Emit(Program::Opcode::Sine, *operand);
+        break;
+      case ir::UnaryTrigExpr::ID::Cosine:
+        mReg = mProgram.Emit(Program::Opcode::Cosine, *operand);
+        break;
+      case ir::UnaryTrigExpr::ID::Tangent:
+        mReg = mProgram.Emit(Program::Opcode::Tangent, *operand);
+        break;
+      case ir::UnaryTrigExpr::ID::Arcsine:
+        mReg = mProgram.Emit(Program::Opcode::Arcsine, *operand);
+        break;
+      case ir::UnaryTrigExpr::ID::Arccosine:
+        mReg = mProgram.Emit(Program::Opcode::Arccosine, *operand);
+        break;
+      case ir::UnaryTrigExpr::ID::Arctangent:
+        mReg = mProgram.Emit(Program::Opcode::Arctangent, *operand);
+        break;
+    }
+  }
+
+  void Visit(const ir::IntLiteralExpr&) override {}
+
+  void Visit(const ir::FloatToIntExpr&) override {}
+
+  void Visit(const ir::BinaryExpr& binaryExpr) override
+  {
+    auto lReg = BuildSubExpr(binaryExpr.GetLeftExpr());
+    auto rReg = BuildSubExpr(binaryExpr.GetRightExpr());
+
+    if (!lReg || !rReg)
+      return;
+
+    switch (binaryExpr.GetID()) {
+      case ir::BinaryExpr::ID::Add:
+        mReg = mProgram.Emit(Program::Opcode::Add, *lReg, *rReg);
+        break;
+      case ir::BinaryExpr::ID::Sub:
+        mReg = mProgram.Emit(Program::Opcode::Sub, *lReg, *rReg);
+        break;
+      case ir::BinaryExpr::ID::Mul:
+        mReg = mProgram.Emit(Program::Opcode::Mul, *lReg, *rReg);
+        break;
+      case ir::BinaryExpr::ID::Div:
+        mReg = mProgram.Emit(Program::Opcode::Div, *lReg, *rReg);
+        break;
+    }
+  }
+
+private:
+  auto BuildSubExpr(const ir::Expr& expr) -> std::optional<uint32_t>
+  {
+    return BuildExpr<FloatExprBuilder>(expr, mProgram, mRegisters);
+  }
+
+private:
+  Program& mProgram;
+
+  RegisterMap& mRegisters;
+
+  std::optional<uint32_t> mReg;
+};
+
+void
+IntExprBuilder::Visit(const ir::FloatToIntExpr& floatToInt)
+{
+  const auto& sourceExpr = floatToInt.GetSourceExpr();
+
+  auto floatReg = BuildExpr<FloatExprBuilder>(sourceExpr, mProgram, mRegisters);
+
+  if (!floatReg)
+    return;
+
+  mReg = mProgram.Emit(Program::Opcode::Truncate, *floatReg);
+}
+
+} // namespace
+
+auto
+BuildProgram(const ir::Expr& expr) -> std::optional<Program>
+{
+  ir::ExprArena arena;
+
+  // Interning after simplifying also merges the subexpressions that only
+  // became equal through simplification.
+  const auto& simplifiedExpr = ir::Simplify(expr, arena);
+
+  const auto& internedExpr = ir::Intern(simplifiedExpr, arena);
+
+  Program program;
+
+  RegisterMap registers;
+
+  auto resultReg =
+    BuildExpr<FloatExprBuilder>(internedExpr, program, registers);
+
+  if (!resultReg)
+    return {};
+
+  program.Finish(*resultReg);
+
+  return program;
+}
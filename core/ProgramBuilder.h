@@ -0,0 +1,18 @@
+#pragma once
+
+#include "core/Program.h"
+
+#include <optional>
+
+namespace ir {
+
+class Expr;
+
+} // namespace ir
+
+/// @brief Lowers a float expression to a program, after simplifying it and
+/// merging equal subexpressions.
+///
+/// @return Nothing if the expression is not a valid float expression.
+auto
+BuildProgram(const ir::Expr& expr) -> std::optional<Program>;
@@ -0,0 +1,348 @@
+#include "core/TerrainLod.h"
+
+#include "core/HeightMapExchange.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <math.h>
+
+namespace {
+
+/// Positions outside of the height map are moved to the closest edge, like
+/// the vertices that pad the nodes.
+float
+Sample(const HeightMap& heightMap, size_t x, size_t y)
+{
+  x = std::min(x, heightMap.w - 1);
+
+  y = std::min(y, heightMap.h - 1);
+
+  return heightMap.data[(y * heightMap.w) + x];
+}
+
+/// @return The largest distance between the vertices that a node of level
+/// @p level gets from its children and the triangles of the node itself.
+/// Triangles are split along the diagonal from the bottom left to the top
+/// right corner of each cell, like in the element buffer of the view.
+float
+GetDeviation(const HeightMap& heightMap, size_t level, size_t x, size_t y)
+{
+  auto stride = TerrainLod::Stride(level);
+
+  auto half = stride / 2;
+
+  auto cells = TerrainLod::NodeSize() - 1;
+
+  float deviation = 0;
+
+  for (size_t j = 0; j <= (cells * 2); j++) {
+
+    auto y0 = y + ((j / 2) * stride);
+    auto y1 = y0 + stride;
+    auto yj = y + (j * half);
+
+    for (size_t i = (j + 1) % 2; i <= (cells * 2); i += 2 - (j % 2)) {
+
+      auto x0 = x + ((i / 2) * stride);
+      auto x1 = x0 + stride;
+      auto xi = x + (i * half);
+
+      float interpolated = 0;
+
+      if (!(j % 2))
+        interpolated = Sample(heightMap, x0, yj) + Sample(heightMap, x1, yj);
+      else if (!(i % 2))
+        interpolated = Sample(heightMap, xi, y0) + Sample(heightMap, xi, y1);
+      else
+        interpolated = Sample(heightMap, x0, y1) + Sample(heightMap, x1, y0);
+
+      auto actual = Sample(heightMap, xi, yj);
+
+      deviation = std::max(deviation, fabsf(actual - (interpolated * 0.5f)));
+    }
+  }
+
+  return deviation;
+}
+
+} // namespace
+
+void
+TerrainLod::Build(const HeightMap& heightMap)
+{
+  mNodes.clear();
+
+  mLevelErrors.clear();
+
+  mLevelDiagonals.clear();
+
+  mWidth = heightMap.w;
+
+  mHeight = heightMap.h;
+
+  if (!mWidth || !mHeight)
+    return;
+
+  auto cells = std::max<size_t>(std::max(mWidth, mHeight), 2) - 1;
+
+  size_t rootLevel = 0;
+
+  while (((NodeSize() - 1) << rootLevel) < cells)
+    rootLevel++;
+
+  mLevelErrors.resize(rootLevel + 1, 0.0f);
+
+  mLevelDiagonals.resize(rootLevel + 1, 0.0f);
+
+  BuildNode(heightMap, rootLevel, 0, 0);
+
+  UpdateLevelStats();
+}
+
+void
+TerrainLod::Update(const HeightMap& heightMap,
+                   const std::vector<bool>& dirtyTiles)
+{
+  // Children come before their parents, which are computed from them.
+  for (auto& node : mNodes) {
+    if (ReadsDirtyTile(heightMap, dirtyTiles, node))
+      ComputeNode(heightMap, node);
+  }
+
+  UpdateLevelStats();
+}
+
+void
+TerrainLod::Select(const LodView& view,
+                   std::vector<LodSelection>& selection) const
+{
+  selection.clear();
+
+  if (mNodes.empty())
+    return;
+
+  // A node is split into its children when the camera is closer than the
+  // range of its level, within which its error would be too large on
+  // screen. Each range leaves at least the size of a node between it and
+  // the one below, so that nodes closer to the camera than a neighbor are
+  // never more than one level below it.
+  std::vector<float> ranges(mLevelErrors.size());
+
+  auto scale = view.pixelsPerUnit / view.maxPixelError;
+
+  for (size_t level = 0; level < ranges.size(); level++) {
+
+    ranges[level] = mLevelErrors[level] * scale;
+
+    if (level > 0) {
+      auto minRange = ranges[level - 1] + mLevelDiagonals[level - 1];
+      ranges[level] = std::max(ranges[level], minRange);
+    }
+  }
+
+  SelectNode(view, ranges, mNodes.size() - 1, selection);
+}
+
+auto
+TerrainLod::BuildNode(const HeightMap& heightMap,
+                      size_t level,
+                      size_t x,
+                      size_t y) -> int32_t
+{
+  LodNode node;
+
+  node.level = level;
+
+  node.x = x;
+
+  node.y = y;
+
+  if (level > 0) {
+
+    auto half = ((NodeSize() - 1) * Stride(level)) / 2;
+
+    for (size_t i = 0; i < 4; i++) {
+
+      auto childX = x + ((i % 2) * half);
+      auto childY = y + ((i / 2) * half);
+
+      // A quarter without any cell of the height map.
+      if (((i % 2) && (childX >= (mWidth - 1))) ||
+          ((i / 2) && (childY >= (mHeight - 1))))
+        continue;
+
+      node.children[i] = BuildNode(heightMap, level - 1, childX, childY);
+    }
+  }
+
+  ComputeNode(heightMap, node);
+
+  mNodes.emplace_back(node);
+
+  return int32_t(mNodes.size() - 1);
+}
+
+void
+TerrainLod::ComputeNode(const HeightMap& heightMap, LodNode& node) const
+{
+  node.minHeight = std::numeric_limits<float>::infinity();
+
+  node.maxHeight = -std::numeric_limits<float>::infinity();
+
+  node.error = 0;
+
+  if (node.level == 0) {
+
+    auto cells = NodeSize() - 1;
+
+    auto lastX = std::min(node.x + cells, mWidth - 1);
+    auto lastY = std::min(node.y + cells, mHeight - 1);
+
+    for (auto y = node.y; y <= lastY; y++) {
+
+      const auto* row = &heightMap.data[y * mWidth];
+
+      for (auto x = node.x; x <= lastX; x++) {
+        node.minHeight = std::min(node.minHeight, row[x]);
+        node.maxHeight = std::max(node.maxHeight, row[x]);
+      }
+    }
+
+    return;
+  }
+
+  for (auto childIndex : node.children) {
+
+    if (childIndex < 0)
+      continue;
+
+    const auto& child = mNodes[childIndex];
+
+    node.minHeight = std::min(node.minHeight, child.minHeight);
+
+    node.maxHeight = std::max(node.maxHeight, child.maxHeight);
+
+    node.error = std::max(node.error, child.error);
+  }
+
+  // The children are only an upper bound of the distance to the height map,
+  // so the deviation from them adds to it.
+  node.error += GetDeviation(heightMap, node.level, node.x, node.y);
+}
+
+void
+TerrainLod::UpdateLevelStats()
+{
+  std::fill(mLevelErrors.begin(), mLevelErrors.end(), 0.0f);
+
+  std::fill(mLevelDiagonals.begin(), mLevelDiagonals.end(), 0.0f);
+
+  for (const auto& node : mNodes) {
+
+    auto cells = float((NodeSize() - 1) * Stride(node.level));
+
+    auto sizeX = cells * 2.0f / float(mWidth);
+    auto sizeY = node.maxHeight - node.minHeight;
+    auto sizeZ = cells * 2.0f / float(mHeight);
+
+    auto diagonal = sqrtf((sizeX * sizeX) + (sizeY * sizeY) + (sizeZ * sizeZ));
+
+    auto& levelError = mLevelErrors[node.level];
+
+    auto& levelDiagonal = mLevelDiagonals[node.level];
+
+    levelError = std::max(levelError, node.error);
+
+    levelDiagonal = std::max(levelDiagonal, diagonal);
+  }
+}
+
+bool
+TerrainLod::ReadsDirtyTile(const HeightMap& heightMap,
+                           const std::vector<bool>& dirtyTiles,
+                           const LodNode& node) const
+{
+  auto cells = (NodeSize() - 1) * Stride(node.level);
+
+  auto lastX = std::min(node.x + cells, mWidth - 1);
+  auto lastY = std::min(node.y + cells, mHeight - 1);
+
+  auto tileSize = HeightMap::TileSize();
+
+  auto tilesPerRow = heightMap.TilesPerRow();
+
+  for (auto tileY = node.y / tileSize; tileY <= (lastY / tileSize); tileY++) {
+    for (auto tileX = node.x / tileSize; tileX <= (lastX / tileSize); tileX++) {
+      if (dirtyTiles[(tileY * tilesPerRow) + tileX])
+        return true;
+    }
+  }
+
+  return false;
+}
+
+void
+TerrainLod::SelectNode(const LodView& view,
+                       const std::vector<float>& ranges,
+                       size_t nodeIndex,
+                       std::vector<LodSelection>& selection) const
+{
+  const auto& node = mNodes[nodeIndex];
+
+  auto level = node.level;
+
+  if ((level > view.minLevel) &&
+      (GetDistance(view.eye, node) < ranges[level])) {
+
+    for (auto childIndex : node.children) {
+      if (childIndex >= 0)
+        SelectNode(view, ranges, size_t(childIndex), selection);
+    }
+
+    return;
+  }
+
+  LodSelection selected;
+
+  selected.node = nodeIndex;
+
+  if ((level + 1) < ranges.size()) {
+    // Morphing starts three quarters of the way to the end of the range.
+    auto start = ranges[level];
+    selected.morphEnd = ranges[level + 1];
+    selected.morphStart = start + ((selected.morphEnd - start) * 0.75f);
+  } else {
+    // The root has nothing to morph into.
+    selected.morphEnd = std::numeric_limits<float>::max();
+    selected.morphStart = selected.morphEnd * 0.5f;
+  }
+
+  selection.emplace_back(selected);
+}
+
+auto
+TerrainLod::GetDistance(const std::array<float, 3>& eye,
+                        const LodNode& node) const -> float
+{
+  auto cells = (NodeSize() - 1) * Stride(node.level);
+
+  auto lastX = std::min(node.x + cells, mWidth - 1);
+  auto lastY = std::min(node.y + cells, mHeight - 1);
+
+  // The same mapping as in the vertex shader of the view.
+  auto minX = ((float(node.x) + 0.5f) / float(mWidth)) * 2.0f - 1.0f;
+  auto maxX = ((float(lastX) + 0.5f) / float(mWidth)) * 2.0f - 1.0f;
+  auto minZ = 1.0f - ((float(lastY) + 0.5f) / float(mHeight)) * 2.0f;
+  auto maxZ = 1.0f - ((float(node.y) + 0.5f) / float(mHeight)) * 2.0f;
+
+  auto outside = [](float value, float min, float max) {
+    return std::max(std::max(min - value, value - max), 0.0f);
+  };
+
+  auto dx = outside(eye[0], minX, maxX);
+  auto dy = outside(eye[1], node.minHeight, node.maxHeight);
+  auto dz = outside(eye[2], minZ, maxZ);
+
+  return sqrtf((dx * dx) + (dy * dy) + (dz * dz));
+}
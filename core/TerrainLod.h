@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct HeightMap;
+
+/// A square of the terrain, drawn with @ref TerrainLod::NodeSize vertices
+/// per side.
+struct LodNode final
+{
+  /// Nodes of level zero have the full resolution, and each level above
+  /// skips every other vertex of the level below.
+  size_t level = 0;
+
+  /// The position of the first vertex, in height samples.
+  size_t x = 0;
+
+  size_t y = 0;
+
+  float minHeight = 0;
+
+  float maxHeight = 0;
+
+  /// An upper bound of the vertical distance between the node and the full
+  /// resolution height map.
+  float error = 0;
+
+  /// The nodes covering each quarter, or -1 where a quarter is outside of
+  /// the height map. Nodes of level zero have no children.
+  std::array<int32_t, 4> children{ { -1, -1, -1, -1 } };
+};
+
+/// A node to draw, along with the range of camera distances over which its
+/// vertices morph into the ones of its parent.
+struct LodSelection final
+{
+  size_t node = 0;
+
+  float morphStart = 0;
+
+  float morphEnd = 0;
+};
+
+/// Where the terrain is viewed from. The terrain is drawn from -1 to 1 on
+/// the x and z axes, with the heights along the y axis.
+struct LodView final
+{
+  std::array<float, 3> eye{ { 0, 0, 0 } };
+
+  /// The number of pixels covered by a length of one, at a distance of one.
+  float pixelsPerUnit = 1;
+
+  /// The largest error that may be visible, in pixels.
+  float maxPixelError = 1;
+
+  /// The lowest level to select, for views that do not have the height map
+  /// at its full resolution.
+  size_t minLevel = 0;
+};
+
+/// @brief A quadtree over a height map, used to draw distant parts of the
+/// terrain with fewer vertices.
+///
+/// @details Every node is drawn with the same number of vertices. The root
+/// covers the whole height map, and each level below covers a quarter of
+/// the area with the same number of vertices. Nodes are selected by how
+/// large their error would be on screen, so the number of triangles drawn
+/// depends on the resolution of the screen rather than of the height map.
+class TerrainLod final
+{
+public:
+  /// The number of vertices along each side of a node.
+  static constexpr size_t NodeSize() noexcept { return 256; }
+
+  static constexpr size_t NodeVertexCount() noexcept
+  {
+    return NodeSize() * NodeSize();
+  }
+
+  /// @return The distance between two vertices of a node at @p level, in
+  /// height samples.
+  static constexpr size_t Stride(size_t level) noexcept
+  {
+    return size_t(1) << level;
+  }
+
+  /// Rebuilds the quadtree for a new height map.
+  void Build(const HeightMap& heightMap);
+
+  /// @brief Updates the nodes that read changed parts of a height map. The
+  /// height map must have the size of the one the quadtree was built from.
+  ///
+  /// @param dirtyTiles One flag per tile of @p heightMap, row by row, set
+  /// for the tiles that changed since the last build or update.
+  void Update(const HeightMap& heightMap, const std::vector<bool>& dirtyTiles);
+
+  /// @return All the nodes. The root is the last one, and children come
+  /// before their parents.
+  auto GetNodes() const noexcept -> const std::vector<LodNode>&
+  {
+    return mNodes;
+  }
+
+  /// @brief Chooses the nodes to draw. The nodes cover the height map
+  /// without overlapping, and neighboring nodes differ by one level at most.
+  ///
+  /// @param selection Cleared before the nodes are added.
+  void Select(const LodView& view,
+              std::vector<LodSelection>& selection) const;
+
+private:
+  auto BuildNode(const HeightMap& heightMap, size_t level, size_t x, size_t y)
+    -> int32_t;
+
+  /// Computes the height range and the error of @p node, whose children
+  /// must be up to date.
+  void ComputeNode(const HeightMap& heightMap, LodNode& node) const;
+
+  void UpdateLevelStats();
+
+  /// @return True if @p node is computed from any dirty tile.
+  bool ReadsDirtyTile(const HeightMap& heightMap,
+                      const std::vector<bool>& dirtyTiles,
+                      const LodNode& node) const;
+
+  void SelectNode(const LodView& view,
+                  const std::vector<float>& ranges,
+                  size_t nodeIndex,
+                  std::vector<LodSelection>& selection) const;
+
+  /// @return The distance between @p eye and the bounding box of @p node.
+  auto GetDistance(const std::array<float, 3>& eye, const LodNode& node) const
+    -> float;
+
+  std::vector<LodNode> mNodes;
+
+  /// The largest error of the nodes of each level.
+  std::vector<float> mLevelErrors;
+
+  /// The largest bounding box diagonal of the nodes of each level.
+  std::vector<float> mLevelDiagonals;
+
+  size_t mWidth = 0;
+
+  size_t mHeight = 0;
+};
@@ -4,38 +4,124 @@
 
 #include "core/Backend.h"
 
+#include <terra/cancellation_token.h>
+
+#include <QTimer>
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <optional>
+#include <utility>
+
 namespace {
 
+/// @brief Passes the changes made to the project on to the backend and
+/// computes the height map on a background thread.
+///
+/// @details Edits that are made within @ref BackendUpdater::DebounceDelay of
+/// each other are coalesced into one computation, so that typing a number
+/// does not compute the height map once per digit. Each edit cancels the
+/// computation in flight, since its result would be out of date.
 class BackendUpdater final : public ProjectObserver
 {
 public:
   BackendUpdater(std::shared_ptr<Backend> backend)
     : mBackend(backend)
-  {}
+  {
+    mTimer.setSingleShot(true);
+
+    QObject::connect(&mTimer, &QTimer::timeout, [this]() { Compute(); });
+  }
+
+  ~BackendUpdater() { StopComputation(); }
 
   void ObserveHeightChange(const ir::Expr* heightExpr) override
   {
+    // The expression is only valid during this call, so it is passed on
+    // right away, once the backend is done with the previous one.
+    StopComputation();
+
     mBackend->UpdateHeightExpr(heightExpr);
 
-    mBackend->ComputeHeightMap();
+    ScheduleComputation();
   }
 
   void ObserveSurfaceChange(const ir::Expr* colorExpr) override
   {
+    auto wasRunning = StopComputation();
+
     mBackend->UpdateColorExpr(colorExpr);
 
     mBackend->ComputeSurface();
+
+    if (wasRunning)
+      ScheduleComputation();
   }
 
   void ObserveResolutionChange(size_t w, size_t h) override
   {
-    mBackend->Resize(w, h);
+    StopComputation();
+
+    // Resizing is left until the computation starts, so that the height map
+    // is not reallocated for every intermediate size.
+    mPendingSize = std::make_pair(w, h);
+
+    ScheduleComputation();
+  }
+
+private:
+  /// The time to wait for more edits before computing the height map, in
+  /// milliseconds.
+  static constexpr int DebounceDelay() noexcept { return 100; }
+
+  void ScheduleComputation() { mTimer.start(DebounceDelay()); }
+
+  void Compute()
+  {
+    StopComputation();
+
+    if (mPendingSize) {
+      mBackend->Resize(mPendingSize->first, mPendingSize->second);
+      mPendingSize.reset();
+    }
+
+    mToken = std::make_unique<CancellationToken>();
+
+    auto compute = [backend = mBackend, token = mToken.get()]() {
+      backend->ComputeHeightMap(token);
+    };
+
+    mComputation = std::async(std::launch::async, compute);
+  }
+
+  /// @brief Cancels the computation in flight and waits for it to stop.
+  ///
+  /// @return True if a computation was still running.
+  bool StopComputation()
+  {
+    if (!mComputation.valid())
+      return false;
+
+    auto status = mComputation.wait_for(std::chrono::seconds(0));
+
+    mToken->Cancel();
+
+    mComputation.get();
 
-    mBackend->ComputeHeightMap();
+    return status != std::future_status::ready;
   }
 
 private:
   std::shared_ptr<Backend> mBackend;
+
+  QTimer mTimer;
+
+  std::optional<std::pair<size_t, size_t>> mPendingSize;
+
+  std::unique_ptr<CancellationToken> mToken;
+
+  std::future<void> mComputation;
 };
 
 } // namespace
@@ -1,15 +1,23 @@
 #include "gui/SceneView.h"
 
 #include "core/Camera.h"
+#include "core/HeightMapExchange.h"
 #include "core/HeightMapObserver.h"
+#include "core/TerrainLod.h"
 
 #include "OpenGL.h"
 
 #include <glm/gtx/transform.hpp>
 
+#include <QOpenGLContext>
 #include <QOpenGLWidget>
 
+#include <algorithm>
 #include <iostream>
+#include <vector>
+
+#include <math.h>
+#include <stdint.h>
 
 namespace {
 
@@ -53,45 +61,103 @@ DumpGlError(unsigned int line, const char* expr, GLenum error)
 namespace {
 
 const char* gVertShaderSource = R"(
-#version 110
+#version 130
+
+in float gLocalIndex;
 
-attribute float gLocationIndex;
+// The heights at every texture stride, see Shader::ResizeHeightTexture.
+uniform sampler2D gHeightMap;
 
-attribute float gHeight;
+uniform float gTextureStride;
 
 uniform mat4 gMVP;
 
+uniform vec3 gEye;
+
 uniform float gTerrainWidth;
 
 uniform float gTerrainHeight;
 
-varying vec2 gTexCoord;
+uniform float gNodeSize;
+
+uniform vec2 gNodeOrigin;
+
+uniform float gNodeStride;
+
+uniform vec2 gMorphRange;
+
+out vec2 gTexCoord;
+
+vec2
+ToPosition(vec2 local)
+{
+  vec2 terrainSize = vec2(gTerrainWidth, gTerrainHeight);
+
+  // Nodes on the right and bottom edges are padded with the last vertex.
+  return min(gNodeOrigin + (local * gNodeStride), terrainSize - 1.0);
+}
+
+vec2
+ToCenter(vec2 local)
+{
+  vec2 terrainSize = vec2(gTerrainWidth, gTerrainHeight);
+
+  return (ToPosition(local) + 0.5) / terrainSize;
+}
+
+float
+GetHeight(vec2 local)
+{
+  ivec2 lastTexel = textureSize(gHeightMap, 0) - 1;
+
+  ivec2 texel = ivec2(ToPosition(local) / gTextureStride);
+
+  return texelFetch(gHeightMap, min(texel, lastTexel), 0).r;
+}
+
+vec3
+ToWorld(vec2 center, float height)
+{
+  return vec3(center.x * 2.0 - 1.0, height, 1.0 - center.y * 2.0);
+}
 
 void
 main()
 {
-  float x = mod(gLocationIndex, gTerrainWidth);
+  float localX = mod(gLocalIndex, gNodeSize);
+
+  float localY = floor(gLocalIndex / gNodeSize);
+
+  vec2 local = vec2(localX, localY);
+
+  float ownHeight = GetHeight(local);
+
+  vec3 pos = ToWorld(ToCenter(local), ownHeight);
 
-  float y = floor(gLocationIndex / gTerrainWidth);
+  float morphLength = gMorphRange.y - gMorphRange.x;
 
-  float uCenter = (x + 0.5) / gTerrainWidth;
+  float morph = (distance(gEye, pos) - gMorphRange.x) / morphLength;
 
-  float vCenter = (y + 0.5) / gTerrainHeight;
+  morph = clamp(morph, 0.0, 1.0);
 
-  gTexCoord = vec2(uCenter, vCenter);
+  // Vertices that the parent does not have slide onto the previous one it
+  // does have, which turns the node into its parent once fully morphed.
+  vec2 odd = mod((gNodeOrigin / gNodeStride) + local, 2.0);
 
-  float ndcX = uCenter * 2.0 - 1.0;
+  vec2 center = ToCenter(local - (odd * morph));
 
-  float ndcY = 1.0f - vCenter * 2.0;
+  gTexCoord = center;
 
-  gl_Position = gMVP * vec4(ndcX, gHeight, ndcY, 1.0);
+  float height = mix(ownHeight, GetHeight(local - odd), morph);
+
+  gl_Position = gMVP * vec4(ToWorld(center, height), 1.0);
 }
 )";
 
 const char* gFragShaderSource = R"(
-#version 110
+#version 130
 
-varying vec2 gTexCoord;
+in vec2 gTexCoord;
 
 void
 main()
@@ -100,13 +166,21 @@ main()
 }
 )";
 
+/// @brief Renders the terrain as the nodes of a @ref TerrainLod quadtree.
+///
+/// @details Every node has @ref TerrainLod::NodeSize vertices per side, so
+/// one 16-bit index buffer and one buffer of vertex indices within a node
+/// are shared by all nodes. Nodes differ by their origin and by the
+/// distance between their vertices. The heights are kept in a texture the
+/// size of the height map, from which the vertex shader reads both the
+/// height of a vertex and the one it morphs into.
 class Shader final
 {
 public:
   Shader()
     : mProgram(CreateShaderProgram())
   {
-    glGenBuffers(1, &mVertexBufferID);
+    glGenBuffers(1, &mLocalIndexBufferID);
 
     glGenBuffers(1, &mElementBufferID);
 
@@ -114,42 +188,106 @@ public:
 
     CHECK_GL_CALL(glActiveTexture(GL_TEXTURE0));
 
+    InitializeHeightTexture();
+
     mMvpLocation = glGetUniformLocation(mProgram.ID(), "gMVP");
 
+    mEyeLocation = glGetUniformLocation(mProgram.ID(), "gEye");
+
     mWidthLocation = glGetUniformLocation(mProgram.ID(), "gTerrainWidth");
 
     mHeightLocation = glGetUniformLocation(mProgram.ID(), "gTerrainHeight");
 
-    UpdateBufferSize(2, 2);
+    mNodeOriginLocation = glGetUniformLocation(mProgram.ID(), "gNodeOrigin");
+
+    mNodeStrideLocation = glGetUniformLocation(mProgram.ID(), "gNodeStride");
+
+    mMorphRangeLocation = glGetUniformLocation(mProgram.ID(), "gMorphRange");
+
+    mTextureStrideLocation =
+      glGetUniformLocation(mProgram.ID(), "gTextureStride");
+
+    auto heightMapLocation = glGetUniformLocation(mProgram.ID(), "gHeightMap");
+
+    glUniform1i(heightMapLocation, 0);
+
+    auto nodeSizeLocation = glGetUniformLocation(mProgram.ID(), "gNodeSize");
 
-    UpdateCameraData(1.0f);
+    glUniform1f(nodeSizeLocation, float(TerrainLod::NodeSize()));
 
-    const float initialHeight[4]{ 0, 0, 0, 0 };
+    InitializeSharedBuffers();
 
-    UpdateHeightMap(initialHeight, 2, 2);
+    UpdateViewport(1, 1);
+
+    HeightMap initialHeightMap;
+
+    initialHeightMap.Resize(2, 2);
+
+    std::fill(initialHeightMap.data.begin(), initialHeightMap.data.end(), 0);
+
+    UpdateHeightMap(initialHeightMap);
   }
 
-  void UpdateHeightMap(const float* data, size_t w, size_t h)
+  /// @brief Uploads the tiles which changed since the last height map. The
+  /// quadtree is only rebuilt, and all of the heights uploaded, when the
+  /// size of the height map changes.
+  void UpdateHeightMap(const HeightMap& heightMap)
   {
-    glBindBuffer(GL_ARRAY_BUFFER, mVertexBufferID);
+    auto resized =
+      (heightMap.w != mTerrainWidth) || (heightMap.h != mTerrainHeight);
 
-    auto attrib = glGetAttribLocation(mProgram.ID(), "gHeight");
+    auto tileCount = heightMap.TilesPerRow() * heightMap.TilesPerColumn();
 
-    glEnableVertexAttribArray(attrib);
+    mDirtyTiles.resize(tileCount);
 
-    using ConstVoidPtr = const void*;
+    // Height maps that were never published, like the initial one, have no
+    // tile versions, so all of their tiles are taken to have changed.
+    auto versioned = (heightMap.tileVersions.size() == tileCount) &&
+                     (mTileVersions.size() == tileCount);
 
-    auto offset = w * h * sizeof(float);
+    if (resized) {
 
-    auto offsetPtr = ConstVoidPtr(offset);
+      mLod.Build(heightMap);
 
-    auto stride = sizeof(float);
+      ResizeHeightTexture(heightMap.w, heightMap.h);
 
-    glVertexAttribPointer(attrib, 1, GL_FLOAT, GL_FALSE, stride, offsetPtr);
+      mTerrainWidth = heightMap.w;
 
-    glBufferSubData(GL_ARRAY_BUFFER, offset, w * h * sizeof(float), data);
+      mTerrainHeight = heightMap.h;
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+      glUniform1f(mWidthLocation, float(heightMap.w));
+
+      glUniform1f(mHeightLocation, float(heightMap.h));
+
+      std::fill(mDirtyTiles.begin(), mDirtyTiles.end(), true);
+
+    } else {
+
+      for (size_t i = 0; i < tileCount; i++) {
+        mDirtyTiles[i] =
+          !versioned || (heightMap.tileVersions[i] != mTileVersions[i]);
+      }
+
+      mLod.Update(heightMap, mDirtyTiles);
+    }
+
+    mTileVersions = heightMap.tileVersions;
+
+    UploadDirtyTiles(heightMap);
+  }
+
+  /// @param w The width of the viewport, in pixels.
+  ///
+  /// @param h The height of the viewport, in pixels.
+  void UpdateViewport(int w, int h)
+  {
+    w = std::max(w, 1);
+
+    h = std::max(h, 1);
+
+    UpdateCameraData(float(w) / float(h));
+
+    mView.pixelsPerUnit = float(h) / (2.0f * tanf(FieldOfView() * 0.5f));
   }
 
   void UpdateCameraData(float aspect)
@@ -161,7 +299,7 @@ public:
 
     float t_far = 100;
 
-    auto proj = glm::perspective(glm::radians(45.0f), aspect, t_near, t_far);
+    auto proj = glm::perspective(FieldOfView(), aspect, t_near, t_far);
 
     auto eye = glm::vec3(3, 3, 3);
     auto center = glm::vec3(0, 0, 0);
@@ -173,31 +311,47 @@ public:
     auto mvp = proj * view * model;
 
     glUniformMatrix4fv(mMvpLocation, 1, GL_FALSE, &mvp[0][0]);
+
+    glUniform3f(mEyeLocation, eye.x, eye.y, eye.z);
+
+    mView.eye = { { eye.x, eye.y, eye.z } };
   }
 
-  void UpdateBufferSize(size_t w, size_t h)
+  void Render()
   {
-    UpdateVertexBuffer(w, h);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    UpdateElementBuffer(w, h);
+    mLod.Select(mView, mSelection);
 
-    glUniform1f(mWidthLocation, float(w));
+    auto localIndexAttrib = glGetAttribLocation(mProgram.ID(), "gLocalIndex");
 
-    glUniform1f(mHeightLocation, float(h));
+    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, mLocalIndexBufferID));
 
-    mIndexCount = (w - 1) * (h - 1) * 6;
-  }
+    CHECK_GL_CALL(glEnableVertexAttribArray(localIndexAttrib));
 
-  void Render()
-  {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    CHECK_GL_CALL(glVertexAttribPointer(
+      localIndexAttrib, 1, GL_FLOAT, GL_FALSE, sizeof(float), nullptr));
 
-    CHECK_GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, mVertexBufferID));
+    CHECK_GL_CALL(glBindTexture(GL_TEXTURE_2D, mHeightTextureID));
 
     CHECK_GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mElementBufferID));
 
-    CHECK_GL_CALL(
-      glDrawElements(GL_TRIANGLES, mIndexCount, GL_UNSIGNED_INT, 0));
+    const auto& nodes = mLod.GetNodes();
+
+    for (const auto& selected : mSelection) {
+
+      const auto& node = nodes[selected.node];
+
+      glUniform2f(mNodeOriginLocation, float(node.x), float(node.y));
+
+      glUniform1f(mNodeStrideLocation, float(TerrainLod::Stride(node.level)));
+
+      glUniform2f(
+        mMorphRangeLocation, selected.morphStart, selected.morphEnd);
+
+      CHECK_GL_CALL(
+        glDrawElements(GL_TRIANGLES, mIndexCount, GL_UNSIGNED_SHORT, 0));
+    }
 
     CHECK_GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
 
@@ -205,57 +359,171 @@ public:
   }
 
 private:
-  void UpdateVertexBuffer(size_t w, size_t h)
+  /// The vertical field of view, in radians.
+  static constexpr float FieldOfView() noexcept { return 0.785398f; }
+
+  void InitializeHeightTexture()
+  {
+    glGenTextures(1, &mHeightTextureID);
+
+    glBindTexture(GL_TEXTURE_2D, mHeightTextureID);
+
+    // Heights are only read with texelFetch, and a texture without mipmaps
+    // would be incomplete with the default filter.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLint maxTextureSize = 0;
+
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+
+    mMaxTextureSize = size_t(std::max(maxTextureSize, 1));
+  }
+
+  /// @brief Reallocates the height texture for a height map of @p w by @p h
+  /// samples.
+  ///
+  /// @details A height map larger than the largest texture is kept at every
+  /// other sample, or every fourth and so on, and the nodes drawn from it
+  /// are limited to the levels that do not need the skipped samples.
+  void ResizeHeightTexture(size_t w, size_t h)
   {
-    std::vector<float> indexBuffer(w * h);
+    size_t level = 0;
 
-    for (size_t i = 0; i < (w * h); i++)
-      indexBuffer[i] = i;
+    while (((std::max(w, h) - 1) >> level) >= mMaxTextureSize)
+      level++;
 
-    glBindBuffer(GL_ARRAY_BUFFER, mVertexBufferID);
+    mView.minLevel = level;
 
-    // The size here is one location value and one height value per vertex
-    auto bufferSize = w * h * 2 * sizeof(float);
+    mTextureStride = TerrainLod::Stride(level);
 
-    glBufferData(GL_ARRAY_BUFFER, bufferSize, nullptr, GL_DYNAMIC_DRAW);
+    mTextureWidth = ((w - 1) / mTextureStride) + 1;
 
-    auto posAttrib = glGetAttribLocation(mProgram.ID(), "gLocationIndex");
+    mTextureHeight = ((h - 1) / mTextureStride) + 1;
 
-    glEnableVertexAttribArray(posAttrib);
+    glUniform1f(mTextureStrideLocation, float(mTextureStride));
 
-    glVertexAttribPointer(posAttrib, 1, GL_FLOAT, GL_FALSE, sizeof(float), 0);
+    glBindTexture(GL_TEXTURE_2D, mHeightTextureID);
 
-    glBufferSubData(GL_ARRAY_BUFFER,
-                    0,
-                    indexBuffer.size() * sizeof(indexBuffer[0]),
-                    indexBuffer.data());
+    glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_R32F,
+                 GLsizei(mTextureWidth),
+                 GLsizei(mTextureHeight),
+                 0,
+                 GL_RED,
+                 GL_FLOAT,
+                 nullptr);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  /// Uploads the texels of each dirty tile of @p heightMap.
+  void UploadDirtyTiles(const HeightMap& heightMap)
+  {
+    auto tileSize = HeightMap::TileSize();
+
+    auto tilesPerRow = heightMap.TilesPerRow();
+
+    // The first texel at or after a position of the height map.
+    auto toTexel = [this](size_t pos) {
+      return (pos + mTextureStride - 1) / mTextureStride;
+    };
+
+    glBindTexture(GL_TEXTURE_2D, mHeightTextureID);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    for (size_t i = 0; i < mDirtyTiles.size(); i++) {
+
+      if (!mDirtyTiles[i])
+        continue;
+
+      auto x0 = toTexel((i % tilesPerRow) * tileSize);
+      auto y0 = toTexel((i / tilesPerRow) * tileSize);
+
+      auto x1 = std::min(toTexel(((i % tilesPerRow) + 1) * tileSize),
+                         mTextureWidth);
+      auto y1 = std::min(toTexel(((i / tilesPerRow) + 1) * tileSize),
+                         mTextureHeight);
+
+      if ((x0 >= x1) || (y0 >= y1))
+        continue;
+
+      mTileTexels.resize((x1 - x0) * (y1 - y0));
+
+      auto* texel = mTileTexels.data();
+
+      for (auto y = y0; y < y1; y++) {
+
+        const auto* row = &heightMap.data[y * mTextureStride * heightMap.w];
+
+        for (auto x = x0; x < x1; x++)
+          *texel++ = row[x * mTextureStride];
+      }
+
+      glTexSubImage2D(GL_TEXTURE_2D,
+                      0,
+                      GLint(x0),
+                      GLint(y0),
+                      GLsizei(x1 - x0),
+                      GLsizei(y1 - y0),
+                      GL_RED,
+                      GL_FLOAT,
+                      mTileTexels.data());
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
   }
 
-  void UpdateElementBuffer(size_t w, size_t h)
+  /// Fills the buffers that are the same for every node.
+  void InitializeSharedBuffers()
   {
-    auto buf = InitializeElementBuffer(w, h);
+    std::vector<float> localIndices(TerrainLod::NodeVertexCount());
+
+    for (size_t i = 0; i < localIndices.size(); i++)
+      localIndices[i] = float(i);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mLocalIndexBufferID);
+
+    glBufferData(GL_ARRAY_BUFFER,
+                 localIndices.size() * sizeof(localIndices[0]),
+                 localIndices.data(),
+                 GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    auto elements = InitializeElementBuffer();
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mElementBufferID);
 
     glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 buf.size() * sizeof(buf[0]),
-                 buf.data(),
-                 GL_DYNAMIC_DRAW);
+                 elements.size() * sizeof(elements[0]),
+                 elements.data(),
+                 GL_STATIC_DRAW);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    mIndexCount = GLsizei(elements.size());
   }
 
-  static auto InitializeElementBuffer(size_t w, size_t h)
-    -> std::vector<uint32_t>
+  /// @return The triangles of one node.
+  static auto InitializeElementBuffer() -> std::vector<uint16_t>
   {
-    size_t bufW = w - 1;
-    size_t bufH = h - 1;
+    static_assert(TerrainLod::NodeVertexCount() <= 65536,
+                  "indices must fit 16 bits");
+
+    size_t bufW = TerrainLod::NodeSize() - 1;
+    size_t bufH = TerrainLod::NodeSize() - 1;
 
-    std::vector<uint32_t> buf(bufW * bufH * 6);
+    std::vector<uint16_t> buf(bufW * bufH * 6);
 
-    auto toVertIndex = [w](size_t x, size_t y) { return (y * w) + x; };
+    auto toVertIndex = [](size_t x, size_t y) {
+      return uint16_t((y * TerrainLod::NodeSize()) + x);
+    };
 
     auto* ptr = buf.data();
 
@@ -311,8 +579,14 @@ private:
   }
 
 private:
-  GLuint mVertexBufferID = 0;
+  /// The index of each vertex within a node, shared by all nodes.
+  GLuint mLocalIndexBufferID = 0;
+
+  /// The heights, one texel per sample of the height map, or per texture
+  /// stride when the height map does not fit.
+  GLuint mHeightTextureID = 0;
 
+  /// The triangles of a node, shared by all nodes.
   GLuint mElementBufferID = 0;
 
   GlProgram mProgram = GlProgram::MakeInvalid();
@@ -323,42 +597,67 @@ private:
 
   GLint mHeightLocation = -1;
 
-  /// The number of vertex indices.
-  /// Only changes when the terrain size is changed.
+  GLint mEyeLocation = -1;
+
+  GLint mNodeOriginLocation = -1;
+
+  GLint mNodeStrideLocation = -1;
+
+  GLint mMorphRangeLocation = -1;
+
+  GLint mTextureStrideLocation = -1;
+
+  /// The number of vertex indices per node.
   GLsizei mIndexCount = 0;
-};
 
-struct HeightMapUpdate final
-{
-  const float* data = nullptr;
-  size_t w = 0;
-  size_t h = 0;
-  bool seen = true;
+  size_t mMaxTextureSize = 1;
+
+  /// The distance between the samples of the height map that are in the
+  /// height texture.
+  size_t mTextureStride = 1;
+
+  size_t mTextureWidth = 0;
+
+  size_t mTextureHeight = 0;
+
+  size_t mTerrainWidth = 0;
+
+  size_t mTerrainHeight = 0;
+
+  /// The tile versions of the height map that was uploaded last.
+  std::vector<uint64_t> mTileVersions;
+
+  std::vector<bool> mDirtyTiles;
+
+  /// The texels of the tile being uploaded, kept to reuse the memory.
+  std::vector<float> mTileTexels;
+
+  TerrainLod mLod;
+
+  LodView mView;
+
+  /// The nodes drawn by the last frame, kept to reuse the memory.
+  std::vector<LodSelection> mSelection;
 };
 
+/// Tells the widget to render the height map that was just published.
 class HeightMapUpdater final : public HeightMapObserver
 {
 public:
-  HeightMapUpdater(QOpenGLWidget* glWidget,
-                   std::shared_ptr<HeightMapUpdate> update)
+  HeightMapUpdater(QOpenGLWidget* glWidget)
     : mGlWidget(glWidget)
-    , mHeightMapUpdate(update)
   {}
 
-  void Observe(const float* data, size_t w, size_t h) override
+  /// May be called from any thread. The height map itself is acquired from
+  /// the exchange when the widget is painted.
+  void Observe(const float*, size_t, size_t) override
   {
-    mHeightMapUpdate->data = data;
-    mHeightMapUpdate->w = w;
-    mHeightMapUpdate->h = h;
-    mHeightMapUpdate->seen = false;
-
-    mGlWidget->update();
+    // Widgets may only be used from the thread they belong to.
+    QMetaObject::invokeMethod(mGlWidget, "update", Qt::QueuedConnection);
   }
 
 private:
   QOpenGLWidget* mGlWidget = nullptr;
-
-  std::shared_ptr<HeightMapUpdate> mHeightMapUpdate;
 };
 
 class GlWidget final : public QOpenGLWidget
@@ -366,14 +665,16 @@ class GlWidget final : public QOpenGLWidget
 public:
   GlWidget(QWidget* parent)
     : QOpenGLWidget(parent)
-    , mHeightMapUpdate(new HeightMapUpdate())
   {}
 
-  auto MakeHeightMapUpdater() -> std::unique_ptr<HeightMapObserver>
+  auto MakeHeightMapUpdater(std::shared_ptr<HeightMapExchange> heightMaps)
+    -> std::unique_ptr<HeightMapObserver>
   {
     using Ret = std::unique_ptr<HeightMapObserver>;
 
-    return Ret(new HeightMapUpdater(this, mHeightMapUpdate));
+    mHeightMaps = std::move(heightMaps);
+
+    return Ret(new HeightMapUpdater(this));
   }
 
 private:
@@ -381,33 +682,40 @@ private:
   {
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
+    // The platform may give an older context than the one requested, which
+    // cannot compile the shaders, so the view is left empty.
+    auto version = context()->format().version();
+
+    if (version < qMakePair(3, 0)) {
+      std::cerr << "OpenGL 3.0 is required, but the context is version "
+                << version.first << "." << version.second << std::endl;
+      return;
+    }
+
     mShader = std::make_unique<Shader>();
   }
 
   void paintGL() override
   {
-    if (!mHeightMapUpdate->seen) {
-
-      UpdateHeightMap();
-
-      mHeightMapUpdate->seen = true;
-    }
+    if (mHeightMaps && mHeightMaps->Acquire())
+      UpdateHeightMap(mHeightMaps->GetFrontBuffer());
 
     if (mShader)
       mShader->Render();
   }
 
-  void resizeGL(int w, int h) override { glViewport(0, 0, w, h); }
-
-  void UpdateHeightMap()
+  void resizeGL(int w, int h) override
   {
-    auto data = mHeightMapUpdate->data;
-    auto w = mHeightMapUpdate->w;
-    auto h = mHeightMapUpdate->h;
+    glViewport(0, 0, w, h);
 
-    mShader->UpdateBufferSize(w, h);
+    if (mShader)
+      mShader->UpdateViewport(w, h);
+  }
 
-    mShader->UpdateHeightMap(data, w, h);
+  void UpdateHeightMap(const HeightMap& heightMap)
+  {
+    if (mShader)
+      mShader->UpdateHeightMap(heightMap);
   }
 
 private:
@@ -415,7 +723,8 @@ private:
 
   std::unique_ptr<Shader> mShader;
 
-  std::shared_ptr<HeightMapUpdate> mHeightMapUpdate;
+  /// The view is the consumer of the exchange.
+  std::shared_ptr<HeightMapExchange> mHeightMaps;
 };
 
 class SceneViewImpl final : public SceneView
@@ -429,9 +738,10 @@ public:
 
   QWidget* GetWidget() override { return &mGlWidget; }
 
-  auto MakeHeightMapUpdater() -> std::unique_ptr<HeightMapObserver> override
+  auto MakeHeightMapUpdater(std::shared_ptr<HeightMapExchange> heightMaps)
+    -> std::unique_ptr<HeightMapObserver> override
   {
-    return mGlWidget.MakeHeightMapUpdater();
+    return mGlWidget.MakeHeightMapUpdater(std::move(heightMaps));
   }
 
 private:
@@ -3,6 +3,7 @@
 #include <memory>
 
 class QWidget;
+class HeightMapExchange;
 class HeightMapObserver;
 
 class SceneView
@@ -14,5 +15,10 @@ public:
 
   virtual QWidget* GetWidget() = 0;
 
-  virtual auto MakeHeightMapUpdater() -> std::unique_ptr<HeightMapObserver> = 0;
+  /// @brief Makes an observer that repaints the view whenever a height map
+  /// is published to @p heightMaps. The view becomes the consumer of the
+  /// exchange.
+  virtual auto MakeHeightMapUpdater(
+    std::shared_ptr<HeightMapExchange> heightMaps)
+    -> std::unique_ptr<HeightMapObserver> = 0;
 };
@@ -0,0 +1,168 @@
+#include <terra/interpreter.h>
+#include <terra/png_writer.h>
+
+#include <terra/exprs/binary.h>
+#include <terra/exprs/literals.h>
+#include <terra/exprs/unary.h>
+#include <terra/exprs/var_ref.h>
+#include <terra/exprs/vector_combiner.h>
+
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+namespace {
+
+using SharedExprPtr = std::shared_ptr<terra::Expr>;
+
+auto
+MakeVar(terra::VarRefExpr::ID id) -> SharedExprPtr
+{
+  return SharedExprPtr(new terra::VarRefExpr(id));
+}
+
+auto
+MakeFloat(float value) -> SharedExprPtr
+{
+  return SharedExprPtr(new terra::LiteralExpr<float>(value));
+}
+
+auto
+MakeBinary(terra::BinaryExpr::ID id, SharedExprPtr l, SharedExprPtr r)
+  -> SharedExprPtr
+{
+  return SharedExprPtr(new terra::BinaryExpr(id, std::move(l), std::move(r)));
+}
+
+auto
+MakeUnary(terra::UnaryExpr::ID id, SharedExprPtr input) -> SharedExprPtr
+{
+  return SharedExprPtr(new terra::UnaryExpr(id, std::move(input)));
+}
+
+auto
+MakeColorExpr() -> SharedExprPtr
+{
+  std::array<SharedExprPtr, 3> elements;
+  elements[0] = MakeVar(terra::VarRefExpr::ID::CenterU);
+  elements[1] = MakeVar(terra::VarRefExpr::ID::CenterV);
+  elements[2] = MakeFloat(1.0f);
+
+  return SharedExprPtr(new terra::VectorCombiner<3>(std::move(elements)));
+}
+
+struct Terrain final
+{
+  const char* name;
+
+  SharedExprPtr heightExpr;
+};
+
+/// A smooth slope, rolling hills and fine ridges, which compress very
+/// differently.
+auto
+MakeTerrains() -> std::vector<Terrain>
+{
+  using ID = terra::BinaryExpr::ID;
+
+  using UnaryID = terra::UnaryExpr::ID;
+
+  auto u = MakeVar(terra::VarRefExpr::ID::CenterU);
+  auto v = MakeVar(terra::VarRefExpr::ID::CenterV);
+  auto half = MakeFloat(0.5f);
+
+  auto slope = MakeBinary(ID::Mul, MakeBinary(ID::Add, u, v), half);
+
+  auto sinU = MakeUnary(UnaryID::Sine, MakeBinary(ID::Mul, u, MakeFloat(7)));
+  auto cosV = MakeUnary(UnaryID::Cosine, MakeBinary(ID::Mul, v, MakeFloat(5)));
+
+  auto hills = MakeBinary(ID::Mul, MakeBinary(ID::Mul, sinU, cosV), half);
+
+  hills = MakeBinary(ID::Add, hills, half);
+
+  auto uv = MakeBinary(ID::Mul, u, v);
+
+  auto uvScaled = MakeBinary(ID::Mul, uv, MakeFloat(400));
+
+  auto ridges = MakeUnary(UnaryID::Sine, uvScaled);
+
+  ridges = MakeBinary(ID::Add, MakeBinary(ID::Mul, ridges, half), half);
+
+  return { { "slope", slope }, { "hills", hills }, { "ridges", ridges } };
+}
+
+struct Profile final
+{
+  const char* name;
+
+  terra::PngProfile profile;
+};
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+  size_t size = (argc > 1) ? size_t(atoi(argv[1])) : 2048;
+
+  Profile profiles[]{ { "fastest", terra::PngProfile::Fastest },
+                      { "balanced", terra::PngProfile::Balanced },
+                      { "smallest", terra::PngProfile::Smallest },
+                      { "archival", terra::PngProfile::Archival } };
+
+  auto colorExpr = MakeColorExpr();
+
+  // 16-bit height and 8-bit RGB per pixel.
+  auto rawBytes = double(size * size * (2 + 3));
+
+  std::cout << "size: " << size << "x" << size << std::endl;
+
+  std::cout << std::left << std::setw(10) << "terrain" << std::setw(10)
+            << "profile" << std::right << std::setw(10) << "MB/s"
+            << std::setw(14) << "height bytes" << std::setw(14)
+            << "color bytes" << std::endl;
+
+  for (const auto& terrain : MakeTerrains()) {
+
+    for (const auto& profile : profiles) {
+
+      auto start = std::chrono::steady_clock::now();
+
+      {
+        auto pngWriter = terra::PngWriter::Make(
+          size, size, "bench-height.png", "bench-color.png", profile.profile);
+
+        auto interpreter = terra::LineInterpreter::Make(size, size, *pngWriter);
+
+        interpreter->SetHeightExpr(*terrain.heightExpr);
+
+        interpreter->SetColorExpr(*colorExpr);
+
+        interpreter->Execute();
+      }
+
+      auto end = std::chrono::steady_clock::now();
+
+      auto seconds = std::chrono::duration<double>(end - start).count();
+
+      std::cout << std::left << std::setw(10) << terrain.name << std::setw(10)
+                << profile.name << std::right << std::setw(10) << std::fixed
+                << std::setprecision(1) << ((rawBytes / 1e6) / seconds)
+                << std::setw(14)
+                << std::filesystem::file_size("bench-height.png")
+                << std::setw(14)
+                << std::filesystem::file_size("bench-color.png") << std::endl;
+    }
+  }
+
+  std::filesystem::remove("bench-height.png");
+
+  std::filesystem::remove("bench-color.png");
+
+  return 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <unordered_map>
+
+namespace terra {
+
+class Expr;
+
+/// A closed range of float values.
+struct Interval final
+{
+  float min = 0;
+
+  float max = 0;
+
+  /// Whether NaN may be among the values as well.
+  bool mayBeNaN = false;
+
+  /// @return True if every value in the range is the same number.
+  bool IsConstant() const noexcept { return !mayBeNaN && (min == max); }
+};
+
+/// @brief Finds conservative bounds of the values that each node of an
+/// expression takes over a rectangle of u and v coordinates, using interval
+/// arithmetic. Each node is evaluated once, instead of once per point.
+///
+/// @details The bounds contain every value the node takes when evaluated in
+/// single precision at any point of the rectangle, including rounding. They
+/// are not always tight, since a value that appears more than once in an
+/// expression is treated as if the appearances were independent.
+class BoundsAnalysis final
+{
+public:
+  BoundsAnalysis(const Expr& root, const Interval& u, const Interval& v);
+
+  /// @param expr Must be a node of the analyzed expression.
+  ///
+  /// @return The bounds of the node, or an unbounded range that may be NaN if
+  /// the node was not analyzed or is a vector.
+  auto GetBounds(const Expr& expr) const -> Interval;
+
+private:
+  std::unordered_map<const Expr*, Interval> mBounds;
+};
+
+} // namespace terra
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <atomic>
+
+namespace terra {
+
+/// Lets a frame, an export or a height map of the application's backends
+/// running on other threads be stopped early. Cancellation is cooperative:
+/// the interpreters check the token once per tile or row, so work that has
+/// already started is finished or dropped at the next check.
+class CancellationToken final
+{
+public:
+  /// Can be called from any thread.
+  void Cancel() noexcept { mCancelled.store(true, std::memory_order_relaxed); }
+
+  /// Can be called from any thread.
+  bool IsCancelled() const noexcept
+  {
+    return mCancelled.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<bool> mCancelled{ false };
+};
+
+} // namespace terra
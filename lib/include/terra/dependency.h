@@ -0,0 +1,34 @@
+#pragma once
+
+#include <unordered_map>
+
+namespace terra {
+
+class Expr;
+
+/// The builtin variables that an expression depends on. Can be combined as a
+/// bit mask.
+enum class Dependency
+{
+  None = 0,
+  U = 1,
+  V = 2,
+  UV = 3
+};
+
+/// Finds the builtin variables that each node of an expression depends on.
+/// An expression that only depends on u has the same value along a column,
+/// one that only depends on v has the same value along a row.
+class DependencyAnalysis final
+{
+public:
+  DependencyAnalysis(const Expr& root);
+
+  /// @param expr Must be a node of the analyzed expression.
+  auto GetDependency(const Expr& expr) const -> Dependency;
+
+private:
+  std::unordered_map<const Expr*, Dependency> mDependencies;
+};
+
+} // namespace terra
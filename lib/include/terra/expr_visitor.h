@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 namespace terra {
 
 class VarRefExpr;
@@ -2,6 +2,8 @@
 
 #include <terra/expr.h>
 
+#include <terra/expr_visitor.h>
+
 #include <memory>
 
 namespace terra {
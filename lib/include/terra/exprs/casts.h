@@ -2,6 +2,8 @@
 
 #include <terra/expr.h>
 
+#include <memory>
+
 namespace terra {
 
 class CastExpr : public Expr
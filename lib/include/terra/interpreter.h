@@ -2,8 +2,11 @@
 
 #include <memory>
 
+#include <stddef.h>
+
 namespace terra {
 
+class CancellationToken;
 class Expr;
 class TileObserver;
 class LineObserver;
@@ -25,25 +28,47 @@ public:
   virtual bool FrameIsDone() const noexcept = 0;
 
   /// Indicates the number of tiles that still need to be rendered within a
-  /// frame.
+  /// frame, counting each level of a progressive frame separately. Tiles
+  /// skipped because the frame was cancelled are not included.
   ///
   /// @return The number of remaining tiles. If no frame is currently being
   /// rendered, then this function returns zero.
   virtual size_t TilesRemaining() const noexcept = 0;
 
-  /// Begins rendering a frame.
+  /// Indicates how many tiles of the frame were skipped because its
+  /// cancellation token was cancelled. Skipped tiles are never passed to the
+  /// tile observers, so the ones that were observed are the partial result.
   ///
-  /// @return True on success, false if a frame is currently being rendered.
-  virtual bool BeginFrame() = 0;
+  /// @return The number of skipped tiles. If no frame is currently being
+  /// rendered, then this function returns zero.
+  virtual size_t TilesSkipped() const noexcept = 0;
 
-  /// Checks for completed tiles.
+  /// Begins rendering a frame. The first tiles of the frame are queued to be
+  /// rendered on worker threads, and the others as completed tiles are
+  /// polled.
+  ///
+  /// @param token If not null, the tiles that have not been rendered when it
+  /// is cancelled are skipped. The frame is done once the tiles that were
+  /// rendered have been polled, and still has to be ended.
   ///
-  /// @param timeout The number of milliseconds to wait before returning.
+  /// @return True on success, false if a frame is currently being rendered or
+  /// if there is no height expression.
+  virtual bool BeginFrame(
+    std::shared_ptr<const CancellationToken> token = nullptr) = 0;
+
+  /// Checks for completed tiles and passes them to the tile observers. The
+  /// observers are called from the thread calling this function. Only a few
+  /// tiles are rendered or buffered at once, so no more tiles are started
+  /// until this function is called once the workers get too far ahead.
+  ///
+  /// @param timeout The maximum number of milliseconds to wait for a tile to
+  /// complete, if none have completed yet.
   ///
   /// @return True on success, false if no frame is currently being rendered.
   virtual bool PollTiles(size_t timeout) = 0;
 
-  /// Completes the frame rendering process.
+  /// Completes the frame rendering process. If there are tiles that have not
+  /// been rendered yet, they are discarded.
   ///
   /// @return True on success, false if no frame is currently being rendered.
   virtual bool EndFrame() = 0;
@@ -59,6 +84,16 @@ public:
   virtual bool SetHeightExpr(const Expr&) = 0;
 
   virtual void SetResolution(size_t w, size_t h) = 0;
+
+  /// @brief Makes the following frames render the whole image at a coarse
+  /// level before refining it, so that a preview is available early.
+  ///
+  /// @details A progressive frame has three passes: level two computes one
+  /// value out of 16, level one computes one out of four and level zero
+  /// computes the rest. Each pass only computes the values the previous ones
+  /// did not. Every tile is passed to the tile observers once per pass, and
+  /// all tiles of a pass are started before the ones of the next pass.
+  virtual void SetProgressive(bool progressive) = 0;
 };
 
 /// Used to render terrain by scanline, using portable C++.
@@ -75,7 +110,26 @@ public:
 
   virtual bool SetColorExpr(const Expr& colorExpr) = 0;
 
-  virtual bool Execute() = 0;
+  /// Sets the maximum number of rows that are rendered or waiting to be
+  /// passed to the line observer at once, which bounds the memory used by
+  /// @ref LineInterpreter::Execute. Zero, the default, picks a number based
+  /// on the thread count.
+  virtual void SetRowsInFlight(size_t rowCount) = 0;
+
+  /// Renders the rows on worker threads. The line observer is called from the
+  /// calling thread, one row at a time and in order from top to bottom.
+  ///
+  /// @param token If not null, rendering stops once it is cancelled. The rows
+  /// that were passed to the line observer up to that point are complete.
+  ///
+  /// @return True if every row was passed to the line observer, false if
+  /// there is no expression or the token was cancelled.
+  virtual bool Execute(const CancellationToken* token = nullptr) = 0;
+
+  /// @return The number of rows passed to the line observer by the last call
+  /// to @ref LineInterpreter::Execute, which is less than the height if it
+  /// was cancelled.
+  virtual size_t RowsObserved() const noexcept = 0;
 };
 
 } // namespace terra
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <memory>
+
+namespace terra {
+
+class Expr;
+
+/// Folds subexpressions that only depend on literals and removes arithmetic
+/// identities, such as multiplying by one or adding zero. Division by a
+/// constant is replaced by multiplication with its reciprocal.
+///
+/// @return A simplified copy of @p expr.
+auto
+Simplify(const Expr& expr) -> std::unique_ptr<Expr>;
+
+} // namespace terra
@@ -8,6 +8,26 @@
 
 namespace terra {
 
+/// Trades the speed of an export against the size of the files. All
+/// profiles produce the same image.
+enum class PngProfile
+{
+  /// Fixed row filters and the lowest compression level.
+  Fastest,
+  /// Fixed row filters and the default compression level. Slower than
+  /// @ref PngProfile::Fastest, and never larger.
+  Balanced,
+  /// Each row gets the filter it compresses best with, and each block of
+  /// data is compressed a few ways, keeping the smallest. The slowest
+  /// profile, and usually the smallest. On terrains that compress very well
+  /// or very poorly, it may be larger than another profile by up to half a
+  /// percent.
+  Smallest,
+  /// The best filter per row and the highest compression level. These are
+  /// the settings libpng uses at its highest level.
+  Archival
+};
+
 class PngWriter : public LineObserver
 {
 public:
@@ -18,14 +38,32 @@ public:
   /// @param heightPath The path to save the height file at.
   ///
   /// @param colorPath The path to save the color file at.
+  ///
+  /// @param profile How to compress the files.
+  ///
+  /// The files are completed when the writer is destroyed. If fewer rows
+  /// than @p height were observed, or if writing failed, they are removed
+  /// instead.
   static auto Make(size_t width,
                    size_t height,
                    const char* heightPath,
-                   const char* colorPath) -> std::unique_ptr<PngWriter>;
+                   const char* colorPath,
+                   PngProfile profile = PngProfile::Archival)
+    -> std::unique_ptr<PngWriter>;
 
   virtual ~PngWriter() = default;
 
+  /// Sets the heights that map to zero and to the largest 16-bit value.
   virtual void SetHeightRange(float min, float max) = 0;
+
+  /// Uses the range of the heights that are observed, so that the whole
+  /// 16-bit range is used. The heights are kept in a temporary file next to
+  /// the height file until the last row is observed, and then written. The
+  /// color file is still written as rows come in.
+  ///
+  /// @return True on success, false if the temporary file could not be
+  /// created or if rows have been observed already.
+  virtual bool EnableAutoHeightRange() = 0;
 };
 
 } // namespace terra
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <terra/line_observer.h>
+
+#include <memory>
+
+#include <stddef.h>
+
+namespace terra {
+
+/// The height map formats that game engines import directly.
+enum class RawFormat
+{
+  /// Unsigned 16-bit little-endian values without a header, rows from top to
+  /// bottom. This is the .r16 format of Unreal.
+  R16,
+  /// Same as @ref RawFormat::R16, but with the rows from bottom to top, as
+  /// Unity reads .raw files (16-bit, Windows byte order) into its terrain.
+  UnityRaw,
+  /// A 16-byte header followed by 32-bit little-endian floats, rows from top
+  /// to bottom. The header contains "TRHM", the format version (1), the width
+  /// and the height, each field 4 bytes and little-endian. The heights are
+  /// written as they are, without the height range applied.
+  Float32
+};
+
+/// Writes the height of each row into a memory-mapped file, at the offset of
+/// the row. The file is sized up front, so writing a row is only a copy and
+/// the kernel writes the pages back to disk. If the writer is destroyed
+/// before all of the rows are observed, the file is removed.
+class RawWriter : public LineObserver
+{
+public:
+  /// @param width The width of the terrain.
+  ///
+  /// @param height The height of the terrain.
+  ///
+  /// @param path The path to save the height file at.
+  ///
+  /// @return Null if the file could not be created or mapped.
+  static auto Make(size_t width,
+                   size_t height,
+                   const char* path,
+                   RawFormat format) -> std::unique_ptr<RawWriter>;
+
+  virtual ~RawWriter() = default;
+
+  /// Sets the heights that map to zero and to the largest value, for the
+  /// 16-bit formats. Heights outside of the range are clamped.
+  virtual void SetHeightRange(float min, float max) = 0;
+};
+
+} // namespace terra
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+
+#if defined(__AVX2__)
+#define SIMD_AVX2
+#define SIMD_AVX2_TARGET
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SIMD_AVX2
+#define SIMD_AVX2_DISPATCH
+#define SIMD_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+#if defined(SIMD_AVX2)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/// @brief Element-wise kernels over spans of floats. Header-only, so that the
+/// core of the application can use them without linking the library.
+///
+/// @details The baseline kernels use the widest instruction set enabled at
+/// compile time. On x86 the AVX2 kernels are also compiled when the build
+/// does not enable AVX2, and are chosen at run time if the processor has it.
+/// The trig functions are evaluated with the C library, one element at a
+/// time, so that the results are identical to the scalar path.
+namespace terra {
+
+namespace simd {
+
+namespace detail {
+
+#if defined(SIMD_AVX2)
+
+#define SIMD_BINARY_KERNEL(name, intrinsic, op)                                \
+  SIMD_AVX2_TARGET inline void name##Avx2(                                     \
+    const float* a, const float* b, float* out, size_t n)                      \
+  {                                                                            \
+    size_t i = 0;                                                              \
+    for (; (i + 8) <= n; i += 8) {                                             \
+      auto result = intrinsic(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)); \
+      _mm256_storeu_ps(out + i, result);                                       \
+    }                                                                          \
+    for (; i < n; i++)                                                         \
+      out[i] = a[i] op b[i];                                                   \
+  }
+
+SIMD_BINARY_KERNEL(Add, _mm256_add_ps, +)
+SIMD_BINARY_KERNEL(Sub, _mm256_sub_ps, -)
+SIMD_BINARY_KERNEL(Mul, _mm256_mul_ps, *)
+SIMD_BINARY_KERNEL(Div, _mm256_div_ps, /)
+
+#undef SIMD_BINARY_KERNEL
+
+SIMD_AVX2_TARGET inline void
+TruncateAvx2(const float* in, float* out, size_t n)
+{
+  constexpr int mode = _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC;
+
+  size_t i = 0;
+
+  for (; (i + 8) <= n; i += 8)
+    _mm256_storeu_ps(out + i, _mm256_round_ps(_mm256_loadu_ps(in + i), mode));
+
+  for (; i < n; i++)
+    out[i] = truncf(in[i]);
+}
+
+#endif // SIMD_AVX2
+
+#if defined(__SSE2__)
+
+#define SIMD_BINARY_KERNEL(name, intrinsic, op)                                \
+  inline void name##Baseline(                                                  \
+    const float* a, const float* b, float* out, size_t n)                      \
+  {                                                                            \
+    size_t i = 0;                                                              \
+    for (; (i + 4) <= n; i += 4) {                                             \
+      auto result = intrinsic(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));       \
+      _mm_storeu_ps(out + i, result);                                          \
+    }                                                                          \
+    for (; i < n; i++)                                                         \
+      out[i] = a[i] op b[i];                                                   \
+  }
+
+SIMD_BINARY_KERNEL(Add, _mm_add_ps, +)
+SIMD_BINARY_KERNEL(Sub, _mm_sub_ps, -)
+SIMD_BINARY_KERNEL(Mul, _mm_mul_ps, *)
+SIMD_BINARY_KERNEL(Div, _mm_div_ps, /)
+
+inline void
+TruncateBaseline(const float* in, float* out, size_t n)
+{
+  size_t i = 0;
+
+#if defined(__SSE4_1__)
+  constexpr int mode = _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC;
+
+  for (; (i + 4) <= n; i += 4)
+    _mm_storeu_ps(out + i, _mm_round_ps(_mm_loadu_ps(in + i), mode));
+#endif
+
+  for (; i < n; i++)
+    out[i] = truncf(in[i]);
+}
+
+#elif defined(__ARM_NEON)
+
+#define SIMD_BINARY_KERNEL(name, intrinsic, op)                                \
+  inline void name##Baseline(                                                  \
+    const float* a, const float* b, float* out, size_t n)                      \
+  {                                                                            \
+    size_t i = 0;                                                              \
+    for (; (i + 4) <= n; i += 4)                                               \
+      vst1q_f32(out + i, intrinsic(vld1q_f32(a + i), vld1q_f32(b + i)));       \
+    for (; i < n; i++)                                                         \
+      out[i] = a[i] op b[i];                                                   \
+  }
+
+SIMD_BINARY_KERNEL(Add, vaddq_f32, +)
+SIMD_BINARY_KERNEL(Sub, vsubq_f32, -)
+SIMD_BINARY_KERNEL(Mul, vmulq_f32, *)
+
+#if defined(__aarch64__)
+SIMD_BINARY_KERNEL(Div, vdivq_f32, /)
+#else
+inline void
+DivBaseline(const float* a, const float* b, float* out, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    out[i] = a[i] / b[i];
+}
+#endif
+
+inline void
+TruncateBaseline(const float* in, float* out, size_t n)
+{
+  size_t i = 0;
+
+#if defined(__aarch64__)
+  for (; (i + 4) <= n; i += 4)
+    vst1q_f32(out + i, vrndq_f32(vld1q_f32(in + i)));
+#endif
+
+  for (; i < n; i++)
+    out[i] = truncf(in[i]);
+}
+
+#else
+
+#define SIMD_BINARY_KERNEL(name, intrinsic, op)                                \
+  inline void name##Baseline(                                                  \
+    const float* a, const float* b, float* out, size_t n)                      \
+  {                                                                            \
+    for (size_t i = 0; i < n; i++)                                             \
+      out[i] = a[i] op b[i];                                                   \
+  }
+
+SIMD_BINARY_KERNEL(Add, unused, +)
+SIMD_BINARY_KERNEL(Sub, unused, -)
+SIMD_BINARY_KERNEL(Mul, unused, *)
+SIMD_BINARY_KERNEL(Div, unused, /)
+
+inline void
+TruncateBaseline(const float* in, float* out, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    out[i] = truncf(in[i]);
+}
+
+#endif
+
+#undef SIMD_BINARY_KERNEL
+
+} // namespace detail
+
+#if defined(SIMD_AVX2_DISPATCH)
+
+/// @return True if the processor running the program supports AVX2.
+inline bool
+HasAvx2()
+{
+  static const bool hasAvx2 = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+  }();
+
+  return hasAvx2;
+}
+
+#define SIMD_DISPATCH(name, ...)                                               \
+  if (HasAvx2())                                                               \
+    detail::name##Avx2(__VA_ARGS__);                                           \
+  else                                                                         \
+    detail::name##Baseline(__VA_ARGS__)
+
+#elif defined(SIMD_AVX2)
+
+inline bool
+HasAvx2()
+{
+  return true;
+}
+
+#define SIMD_DISPATCH(name, ...) detail::name##Avx2(__VA_ARGS__)
+
+#else
+
+inline bool
+HasAvx2()
+{
+  return false;
+}
+
+#define SIMD_DISPATCH(name, ...) detail::name##Baseline(__VA_ARGS__)
+
+#endif
+
+#define SIMD_BINARY_KERNEL(name)                                               \
+  inline void name(const float* a, const float* b, float* out, size_t n)       \
+  {                                                                            \
+    SIMD_DISPATCH(name, a, b, out, n);                                         \
+  }
+
+SIMD_BINARY_KERNEL(Add)
+SIMD_BINARY_KERNEL(Sub)
+SIMD_BINARY_KERNEL(Mul)
+SIMD_BINARY_KERNEL(Div)
+
+#undef SIMD_BINARY_KERNEL
+
+inline void
+Truncate(const float* in, float* out, size_t n)
+{
+  SIMD_DISPATCH(Truncate, in, out, n);
+}
+
+#undef SIMD_DISPATCH
+
+#define SIMD_UNARY_KERNEL(name, func)                                          \
+  inline void name(const float* in, float* out, size_t n)                      \
+  {                                                                            \
+    for (size_t i = 0; i < n; i++)                                             \
+      out[i] = func(in[i]);                                                    \
+  }
+
+SIMD_UNARY_KERNEL(Sine, sin)
+SIMD_UNARY_KERNEL(Cosine, cos)
+SIMD_UNARY_KERNEL(Tangent, tan)
+SIMD_UNARY_KERNEL(Arcsine, asin)
+SIMD_UNARY_KERNEL(Arccosine, acos)
+SIMD_UNARY_KERNEL(Arctangent, atan)
+
+#undef SIMD_UNARY_KERNEL
+
+inline void
+Fill(float value, float* out, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    out[i] = value;
+}
+
+} // namespace simd
+
+} // namespace terra
+
+#undef SIMD_AVX2
+#undef SIMD_AVX2_DISPATCH
+#undef SIMD_AVX2_TARGET
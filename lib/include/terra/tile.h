@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <memory>
 
 #include <stddef.h>
 
@@ -12,27 +13,64 @@ TileSize() noexcept
   return 256;
 }
 
-class Tile final
+/// @brief A rectangular part of the image.
+///
+/// @details The channels are stored in separate planes, so that consumers of
+/// the height do not have to read the color as well. The color planes are
+/// optional and only allocated when asked for. Aligned to a cache line, so
+/// that rows of the planes do not share cache lines with other data.
+class alignas(64) Tile final
 {
 public:
-  /// The height and RGB color data, interleaved.
-  using Buffer = std::array<float, TileSize() * TileSize() * 4>;
+  /// The values of a single channel, one row after another.
+  using Plane = std::array<float, TileSize() * TileSize()>;
 
-  Tile(size_t offsetX, size_t offsetY, size_t width, size_t height) noexcept
-    : mOffsetX(offsetX)
-    , mOffsetY(offsetY)
-    , mWidth(width)
-    , mHeight(height)
-  {}
+  /// The red, green and blue planes.
+  struct alignas(64) ColorPlanes final
+  {
+    std::array<Plane, 3> planes;
+  };
+
+  /// @param hasColor Whether to allocate the color planes.
+  Tile(size_t offsetX,
+       size_t offsetY,
+       size_t width,
+       size_t height,
+       bool hasColor = false);
+
+  const float* GetHeightLinePtr(size_t line) const noexcept
+  {
+    return mHeightPlane.data() + (line * mWidth);
+  }
+
+  float* GetHeightLinePtr(size_t line) noexcept
+  {
+    return mHeightPlane.data() + (line * mWidth);
+  }
+
+  /// @return Null if the tile has no color.
+  const float* GetColorLinePtr(size_t channel, size_t line) const noexcept
+  {
+    if (!mColorPlanes)
+      return nullptr;
+
+    return mColorPlanes->planes[channel].data() + (line * mWidth);
+  }
 
-  const float* GetLinePtr(size_t line) const noexcept
+  /// @return Null if the tile has no color.
+  float* GetColorLinePtr(size_t channel, size_t line) noexcept
   {
-    return mBuffer.data() + (line * mWidth * 4);
+    if (!mColorPlanes)
+      return nullptr;
+
+    return mColorPlanes->planes[channel].data() + (line * mWidth);
   }
 
-  const Buffer& GetBuffer() const noexcept { return mBuffer; }
+  const Plane& GetHeightPlane() const noexcept { return mHeightPlane; }
+
+  Plane& GetHeightPlane() noexcept { return mHeightPlane; }
 
-  Buffer& GetBuffer() noexcept { return mBuffer; }
+  bool HasColor() const noexcept { return !!mColorPlanes; }
 
   size_t GetOffsetX() const noexcept { return mOffsetX; }
 
@@ -42,6 +80,13 @@ public:
 
   size_t GetHeight() const noexcept { return mHeight; }
 
+  /// Tiles of level zero have every value computed. At level n, only every
+  /// 2^n-th value along each axis was computed, and the others repeat the
+  /// closest computed value above and to the left of them.
+  size_t GetLevel() const noexcept { return mLevel; }
+
+  void SetLevel(size_t level) noexcept { mLevel = level; }
+
   float GetHeightAt(size_t x, size_t y) const noexcept;
 
   /// @return True on success, false if @p bufferSize is too small or too large.
@@ -51,7 +96,9 @@ public:
   bool ToNormalBuffer(float* buffer, size_t bufferSize) const noexcept;
 
 private:
-  Buffer mBuffer;
+  Plane mHeightPlane;
+
+  std::unique_ptr<ColorPlanes> mColorPlanes;
 
   size_t mOffsetX;
 
@@ -60,6 +107,8 @@ private:
   size_t mWidth;
 
   size_t mHeight;
+
+  size_t mLevel = 0;
 };
 
 } // namespace terra
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory>
+
 namespace terra {
 
 class Tile;
@@ -9,7 +11,12 @@ class TileObserver
 public:
   virtual ~TileObserver() = default;
 
-  virtual void Observe(const Tile&) = 0;
+  /// Called for every completed tile. The tile may be kept after this
+  /// function returns; its memory is recycled once the last reference to it
+  /// is dropped. In progressive frames, each part of the image is observed
+  /// once per level, from the coarsest level to level zero, see
+  /// @ref Tile::GetLevel.
+  virtual void Observe(const std::shared_ptr<const Tile>& tile) = 0;
 };
 
 } // namespace terra
@@ -0,0 +1,498 @@
+#include <terra/bounds.h>
+
+#include <terra/expr_visitor.h>
+
+#include <terra/exprs/binary.h>
+#include <terra/exprs/casts.h>
+#include <terra/exprs/literals.h>
+#include <terra/exprs/unary.h>
+#include <terra/exprs/var_ref.h>
+#include <terra/exprs/vector_combiner.h>
+
+#include <algorithm>
+#include <initializer_list>
+#include <limits>
+#include <unordered_set>
+
+#include <math.h>
+
+namespace terra {
+
+namespace {
+
+/// An interval kept in double precision while it is computed, so that the
+/// rounding of the float operations can be accounted for when converting
+/// back.
+struct Range final
+{
+  double min = 0;
+
+  double max = 0;
+
+  bool mayBeNaN = false;
+};
+
+constexpr double
+Pi() noexcept
+{
+  return 3.14159265358979323846;
+}
+
+auto
+Unbounded(bool mayBeNaN) noexcept -> Interval
+{
+  auto inf = std::numeric_limits<float>::infinity();
+
+  return Interval{ -inf, inf, mayBeNaN };
+}
+
+auto
+ToRange(const Interval& interval) noexcept -> Range
+{
+  return Range{ interval.min, interval.max, interval.mayBeNaN };
+}
+
+/// @brief Rounds a range outward to floats.
+///
+/// @param ulps How many units in the last place the float operation may be
+/// away from the exact result.
+auto
+ToInterval(const Range& range, int ulps) noexcept -> Interval
+{
+  auto inf = std::numeric_limits<float>::infinity();
+
+  auto min = float(range.min);
+  auto max = float(range.max);
+
+  if (double(min) > range.min)
+    min = nextafterf(min, -inf);
+
+  if (double(max) < range.max)
+    max = nextafterf(max, inf);
+
+  for (int i = 0; i < ulps; i++) {
+    min = nextafterf(min, -inf);
+    max = nextafterf(max, inf);
+  }
+
+  return Interval{ min, max, range.mayBeNaN };
+}
+
+bool
+Contains(const Range& range, double value) noexcept
+{
+  return (range.min <= value) && (value <= range.max);
+}
+
+bool
+HasInfinity(const Range& range) noexcept
+{
+  return isinf(range.min) || isinf(range.max);
+}
+
+/// @return The range of the products of the end points. A product of zero
+/// and infinity counts as zero, since it is NaN only if both values occur.
+auto
+ProductRange(const Range& l, const Range& r) noexcept -> Range
+{
+  auto inf = std::numeric_limits<double>::infinity();
+
+  Range result{ inf, -inf, false };
+
+  for (auto a : { l.min, l.max }) {
+    for (auto b : { r.min, r.max }) {
+      auto product = a * b;
+      product = isnan(product) ? 0.0 : product;
+      result.min = std::min(result.min, product);
+      result.max = std::max(result.max, product);
+    }
+  }
+
+  return result;
+}
+
+auto
+Add(const Range& l, const Range& r) noexcept -> Range
+{
+  auto mayBeNaN = l.mayBeNaN || r.mayBeNaN;
+
+  auto inf = std::numeric_limits<double>::infinity();
+
+  // Opposite infinities.
+  if (((l.max == inf) && (r.min == -inf)) ||
+      ((l.min == -inf) && (r.max == inf)))
+    return Range{ -inf, inf, true };
+
+  return Range{ l.min + r.min, l.max + r.max, mayBeNaN };
+}
+
+auto
+Sub(const Range& l, const Range& r) noexcept -> Range
+{
+  return Add(l, Range{ -r.max, -r.min, r.mayBeNaN });
+}
+
+auto
+Mul(const Range& l, const Range& r) noexcept -> Range
+{
+  auto result = ProductRange(l, r);
+
+  result.mayBeNaN = l.mayBeNaN || r.mayBeNaN;
+
+  // Zero times infinity.
+  if ((Contains(l, 0) && HasInfinity(r)) || (Contains(r, 0) && HasInfinity(l)))
+    result.mayBeNaN = true;
+
+  return result;
+}
+
+auto
+Div(const Range& l, const Range& r) noexcept -> Range
+{
+  auto inf = std::numeric_limits<double>::infinity();
+
+  auto mayBeNaN = l.mayBeNaN || r.mayBeNaN;
+
+  // Zero divided by zero.
+  if (Contains(r, 0))
+    return Range{ -inf, inf, mayBeNaN || Contains(l, 0) };
+
+  // Infinity divided by infinity.
+  if (HasInfinity(l) && HasInfinity(r))
+    mayBeNaN = true;
+
+  auto result = ProductRange(l, Range{ 1.0 / r.max, 1.0 / r.min, false });
+
+  result.mayBeNaN = mayBeNaN;
+
+  return result;
+}
+
+/// @brief The range of sine or cosine, given a phase added to the input.
+///
+/// @details The maximum is reached at pi/2 + 2 k pi and the minimum at
+/// -pi/2 + 2 k pi, so the range is that of the end points unless one of
+/// those lies in between.
+auto
+Periodic(const Range& x, double phase, double (*func)(double)) noexcept
+  -> Range
+{
+  auto mayBeNaN = x.mayBeNaN || HasInfinity(x);
+
+  // Beyond this, the argument reduction of the float functions is not
+  // something to reason about here.
+  const double limit = 1.0e6;
+
+  if (((x.max - x.min) >= (2 * Pi())) || (fabs(x.min) > limit) ||
+      (fabs(x.max) > limit))
+    return Range{ -1, 1, mayBeNaN };
+
+  auto min = std::min(func(x.min), func(x.max));
+  auto max = std::max(func(x.min), func(x.max));
+
+  auto a = x.min + phase;
+  auto b = x.max + phase;
+
+  // The first peak at or above a.
+  auto peak = (Pi() / 2) + (2 * Pi()) * ceil((a - (Pi() / 2)) / (2 * Pi()));
+
+  if (peak <= b)
+    max = 1;
+
+  auto trough = (-Pi() / 2) + (2 * Pi()) * ceil((a + (Pi() / 2)) / (2 * Pi()));
+
+  if (trough <= b)
+    min = -1;
+
+  return Range{ min, max, mayBeNaN };
+}
+
+auto
+Tan(const Range& x) noexcept -> Range
+{
+  auto inf = std::numeric_limits<double>::infinity();
+
+  auto mayBeNaN = x.mayBeNaN || HasInfinity(x);
+
+  const double limit = 1.0e6;
+
+  if (((x.max - x.min) >= Pi()) || (fabs(x.min) > limit) ||
+      (fabs(x.max) > limit))
+    return Range{ -inf, inf, mayBeNaN };
+
+  // The first pole at or above the minimum.
+  auto pole = (Pi() / 2) + Pi() * ceil((x.min - (Pi() / 2)) / Pi());
+
+  if (pole <= x.max)
+    return Range{ -inf, inf, mayBeNaN };
+
+  return Range{ tan(x.min), tan(x.max), mayBeNaN };
+}
+
+/// For the inverse functions that are only defined on [-1, 1].
+auto
+Inverse(const Range& x, double (*func)(double), bool decreasing) noexcept
+  -> Range
+{
+  auto mayBeNaN = x.mayBeNaN || (x.min < -1) || (x.max > 1);
+
+  auto min = std::max(x.min, -1.0);
+  auto max = std::min(x.max, 1.0);
+
+  if (min > max)
+    return Range{ 0, 0, true };
+
+  if (decreasing)
+    return Range{ func(max), func(min), mayBeNaN };
+
+  return Range{ func(min), func(max), mayBeNaN };
+}
+
+auto
+Trig(UnaryExpr::ID id, const Range& x) noexcept -> Range
+{
+  switch (id) {
+    case UnaryExpr::ID::Sine:
+      return Periodic(x, 0, sin);
+    case UnaryExpr::ID::Cosine:
+      // cos(x) = sin(x + pi/2)
+      return Periodic(x, Pi() / 2, cos);
+    case UnaryExpr::ID::Tangent:
+      return Tan(x);
+    case UnaryExpr::ID::Arcsine:
+      return Inverse(x, asin, false);
+    case UnaryExpr::ID::Arccosine:
+      return Inverse(x, acos, true);
+    case UnaryExpr::ID::Arctangent:
+      return Range{ atan(x.min), atan(x.max), x.mayBeNaN };
+  }
+
+  return Range{ x.min, x.max, true };
+}
+
+class BoundsVisitor final : public ExprVisitor
+{
+public:
+  BoundsVisitor(std::unordered_map<const Expr*, Interval>& bounds,
+                const Interval& u,
+                const Interval& v)
+    : mBounds(bounds)
+    , mU(u)
+    , mV(v)
+  {}
+
+  /// Shared nodes are only visited once.
+  auto Run(const Expr& expr) -> Interval
+  {
+    auto it = mBounds.find(&expr);
+
+    if (it != mBounds.end())
+      return it->second;
+
+    expr.Accept(*this);
+
+    mBounds.emplace(&expr, mResult);
+
+    return mResult;
+  }
+
+  void Visit(const VarRefExpr& expr) override
+  {
+    switch (expr.GetID()) {
+      case VarRefExpr::ID::CenterU:
+        mResult = mU;
+        break;
+      case VarRefExpr::ID::CenterV:
+        mResult = mV;
+        break;
+    }
+  }
+
+  void Visit(const IntLiteralExpr& expr) override
+  {
+    mIntExprs.emplace(&expr);
+
+    auto value = float(expr.GetValue());
+
+    mResult = Interval{ value, value, false };
+  }
+
+  void Visit(const FloatLiteralExpr& expr) override
+  {
+    auto value = expr.GetValue();
+
+    if (isnan(value))
+      mResult = Unbounded(true);
+    else
+      mResult = Interval{ value, value, false };
+  }
+
+  void Visit(const FloatToIntExpr& expr) override
+  {
+    mIntExprs.emplace(&expr);
+
+    auto source = Run(expr.GetSourceExpr());
+
+    // Converting NaN or values that do not fit into an int is undefined, but
+    // the result is still an int.
+    if (source.mayBeNaN || !FitsInt(source.min) || !FitsInt(source.max)) {
+      mResult = IntRange();
+      return;
+    }
+
+    // Truncation is exact and does not decrease.
+    auto min = truncf(source.min);
+    auto max = truncf(source.max);
+
+    mResult = Interval{ min, max, false };
+  }
+
+  void Visit(const IntToFloatExpr& expr) override
+  {
+    mResult = Run(expr.GetSourceExpr());
+  }
+
+  void Visit(const UnaryExpr& expr) override
+  {
+    auto input = ToRange(Run(expr.GetInputExpr()));
+
+    auto result = ToInterval(Trig(expr.GetID(), input), 2);
+
+    // Rounding outward must not leave the range of the function.
+    switch (expr.GetID()) {
+      case UnaryExpr::ID::Sine:
+      case UnaryExpr::ID::Cosine:
+        result.min = std::max(result.min, -1.0f);
+        result.max = std::min(result.max, 1.0f);
+        break;
+      default:
+        break;
+    }
+
+    mResult = result;
+  }
+
+  void Visit(const BinaryExpr& expr) override
+  {
+    auto l = ToRange(Run(expr.GetLeftExpr()));
+    auto r = ToRange(Run(expr.GetRightExpr()));
+
+    Range result;
+
+    // Add, sub and mul of floats are exact in double, apart from overflow,
+    // so rounding outward to float is enough. Division is rounded twice.
+    int ulps = 0;
+
+    switch (expr.GetID()) {
+      case BinaryExpr::ID::Add:
+        result = Add(l, r);
+        break;
+      case BinaryExpr::ID::Sub:
+        result = Sub(l, r);
+        break;
+      case BinaryExpr::ID::Mul:
+        result = Mul(l, r);
+        break;
+      case BinaryExpr::ID::Div:
+        result = Div(l, r);
+        ulps = 1;
+        break;
+    }
+
+    if (mIntExprs.count(&expr.GetLeftExpr()))
+      mResult = ToIntInterval(expr, result);
+    else
+      mResult = ToInterval(result, ulps);
+  }
+
+  void Visit(const VectorCombiner<2>& expr) override { VisitElements(expr); }
+
+  void Visit(const VectorCombiner<3>& expr) override { VisitElements(expr); }
+
+  void Visit(const VectorCombiner<4>& expr) override { VisitElements(expr); }
+
+private:
+  static bool FitsInt(double value) noexcept
+  {
+    return (value >= std::numeric_limits<int>::min()) &&
+           (value <= std::numeric_limits<int>::max());
+  }
+
+  static auto IntRange() noexcept -> Interval
+  {
+    auto min = float(std::numeric_limits<int>::min());
+    auto max = float(std::numeric_limits<int>::max());
+
+    return Interval{ min, max, false };
+  }
+
+  /// Integer operations are exact, apart from overflow and division, which
+  /// truncates the quotient.
+  auto ToIntInterval(const BinaryExpr& expr, const Range& range) -> Interval
+  {
+    mIntExprs.emplace(&expr);
+
+    // Dividing by zero is undefined.
+    if (range.mayBeNaN || isinf(range.min) || isinf(range.max))
+      return IntRange();
+
+    auto min = range.min;
+    auto max = range.max;
+
+    if (expr.GetID() == BinaryExpr::ID::Div) {
+      min = floor(min);
+      max = ceil(max);
+    }
+
+    if (!FitsInt(min) || !FitsInt(max))
+      return IntRange();
+
+    return ToInterval(Range{ min, max, false }, 0);
+  }
+
+  /// The elements are analyzed, but a vector has no bounds of its own.
+  template<size_t Size>
+  void VisitElements(const VectorCombiner<Size>& expr)
+  {
+    for (size_t i = 0; i < Size; i++)
+      Run(expr.GetElement(i));
+
+    mResult = Unbounded(true);
+  }
+
+private:
+  std::unordered_map<const Expr*, Interval>& mBounds;
+
+  /// The nodes that evaluate to an int.
+  std::unordered_set<const Expr*> mIntExprs;
+
+  Interval mU;
+
+  Interval mV;
+
+  Interval mResult;
+};
+
+} // namespace
+
+BoundsAnalysis::BoundsAnalysis(const Expr& root,
+                               const Interval& u,
+                               const Interval& v)
+{
+  BoundsVisitor visitor(mBounds, u, v);
+
+  visitor.Run(root);
+}
+
+auto
+BoundsAnalysis::GetBounds(const Expr& expr) const -> Interval
+{
+  auto it = mBounds.find(&expr);
+
+  if (it == mBounds.end())
+    return Unbounded(true);
+
+  return it->second;
+}
+
+} // namespace terra
@@ -0,0 +1,127 @@
+#include <terra/dependency.h>
+
+#include <terra/expr_visitor.h>
+
+#include <terra/exprs/binary.h>
+#include <terra/exprs/casts.h>
+#include <terra/exprs/literals.h>
+#include <terra/exprs/unary.h>
+#include <terra/exprs/var_ref.h>
+#include <terra/exprs/vector_combiner.h>
+
+namespace terra {
+
+namespace {
+
+auto
+Combine(Dependency a, Dependency b) noexcept -> Dependency
+{
+  return Dependency(int(a) | int(b));
+}
+
+class DependencyVisitor final : public ExprVisitor
+{
+public:
+  DependencyVisitor(std::unordered_map<const Expr*, Dependency>& dependencies)
+    : mDependencies(dependencies)
+  {}
+
+  /// Shared nodes are only visited once.
+  auto Run(const Expr& expr) -> Dependency
+  {
+    auto it = mDependencies.find(&expr);
+
+    if (it != mDependencies.end())
+      return it->second;
+
+    expr.Accept(*this);
+
+    mDependencies.emplace(&expr, mResult);
+
+    return mResult;
+  }
+
+  void Visit(const VarRefExpr& expr) override
+  {
+    switch (expr.GetID()) {
+      case VarRefExpr::ID::CenterU:
+        mResult = Dependency::U;
+        break;
+      case VarRefExpr::ID::CenterV:
+        mResult = Dependency::V;
+        break;
+    }
+  }
+
+  void Visit(const IntLiteralExpr&) override { mResult = Dependency::None; }
+
+  void Visit(const FloatLiteralExpr&) override { mResult = Dependency::None; }
+
+  void Visit(const FloatToIntExpr& expr) override
+  {
+    mResult = Run(expr.GetSourceExpr());
+  }
+
+  void Visit(const IntToFloatExpr& expr) override
+  {
+    mResult = Run(expr.GetSourceExpr());
+  }
+
+  void Visit(const UnaryExpr& expr) override
+  {
+    mResult = Run(expr.GetInputExpr());
+  }
+
+  void Visit(const BinaryExpr& expr) override
+  {
+    auto l = Run(expr.GetLeftExpr());
+    auto r = Run(expr.GetRightExpr());
+
+    mResult = Combine(l, r);
+  }
+
+  void Visit(const VectorCombiner<2>& expr) override { VisitElements(expr); }
+
+  void Visit(const VectorCombiner<3>& expr) override { VisitElements(expr); }
+
+  void Visit(const VectorCombiner<4>& expr) override { VisitElements(expr); }
+
+private:
+  template<size_t Size>
+  void VisitElements(const VectorCombiner<Size>& expr)
+  {
+    auto result = Dependency::None;
+
+    for (size_t i = 0; i < Size; i++)
+      result = Combine(result, Run(expr.GetElement(i)));
+
+    mResult = result;
+  }
+
+private:
+  std::unordered_map<const Expr*, Dependency>& mDependencies;
+
+  Dependency mResult = Dependency::None;
+};
+
+} // namespace
+
+DependencyAnalysis::DependencyAnalysis(const Expr& root)
+{
+  DependencyVisitor visitor(mDependencies);
+
+  visitor.Run(root);
+}
+
+auto
+DependencyAnalysis::GetDependency(const Expr& expr) const -> Dependency
+{
+  auto it = mDependencies.find(&expr);
+
+  if (it == mDependencies.end())
+    return Dependency::UV;
+
+  return it->second;
+}
+
+} // namespace terra
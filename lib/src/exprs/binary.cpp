@@ -0,0 +1,23 @@
+#include <terra/exprs/binary.h>
+
+namespace terra {
+
+auto
+BinaryExpr::GetType() const noexcept -> std::optional<Type>
+{
+  auto lType = mLeft->GetType();
+
+  auto rType = mRight->GetType();
+
+  if (!lType || !rType)
+    return {};
+
+  if (lType == rType)
+    return *lType;
+
+  // TODO : handle vector and matrix types
+
+  return {};
+}
+
+} // namespace terra
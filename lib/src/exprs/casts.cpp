@@ -0,0 +1,41 @@
+#include <terra/exprs/casts.h>
+
+#include <terra/expr_visitor.h>
+
+namespace terra {
+
+CastExpr::CastExpr(std::unique_ptr<Expr>&& sourceExpr)
+  : mSourceExpr(std::move(sourceExpr))
+{}
+
+auto
+CastExpr::GetSourceExpr() const noexcept -> const Expr&
+{
+  return *mSourceExpr;
+}
+
+void
+IntToFloatExpr::Accept(ExprVisitor& visitor) const
+{
+  visitor.Visit(*this);
+}
+
+auto
+IntToFloatExpr::GetType() const noexcept -> std::optional<Type>
+{
+  return Type::Float;
+}
+
+void
+FloatToIntExpr::Accept(ExprVisitor& visitor) const
+{
+  visitor.Visit(*this);
+}
+
+auto
+FloatToIntExpr::GetType() const noexcept -> std::optional<Type>
+{
+  return Type::Int;
+}
+
+} // namespace terra
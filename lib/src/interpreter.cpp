@@ -1,20 +1,40 @@
 #include <terra/interpreter.h>
 
+#include <terra/bounds.h>
+#include <terra/cancellation_token.h>
+#include <terra/dependency.h>
 #include <terra/expr_visitor.h>
 #include <terra/line_observer.h>
+#include <terra/optimizer.h>
 #include <terra/tile.h>
 #include <terra/tile_observer.h>
 
+#include <terra/exprs/binary.h>
 #include <terra/exprs/literals.h>
+#include <terra/exprs/unary.h>
 #include <terra/exprs/var_ref.h>
 #include <terra/exprs/vector_combiner.h>
 
+#include <thread_pool.hpp>
+
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
 #include <type_traits>
 #include <vector>
 
 #include <Eigen/Dense>
 
+#include <terra/simd.h>
+
+#include "mpsc_queue.h"
+#include "shared_thread_pool.h"
+#include "tile_pool.h"
+
 namespace terra {
 
 namespace {
@@ -37,6 +57,47 @@ namespace impl {
 template<typename Scalar, size_t Size>
 using Vector = Eigen::Matrix<Scalar, Size, 1>;
 
+/// The number of elements evaluated at a time by the batch kernels.
+/// Intermediate results of this size are kept on the stack.
+constexpr size_t
+BatchSize() noexcept
+{
+  return 64;
+}
+
+/// The inputs for evaluating several points at once.
+struct Batch final
+{
+  const float* u = nullptr;
+
+  const float* v = nullptr;
+
+  /// The values of the subexpressions that only depend on u, for every point.
+  /// The values of each subexpression are @ref Batch::columnStride apart. May
+  /// be null, in which case the subexpressions are evaluated.
+  const float* columns = nullptr;
+
+  size_t columnStride = 0;
+
+  /// The values of the subexpressions that only depend on v, which are the
+  /// same for every point. May be null.
+  const float* rowValues = nullptr;
+
+  /// @return The batch starting @p offset points later.
+  auto Offset(size_t offset) const noexcept -> Batch
+  {
+    Batch batch = *this;
+
+    batch.u += offset;
+    batch.v += offset;
+
+    if (batch.columns)
+      batch.columns += offset;
+
+    return batch;
+  }
+};
+
 template<typename Type>
 class Expr
 {
@@ -44,6 +105,21 @@ public:
   virtual ~Expr() = default;
 
   virtual Type Eval(const BuiltinVars&) const noexcept = 0;
+
+  /// Evaluates @p n points at once. Expressions that have a vectorized
+  /// implementation override this, the rest are evaluated point by point.
+  virtual void EvalBatch(const Batch& batch, Type* out, size_t n) const
+    noexcept
+  {
+    for (size_t i = 0; i < n; i++) {
+
+      BuiltinVars builtinVars;
+      builtinVars.uCenter = batch.u[i];
+      builtinVars.vCenter = batch.v[i];
+
+      out[i] = Eval(builtinVars);
+    }
+  }
 };
 
 template<typename Scalar, size_t Size>
@@ -56,6 +132,12 @@ public:
   {
     return builtinVars.uCenter;
   }
+
+  void EvalBatch(const Batch& batch, float* out, size_t n) const
+    noexcept override
+  {
+    std::copy(batch.u, batch.u + n, out);
+  }
 };
 
 class VCenterExpr final : public Expr<float>
@@ -65,6 +147,12 @@ public:
   {
     return builtinVars.vCenter;
   }
+
+  void EvalBatch(const Batch& batch, float* out, size_t n) const
+    noexcept override
+  {
+    std::copy(batch.v, batch.v + n, out);
+  }
 };
 
 template<typename Scalar, size_t Size>
@@ -86,6 +174,26 @@ public:
     return result;
   }
 
+  void EvalBatch(const Batch& batch,
+                 Vector<Scalar, Size>* out,
+                 size_t n) const noexcept override
+  {
+    Scalar element[BatchSize()];
+
+    for (size_t offset = 0; offset < n; offset += BatchSize()) {
+
+      auto count = std::min(n - offset, BatchSize());
+
+      for (size_t i = 0; i < Size; i++) {
+
+        mElements[i]->EvalBatch(batch.Offset(offset), element, count);
+
+        for (size_t j = 0; j < count; j++)
+          out[offset + j](i) = element[j];
+      }
+    }
+  }
+
 private:
   std::array<std::unique_ptr<Expr<Scalar>>, Size> mElements;
 };
@@ -100,21 +208,268 @@ public:
 
   Scalar Eval(const BuiltinVars&) const noexcept override { return mValue; }
 
+  void EvalBatch(const Batch&, Scalar* out, size_t n) const noexcept override
+  {
+    std::fill(out, out + n, mValue);
+  }
+
 private:
   Scalar mValue;
 };
 
+class UnaryExpr final : public Expr<float>
+{
+public:
+  UnaryExpr(terra::UnaryExpr::ID id, std::unique_ptr<Expr<float>> input)
+    : mID(id)
+    , mInput(std::move(input))
+  {}
+
+  float Eval(const BuiltinVars& builtinVars) const noexcept override
+  {
+    float x = mInput->Eval(builtinVars);
+
+    float result = 0;
+
+    Apply(&x, &result, 1);
+
+    return result;
+  }
+
+  void EvalBatch(const Batch& batch, float* out, size_t n) const
+    noexcept override
+  {
+    mInput->EvalBatch(batch, out, n);
+
+    Apply(out, out, n);
+  }
+
+private:
+  void Apply(const float* in, float* out, size_t n) const noexcept
+  {
+    switch (mID) {
+      case terra::UnaryExpr::ID::Sine:
+        simd::Sine(in, out, n);
+        break;
+      case terra::UnaryExpr::ID::Cosine:
+        simd::Cosine(in, out, n);
+        break;
+      case terra::UnaryExpr::ID::Tangent:
+        simd::Tangent(in, out, n);
+        break;
+      case terra::UnaryExpr::ID::Arcsine:
+        simd::Arcsine(in, out, n);
+        break;
+      case terra::UnaryExpr::ID::Arccosine:
+        simd::Arccosine(in, out, n);
+        break;
+      case terra::UnaryExpr::ID::Arctangent:
+        simd::Arctangent(in, out, n);
+        break;
+    }
+  }
+
+  terra::UnaryExpr::ID mID;
+
+  std::unique_ptr<Expr<float>> mInput;
+};
+
+class BinaryExpr final : public Expr<float>
+{
+public:
+  BinaryExpr(terra::BinaryExpr::ID id,
+             std::unique_ptr<Expr<float>> left,
+             std::unique_ptr<Expr<float>> right)
+    : mID(id)
+    , mLeft(std::move(left))
+    , mRight(std::move(right))
+  {}
+
+  float Eval(const BuiltinVars& builtinVars) const noexcept override
+  {
+    float l = mLeft->Eval(builtinVars);
+    float r = mRight->Eval(builtinVars);
+
+    float result = 0;
+
+    Apply(&l, &r, &result, 1);
+
+    return result;
+  }
+
+  void EvalBatch(const Batch& batch, float* out, size_t n) const
+    noexcept override
+  {
+    float right[BatchSize()];
+
+    for (size_t offset = 0; offset < n; offset += BatchSize()) {
+
+      auto count = std::min(n - offset, BatchSize());
+
+      mLeft->EvalBatch(batch.Offset(offset), out + offset, count);
+
+      mRight->EvalBatch(batch.Offset(offset), right, count);
+
+      Apply(out + offset, right, out + offset, count);
+    }
+  }
+
+private:
+  void Apply(const float* l, const float* r, float* out, size_t n) const
+    noexcept
+  {
+    switch (mID) {
+      case terra::BinaryExpr::ID::Add:
+        simd::Add(l, r, out, n);
+        break;
+      case terra::BinaryExpr::ID::Sub:
+        simd::Sub(l, r, out, n);
+        break;
+      case terra::BinaryExpr::ID::Mul:
+        simd::Mul(l, r, out, n);
+        break;
+      case terra::BinaryExpr::ID::Div:
+        simd::Div(l, r, out, n);
+        break;
+    }
+  }
+
+  terra::BinaryExpr::ID mID;
+
+  std::unique_ptr<Expr<float>> mLeft;
+
+  std::unique_ptr<Expr<float>> mRight;
+};
+
+/// A subexpression that only depends on u or only on v. Its values are looked
+/// up in the batch when they are available.
+class InvariantExpr final : public Expr<float>
+{
+public:
+  InvariantExpr(Dependency dependency,
+                size_t index,
+                std::unique_ptr<Expr<float>> expr)
+    : mDependency(dependency)
+    , mIndex(index)
+    , mExpr(std::move(expr))
+  {}
+
+  float Eval(const BuiltinVars& builtinVars) const noexcept override
+  {
+    return mExpr->Eval(builtinVars);
+  }
+
+  void EvalBatch(const Batch& batch, float* out, size_t n) const
+    noexcept override
+  {
+    if ((mDependency == Dependency::U) && batch.columns) {
+      const auto* column = batch.columns + (mIndex * batch.columnStride);
+      std::copy(column, column + n, out);
+    } else if ((mDependency == Dependency::V) && batch.rowValues) {
+      std::fill(out, out + n, batch.rowValues[mIndex]);
+    } else {
+      mExpr->EvalBatch(batch, out, n);
+    }
+  }
+
+private:
+  Dependency mDependency;
+
+  size_t mIndex;
+
+  std::unique_ptr<Expr<float>> mExpr;
+};
+
+/// The subexpressions that only depend on u, evaluated once per column, and
+/// the ones that only depend on v, evaluated once per row.
+class Invariants final
+{
+public:
+  /// @return An expression that looks up the value of @p expr.
+  auto Add(Dependency dependency, std::unique_ptr<Expr<float>> expr)
+    -> std::unique_ptr<Expr<float>>
+  {
+    auto& exprs = (dependency == Dependency::U) ? mColumnExprs : mRowExprs;
+
+    exprs.emplace_back(expr.get());
+
+    auto index = exprs.size() - 1;
+
+    using Ret = std::unique_ptr<Expr<float>>;
+
+    return Ret(new InvariantExpr(dependency, index, std::move(expr)));
+  }
+
+  /// @return The values of the column expressions for @p n columns, in the
+  /// layout expected by @ref Batch::columns.
+  auto EvalColumns(const float* u, size_t n) const -> std::vector<float>
+  {
+    std::vector<float> columns(mColumnExprs.size() * n);
+
+    Batch batch;
+    batch.u = u;
+    // Not read by the column expressions.
+    batch.v = u;
+
+    for (size_t i = 0; i < mColumnExprs.size(); i++)
+      mColumnExprs[i]->EvalBatch(batch, &columns[i * n], n);
+
+    return columns;
+  }
+
+  auto EvalRow(float v) const -> std::vector<float>
+  {
+    std::vector<float> rowValues(mRowExprs.size());
+
+    Batch batch;
+    batch.u = &v;
+    batch.v = &v;
+
+    for (size_t i = 0; i < mRowExprs.size(); i++)
+      mRowExprs[i]->EvalBatch(batch, &rowValues[i], 1);
+
+    return rowValues;
+  }
+
+private:
+  /// Owned by the invariant expressions that refer to them.
+  std::vector<const Expr<float>*> mColumnExprs;
+
+  std::vector<const Expr<float>*> mRowExprs;
+};
+
 } // namespace impl
 
 template<typename Type>
 class ExprBuilder final : public ExprVisitor
 {
 public:
+  ExprBuilder() = default;
+
+  /// Subexpressions that only depend on one of the coordinates are added to
+  /// @p invariants, using the dependencies found by @p analysis.
+  ExprBuilder(const DependencyAnalysis& analysis, impl::Invariants& invariants)
+    : mAnalysis(&analysis)
+    , mInvariants(&invariants)
+  {}
+
   auto TakeExpr() -> std::unique_ptr<impl::Expr<Type>>
   {
     return std::move(mExpr);
   }
 
+  auto Build(const terra::Expr& expr) -> std::unique_ptr<impl::Expr<Type>>
+  {
+    if constexpr (std::is_same<Type, float>::value) {
+      if (auto invariantExpr = BuildInvariant(expr))
+        return invariantExpr;
+    }
+
+    expr.Accept(*this);
+
+    return TakeExpr();
+  }
+
   void Visit(const VarRefExpr& varRef) override
   {
     switch (varRef.GetID()) {
@@ -145,9 +500,32 @@ public:
 
   void Visit(const IntToFloatExpr&) override {}
 
-  void Visit(const UnaryExpr&) override {}
+  void Visit(const UnaryExpr& unary) override
+  {
+    if constexpr (std::is_same<Type, float>::value) {
+
+      auto input = BuildSubExpr(unary.GetInputExpr());
+
+      if (input)
+        mExpr.reset(new impl::UnaryExpr(unary.GetID(), std::move(input)));
+    }
+  }
+
+  void Visit(const BinaryExpr& binary) override
+  {
+    if constexpr (std::is_same<Type, float>::value) {
 
-  void Visit(const BinaryExpr&) override {}
+      auto left = BuildSubExpr(binary.GetLeftExpr());
+      auto right = BuildSubExpr(binary.GetRightExpr());
+
+      if (!left || !right)
+        return;
+
+      auto id = binary.GetID();
+
+      mExpr.reset(new impl::BinaryExpr(id, std::move(left), std::move(right)));
+    }
+  }
 
   void Visit(const VectorCombiner<2>& vecCombiner) override
   {
@@ -168,6 +546,40 @@ public:
   }
 
 private:
+  auto BuildSubExpr(const terra::Expr& expr)
+    -> std::unique_ptr<impl::Expr<float>>
+  {
+    if (!mInvariants)
+      return ExprBuilder<float>().Build(expr);
+
+    return ExprBuilder<float>(*mAnalysis, *mInvariants).Build(expr);
+  }
+
+  /// Only unary and binary expressions are worth computing ahead of time,
+  /// the others are as cheap to evaluate as to look up.
+  auto BuildInvariant(const terra::Expr& expr)
+    -> std::unique_ptr<impl::Expr<float>>
+  {
+    if (!mInvariants)
+      return nullptr;
+
+    auto dependency = mAnalysis->GetDependency(expr);
+
+    if ((dependency != Dependency::U) && (dependency != Dependency::V))
+      return nullptr;
+
+    if (!dynamic_cast<const UnaryExpr*>(&expr) &&
+        !dynamic_cast<const BinaryExpr*>(&expr))
+      return nullptr;
+
+    auto invariantExpr = ExprBuilder<float>().Build(expr);
+
+    if (!invariantExpr)
+      return nullptr;
+
+    return mInvariants->Add(dependency, std::move(invariantExpr));
+  }
+
   template<size_t Size>
   void HandleVectorCombiner(const VectorCombiner<Size>& vecCombiner)
   {
@@ -175,59 +587,265 @@ private:
 
     for (size_t i = 0; i < Size; i++) {
 
-      ExprBuilder<float> elementBuilder;
-
-      vecCombiner.GetElement(i).Accept(elementBuilder);
-
-      elements[i] = elementBuilder.TakeExpr();
+      elements[i] = BuildSubExpr(vecCombiner.GetElement(i));
     }
 
     mExpr.reset(new impl::VectorCombinerExpr<float, Size>(std::move(elements)));
   }
 
 private:
+  const DependencyAnalysis* mAnalysis = nullptr;
+
+  impl::Invariants* mInvariants = nullptr;
+
   std::unique_ptr<impl::Expr<Type>> mExpr;
 };
 
+/// An expression along with its subexpressions that only depend on one of
+/// the coordinates, so that a grid of points can be evaluated row by row with
+/// those computed once per column and once per row.
+template<typename Type>
+class Program final
+{
+public:
+  /// @return Null if the expression is not valid.
+  static auto Build(const terra::Expr& expr) -> std::unique_ptr<Program>
+  {
+    auto simplifiedExpr = Simplify(expr);
+
+    std::unique_ptr<Program> program(new Program());
+
+    DependencyAnalysis analysis(*simplifiedExpr);
+
+    ExprBuilder<Type> builder(analysis, program->mInvariants);
+
+    program->mExpr = builder.Build(*simplifiedExpr);
+
+    if (!program->mExpr)
+      return nullptr;
+
+    program->mSimplifiedExpr = std::move(simplifiedExpr);
+
+    return program;
+  }
+
+  /// @return Conservative bounds of the values over a rectangle of
+  /// coordinates, see @ref BoundsAnalysis.
+  auto EvalBounds(const Interval& u, const Interval& v) const -> Interval
+  {
+    return BoundsAnalysis(*mSimplifiedExpr, u, v).GetBounds(*mSimplifiedExpr);
+  }
+
+  /// @return The values to pass to @ref Program::EvalRow for the @p n
+  /// columns at @p u.
+  auto EvalColumns(const float* u, size_t n) const -> std::vector<float>
+  {
+    return mInvariants.EvalColumns(u, n);
+  }
+
+  /// Evaluates @p n points that share the same v coordinate.
+  void EvalRow(const float* u,
+               float v,
+               const std::vector<float>& columns,
+               Type* out,
+               size_t n) const noexcept
+  {
+    auto rowValues = mInvariants.EvalRow(v);
+
+    float vBatch[impl::BatchSize()];
+
+    std::fill(vBatch, vBatch + impl::BatchSize(), v);
+
+    impl::Batch batch;
+    batch.u = u;
+    batch.columns = columns.data();
+    batch.columnStride = n;
+    batch.rowValues = rowValues.data();
+
+    for (size_t offset = 0; offset < n; offset += impl::BatchSize()) {
+
+      auto count = std::min(n - offset, impl::BatchSize());
+
+      auto subBatch = batch.Offset(offset);
+
+      subBatch.v = vBatch;
+
+      mExpr->EvalBatch(subBatch, out + offset, count);
+    }
+  }
+
+private:
+  Program() = default;
+
+  impl::Invariants mInvariants;
+
+  std::unique_ptr<impl::Expr<Type>> mExpr;
+
+  /// The expression that @ref Program::mExpr was built from, kept for
+  /// @ref Program::EvalBounds.
+  std::unique_ptr<terra::Expr> mSimplifiedExpr;
+};
+
+/// The number of passes of a progressive frame, one per tile level.
+constexpr size_t
+ProgressivePassCount() noexcept
+{
+  return 3;
+}
+
 struct FrameStatus final
 {
-  FrameStatus(size_t tilesPerRow, size_t tilesPerCol, size_t w, size_t h)
-    : tileCount(tilesPerRow * tilesPerCol)
-    , tileIndex(0)
+  FrameStatus(size_t tilesPerRow,
+              size_t tilesPerCol,
+              size_t passCount,
+              size_t w,
+              size_t h,
+              size_t maxTilesInFlight,
+              std::shared_ptr<TilePool> tilePool,
+              std::shared_ptr<const CancellationToken> token)
+    : tilesPerRow(tilesPerRow)
+    , tilesPerPass(tilesPerRow * tilesPerCol)
+    , passCount(passCount)
+    , tileCount(tilesPerPass * passCount)
+    , maxTilesInFlight(maxTilesInFlight)
     , resX(w)
     , resY(h)
-  {}
+    , token(std::move(token))
+    , tilePool(std::move(tilePool))
+    , completedTiles(maxTilesInFlight)
+  {
+    if (passCount > 1) {
+      levelSamples.resize(tilesPerPass);
+      auto handoffCount = tilesPerPass * (passCount - 1);
+      handoffs = std::vector<std::atomic<size_t>>(handoffCount);
+    }
+  }
+
+  size_t tilesPerRow = 0;
 
+  size_t tilesPerPass = 0;
+
+  size_t passCount = 1;
+
+  /// The number of tiles of all passes.
   size_t tileCount = 0;
 
-  size_t tileIndex = 0;
+  /// The number of tiles that have been submitted to the thread pool.
+  size_t tilesStarted = 0;
+
+  /// The number of tiles that have been passed to the tile observers.
+  size_t tilesObserved = 0;
+
+  /// The number of tiles that may be started but not observed or skipped
+  /// yet, which is also the capacity of the queue. Since no more tiles are
+  /// rendered than fit into the queue, the workers never wait for room.
+  size_t maxTilesInFlight = 0;
 
   size_t resX = 0;
 
   size_t resY = 0;
 
-  size_t GetNextXOffset() const noexcept
+  /// Set when the frame is ended early, so that queued tiles are skipped.
+  std::atomic<bool> cancelled{ false };
+
+  /// Tiles are skipped as well once this is cancelled, but the frame goes on
+  /// until the rendered tiles are polled.
+  std::shared_ptr<const CancellationToken> token;
+
+  /// The number of tiles that were skipped because of the token.
+  std::atomic<size_t> tilesSkipped{ 0 };
+
+  /// Set while @ref TileInterpreter::PollTiles is waiting for a tile, so that
+  /// the worker threads only lock the mutex when it has to be woken up.
+  std::atomic<bool> pollerWaiting{ false };
+
+  std::mutex pollerMutex;
+
+  std::condition_variable tileCompleted;
+
+  std::shared_ptr<TilePool> tilePool;
+
+  /// Written by the worker threads, read by the thread polling for tiles.
+  MpscQueue<std::shared_ptr<Tile>> completedTiles;
+
+  std::vector<std::future<void>> tileTasks;
+
+  /// For progressive frames, the values computed by the last pass rendered
+  /// for each part of the image, which the next pass reuses. Only the values
+  /// are kept, so that tiles return to the pool once they are observed.
+  std::vector<std::vector<float>> levelSamples;
+
+  /// For progressive frames, one counter per part of the image and pass
+  /// after the first, see @ref FrameStatus::HandOff.
+  std::vector<std::atomic<size_t>> handoffs;
+
+  size_t TilesRemaining() const noexcept
+  {
+    return tileCount - tilesObserved - tilesSkipped;
+  }
+
+  /// Called by the polling thread.
+  bool CanStartTile() const noexcept
+  {
+    auto tilesInFlight = tilesStarted - tilesObserved - tilesSkipped;
+
+    return (tilesStarted < tileCount) && (tilesInFlight < maxTilesInFlight);
+  }
+
+  /// @brief Called both when a pass of a part of the image is done and when
+  /// the task of the next pass of that part starts, in any order.
+  ///
+  /// @return True for the second of the two calls, which renders the next
+  /// pass. A task that starts before the previous pass is done returns
+  /// instead of waiting, and the thread that finishes the previous pass
+  /// continues with it.
+  bool HandOff(size_t tileIndex, size_t nextPass) noexcept
+  {
+    auto& handoff = handoffs[((nextPass - 1) * tilesPerPass) + tileIndex];
+
+    return handoff.fetch_add(1, std::memory_order_acq_rel) == 1;
+  }
+
+  bool TokenIsCancelled() const noexcept
+  {
+    return token && token->IsCancelled();
+  }
+
+  /// Called by a worker thread after a tile was either queued or skipped.
+  void WakePoller()
   {
-    return (tileIndex * TileSize()) % resX;
+    // Pairs with the fence in PollTiles, so that either the poller sees the
+    // change or this thread sees that the poller is waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (pollerWaiting) {
+      std::lock_guard<std::mutex> lock(pollerMutex);
+      tileCompleted.notify_one();
+    }
   }
 
-  size_t GetNextYOffset() const noexcept
+  size_t GetXOffset(size_t tileIndex) const noexcept
   {
-    return ((tileIndex * TileSize()) / resX) * TileSize();
+    return (tileIndex % tilesPerRow) * TileSize();
   }
 
-  size_t GetNextWidth() const noexcept
+  size_t GetYOffset(size_t tileIndex) const noexcept
   {
-    auto offset = GetNextXOffset();
+    return (tileIndex / tilesPerRow) * TileSize();
+  }
+
+  size_t GetWidth(size_t tileIndex) const noexcept
+  {
+    auto offset = GetXOffset(tileIndex);
 
     auto end = offset + TileSize();
 
     return std::min(end, resX) - offset;
   }
 
-  size_t GetNextHeight() const noexcept
+  size_t GetHeight(size_t tileIndex) const noexcept
   {
-    auto offset = GetNextYOffset();
+    auto offset = GetYOffset(tileIndex);
 
     auto end = offset + TileSize();
 
@@ -238,42 +856,201 @@ struct FrameStatus final
 class RenderTask final
 {
 public:
-  RenderTask(Tile& tile, const impl::Expr<float>& heightExpr)
+  /// @param coarser The values computed for the same part of the image at
+  /// the level above the one of @p tile, which are reused. Null if there is
+  /// none. See @ref RenderTask::GetSampleIndex for the layout.
+  ///
+  /// @param samples If not null, receives the values computed at the level
+  /// of @p tile, for the next pass to reuse.
+  RenderTask(Tile& tile,
+             const Program<float>& heightProgram,
+             size_t resX,
+             size_t resY,
+             const std::vector<float>* coarser = nullptr,
+             std::vector<float>* samples = nullptr)
     : mTile(tile)
-    , mHeightExpr(heightExpr)
+    , mHeightProgram(heightProgram)
+    , mResX(resX)
+    , mResY(resY)
+    , mCoarser(coarser)
+    , mSamples(samples)
   {}
 
   void operator()() noexcept
   {
-    auto& buffer = mTile.GetBuffer();
+    auto w = mTile.GetWidth();
+    auto h = mTile.GetHeight();
 
-    for (size_t i = 0; i < (TileSize() * TileSize()); i++) {
+    float uRow[TileSize()];
 
-      size_t x = i % TileSize();
-      size_t y = i / TileSize();
+    for (size_t x = 0; x < w; x++)
+      uRow[x] = (mTile.GetOffsetX() + x + 0.5f) / mResX;
 
-      BuiltinVars builtinVars;
-      builtinVars.uCenter = (x + 0.5f) / TileSize();
-      builtinVars.vCenter = (y + 0.5f) / TileSize();
+    // The coordinates grow with the index, so the end points bound them.
+    Interval u{ uRow[0], uRow[w - 1], false };
+
+    Interval v{ VCoord(0), VCoord(h - 1), false };
+
+    if (mHeightProgram.EvalBounds(u, v).IsConstant()) {
+      FillConstant(uRow, VCoord(0));
+      return;
+    }
+
+    if ((mTile.GetLevel() > 0) || mCoarser) {
+      RenderLevel(uRow);
+      return;
+    }
 
-      auto h = mHeightExpr.Eval(builtinVars);
+    auto columns = mHeightProgram.EvalColumns(uRow, w);
 
-      buffer[(i * 4) + 0] = h;
-      buffer[(i * 4) + 1] = 0;
-      buffer[(i * 4) + 2] = 0;
-      buffer[(i * 4) + 3] = 0;
+    for (size_t y = 0; y < h; y++) {
+      auto* line = mTile.GetHeightLinePtr(y);
+      mHeightProgram.EvalRow(uRow, VCoord(y), columns, line, w);
     }
   }
 
+private:
+  float VCoord(size_t y) const noexcept
+  {
+    return (mTile.GetOffsetY() + y + 0.5f) / mResY;
+  }
+
+  /// @return The index of the value computed at (@p x, @p y) among the ones
+  /// of a level, which are stored row by row.
+  auto GetSampleIndex(size_t x, size_t y, size_t level) const noexcept
+    -> size_t
+  {
+    auto step = size_t(1) << level;
+
+    auto samplesPerRow = (mTile.GetWidth() + step - 1) / step;
+
+    return ((y / step) * samplesPerRow) + (x / step);
+  }
+
+  auto GetSampleCount(size_t level) const noexcept -> size_t
+  {
+    auto step = size_t(1) << level;
+
+    auto rowCount = (mTile.GetHeight() + step - 1) / step;
+
+    return GetSampleIndex(0, rowCount * step, level);
+  }
+
+  /// Computes the values of the tile's level that the coarser level does not
+  /// have, and repeats each of them over the values skipped at this level.
+  void RenderLevel(const float* uRow) noexcept
+  {
+    auto w = mTile.GetWidth();
+    auto h = mTile.GetHeight();
+
+    auto step = size_t(1) << mTile.GetLevel();
+
+    // The columns of the level, and the ones the coarser level lacks.
+    float uLevel[TileSize()];
+    float uNew[TileSize()];
+
+    size_t levelCount = 0;
+    size_t newCount = 0;
+
+    for (size_t x = 0; x < w; x += step) {
+
+      uLevel[levelCount++] = uRow[x];
+
+      if ((x / step) % 2)
+        uNew[newCount++] = uRow[x];
+    }
+
+    auto levelColumns = mHeightProgram.EvalColumns(uLevel, levelCount);
+
+    auto newColumns = mHeightProgram.EvalColumns(uNew, newCount);
+
+    float values[TileSize()];
+
+    if (mSamples)
+      mSamples->resize(GetSampleCount(mTile.GetLevel()));
+
+    for (size_t y = 0; y < h; y += step) {
+
+      auto* line = mTile.GetHeightLinePtr(y);
+
+      if (mCoarser && !((y / step) % 2)) {
+
+        mHeightProgram.EvalRow(uNew, VCoord(y), newColumns, values, newCount);
+
+        for (size_t i = 0; i < newCount; i++)
+          line[((i * 2) + 1) * step] = values[i];
+
+        auto coarserLevel = mTile.GetLevel() + 1;
+
+        for (size_t x = 0; x < w; x += step * 2)
+          line[x] = (*mCoarser)[GetSampleIndex(x, y, coarserLevel)];
+
+      } else {
+
+        mHeightProgram.EvalRow(
+          uLevel, VCoord(y), levelColumns, values, levelCount);
+
+        for (size_t i = 0; i < levelCount; i++)
+          line[i * step] = values[i];
+      }
+
+      for (size_t x = 0; mSamples && (x < w); x += step)
+        (*mSamples)[GetSampleIndex(x, y, mTile.GetLevel())] = line[x];
+
+      for (size_t x = 0; (step > 1) && (x < w); x += step)
+        std::fill(line + x + 1, line + std::min(x + step, w), line[x]);
+    }
+
+    for (size_t y = 0; (step > 1) && (y < h); y++) {
+
+      if (!(y % step))
+        continue;
+
+      const auto* src = mTile.GetHeightLinePtr(y - (y % step));
+
+      std::copy(src, src + w, mTile.GetHeightLinePtr(y));
+    }
+  }
+
+  /// Fills a tile that is known to be flat, such as a plateau, evaluating
+  /// only its first point. The value is evaluated rather than taken from the
+  /// bounds, so that the sign of a zero matches the other tiles.
+  void FillConstant(const float* uRow, float v) noexcept
+  {
+    auto columns = mHeightProgram.EvalColumns(uRow, 1);
+
+    float value = 0;
+
+    mHeightProgram.EvalRow(uRow, v, columns, &value, 1);
+
+    for (size_t y = 0; y < mTile.GetHeight(); y++) {
+      auto* line = mTile.GetHeightLinePtr(y);
+      std::fill(line, line + mTile.GetWidth(), value);
+    }
+
+    if (mSamples)
+      mSamples->assign(GetSampleCount(mTile.GetLevel()), value);
+  }
+
 private:
   Tile& mTile;
 
-  const impl::Expr<float>& mHeightExpr;
+  const Program<float>& mHeightProgram;
+
+  size_t mResX;
+
+  size_t mResY;
+
+  const std::vector<float>* mCoarser;
+
+  std::vector<float>* mSamples;
 };
 
 class TileInterpreterImpl final : public TileInterpreter
 {
 public:
+  ~TileInterpreterImpl() { EndFrame(); }
+
   void AddTileObserver(std::shared_ptr<TileObserver> observer) override
   {
     mTileObservers.emplace_back(std::move(observer));
@@ -283,45 +1060,79 @@ public:
 
   size_t TilesRemaining() const noexcept override
   {
-    if (!mFrameStatus)
-      return 0;
+    return mFrameStatus ? mFrameStatus->TilesRemaining() : 0;
+  }
 
-    return mFrameStatus->tileCount - mFrameStatus->tileIndex;
+  size_t TilesSkipped() const noexcept override
+  {
+    return mFrameStatus ? mFrameStatus->tilesSkipped.load() : 0;
   }
 
-  bool BeginFrame() override
+  bool BeginFrame(std::shared_ptr<const CancellationToken> token) override
   {
-    if (mFrameStatus)
+    if (mFrameStatus || !mHeightProgram)
       return false;
 
     size_t tilesPerRow = (mResX + (TileSize() - 1)) / TileSize();
 
     size_t tilesPerCol = (mResY + (TileSize() - 1)) / TileSize();
 
-    mFrameStatus.reset(new FrameStatus(tilesPerRow, tilesPerCol, mResX, mResY));
+    auto passCount = mProgressive ? ProgressivePassCount() : 1;
+
+    mFrameStatus.reset(new FrameStatus(tilesPerRow,
+                                       tilesPerCol,
+                                       passCount,
+                                       mResX,
+                                       mResY,
+                                       MaxTilesInFlight(),
+                                       mTilePool,
+                                       std::move(token)));
+
+    StartTiles();
 
     return true;
   }
 
-  bool PollTiles(size_t) override
+  bool PollTiles(size_t timeout) override
   {
-    if (!mFrameStatus || !mHeightExpr)
+    if (!mFrameStatus)
       return false;
 
-    auto x = mFrameStatus->GetNextXOffset();
-    auto y = mFrameStatus->GetNextYOffset();
-    auto w = mFrameStatus->GetNextWidth();
-    auto h = mFrameStatus->GetNextHeight();
+    auto* frame = mFrameStatus.get();
+
+    StartTiles();
+
+    if ((TilesRemaining() > 0) && frame->completedTiles.Empty()) {
+
+      std::unique_lock<std::mutex> lock(frame->pollerMutex);
+
+      frame->pollerWaiting = true;
 
-    Tile tile(x, y, w, h);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
 
-    RenderTask renderTask(tile, *mHeightExpr);
+      // Skipped tiles make room for more tiles to start.
+      auto hasTiles = [frame]() {
+        return !frame->completedTiles.Empty() || !frame->TilesRemaining() ||
+               frame->CanStartTile();
+      };
 
-    renderTask();
+      auto duration = std::chrono::milliseconds(timeout);
 
-    NotifyTileObservers(tile);
+      frame->tileCompleted.wait_for(lock, duration, hasTiles);
 
-    mFrameStatus->tileIndex++;
+      frame->pollerWaiting = false;
+    }
+
+    std::shared_ptr<Tile> tile;
+
+    while (frame->completedTiles.TryPop(tile)) {
+
+      NotifyTileObservers(tile);
+
+      frame->tilesObserved++;
+    }
+
+    StartTiles();
 
     return true;
   }
@@ -331,6 +1142,13 @@ public:
     if (!mFrameStatus)
       return false;
 
+    // Tiles that have not started yet are skipped, the ones that are being
+    // rendered have to finish since they reference the frame.
+    mFrameStatus->cancelled = true;
+
+    for (auto& tileTask : mFrameStatus->tileTasks)
+      tileTask.wait();
+
     mFrameStatus.reset();
 
     return true;
@@ -338,13 +1156,12 @@ public:
 
   bool SetHeightExpr(const terra::Expr& heightExpr) override
   {
-    ExprBuilder<float> exprBuilder;
-
-    heightExpr.Accept(exprBuilder);
+    if (mFrameStatus)
+      return false;
 
-    mHeightExpr = exprBuilder.TakeExpr();
+    mHeightProgram = Program<float>::Build(heightExpr);
 
-    return !!mHeightExpr;
+    return !!mHeightProgram;
   }
 
   void SetResolution(size_t w, size_t h) override
@@ -353,23 +1170,142 @@ public:
     mResY = h;
   }
 
+  void SetProgressive(bool progressive) override
+  {
+    mProgressive = progressive;
+  }
+
 private:
-  void NotifyTileObservers(const Tile& tile)
+  void NotifyTileObservers(const std::shared_ptr<const Tile>& tile)
   {
     for (auto& tileObserver : mTileObservers)
       tileObserver->Observe(tile);
   }
 
+  /// One tile being rendered per thread, and two per thread waiting to be
+  /// observed, so that the workers are kept busy while the observers are.
+  size_t MaxTilesInFlight() const
+  {
+    return size_t(mThreadPool.get_thread_count()) * 3;
+  }
+
+  /// Submits tiles in order, as long as there is room in the queue for them.
+  /// Called by the polling thread.
+  void StartTiles()
+  {
+    auto* frame = mFrameStatus.get();
+
+    // Tiles that would only be skipped are not submitted at all.
+    if (frame->TokenIsCancelled()) {
+      frame->tilesSkipped += frame->tileCount - frame->tilesStarted;
+      frame->tilesStarted = frame->tileCount;
+      return;
+    }
+
+    const auto& heightProgram = *mHeightProgram;
+
+    while (frame->CanStartTile()) {
+
+      auto tileTask = [frame, &heightProgram, i = frame->tilesStarted]() {
+        RenderTile(*frame, heightProgram, i);
+      };
+
+      frame->tileTasks.emplace_back(mThreadPool.submit(tileTask));
+
+      frame->tilesStarted++;
+    }
+  }
+
+  /// @brief Renders the tile of a task and queues it for the observers. For
+  /// progressive frames, also renders the following passes of the same part
+  /// of the image whose tasks started too early.
+  ///
+  /// @param taskIndex The tiles of each pass come after the ones of the pass
+  /// before.
+  static void RenderTile(FrameStatus& frame,
+                         const Program<float>& heightProgram,
+                         size_t taskIndex)
+  {
+    auto tileIndex = taskIndex % frame.tilesPerPass;
+
+    auto pass = taskIndex / frame.tilesPerPass;
+
+    if ((pass > 0) && !frame.HandOff(tileIndex, pass))
+      return;
+
+    auto x = frame.GetXOffset(tileIndex);
+    auto y = frame.GetYOffset(tileIndex);
+    auto w = frame.GetWidth(tileIndex);
+    auto h = frame.GetHeight(tileIndex);
+
+    for (;; pass++) {
+
+      if (frame.cancelled)
+        return;
+
+      auto isLastPass = (pass + 1) == frame.passCount;
+
+      if (frame.TokenIsCancelled()) {
+
+        // The following passes are skipped as well, but still have to be
+        // counted once their tasks start.
+        frame.tilesSkipped++;
+
+        frame.WakePoller();
+
+      } else {
+
+        std::vector<float> coarser;
+
+        if (pass > 0)
+          coarser = std::move(frame.levelSamples[tileIndex]);
+
+        auto tile = frame.tilePool->Acquire(x, y, w, h);
+
+        tile->SetLevel(frame.passCount - 1 - pass);
+
+        std::vector<float> samples;
+
+        RenderTask renderTask(*tile,
+                              heightProgram,
+                              frame.resX,
+                              frame.resY,
+                              (pass > 0) ? &coarser : nullptr,
+                              isLastPass ? nullptr : &samples);
+
+        renderTask();
+
+        if (!isLastPass)
+          frame.levelSamples[tileIndex] = std::move(samples);
+
+        // There is always room, see FrameStatus::maxTilesInFlight.
+        frame.completedTiles.TryPush(tile);
+
+        frame.WakePoller();
+      }
+
+      if (isLastPass || !frame.HandOff(tileIndex, pass + 1))
+        return;
+    }
+  }
+
 private:
   size_t mResX = 0;
 
   size_t mResY = 0;
 
+  bool mProgressive = false;
+
+  thread_pool& mThreadPool = GetSharedThreadPool();
+
+  /// Keeps the tiles that can be in flight at once.
+  std::shared_ptr<TilePool> mTilePool = TilePool::Make(MaxTilesInFlight());
+
   std::vector<std::shared_ptr<TileObserver>> mTileObservers;
 
   std::unique_ptr<FrameStatus> mFrameStatus;
 
-  std::unique_ptr<impl::Expr<float>> mHeightExpr;
+  std::unique_ptr<Program<float>> mHeightProgram;
 };
 
 } // namespace
@@ -393,57 +1329,170 @@ public:
 
   bool SetHeightExpr(const Expr& heightExpr) override
   {
-    ExprBuilder<float> exprBuilder;
-
-    heightExpr.Accept(exprBuilder);
-
-    mHeightExpr = exprBuilder.TakeExpr();
+    mHeightProgram = Program<float>::Build(heightExpr);
 
     return true;
   }
 
   bool SetColorExpr(const Expr& expr) override
   {
-    ExprBuilder<impl::Vector<float, 3>> exprBuilder;
-
-    expr.Accept(exprBuilder);
-
-    mColorExpr = exprBuilder.TakeExpr();
+    mColorProgram = Program<impl::Vector<float, 3>>::Build(expr);
 
     return true;
   }
 
-  bool Execute() override
+  void SetRowsInFlight(size_t rowCount) override { mRowsInFlight = rowCount; }
+
+  bool Execute(const CancellationToken* token) override
   {
-    if (!mHeightExpr || !mColorExpr)
+    mRowsObserved = 0;
+
+    if (!mHeightProgram || !mColorProgram)
       return false;
 
-    std::vector<float> heightAndRgbBuffer(mWidth * 4);
+    auto threadCount = size_t(mThreadPool.get_thread_count());
 
-    for (size_t y = 0; y < mHeight; y++) {
+    auto rowsInFlight = mRowsInFlight ? mRowsInFlight : (threadCount * 8);
 
-      for (size_t x = 0; x < mWidth; x++) {
+    rowsInFlight = std::min(rowsInFlight, std::max<size_t>(mHeight, 1));
+
+    // Two bands per thread, so that threads do not sit idle while the oldest
+    // band is passed to the observer.
+    auto rowsPerBand = std::max<size_t>(rowsInFlight / (threadCount * 2), 1);
+
+    auto bandCount = std::max<size_t>(rowsInFlight / rowsPerBand, 1);
+
+    std::vector<float> uRow(mWidth);
+
+    for (size_t x = 0; x < mWidth; x++)
+      uRow[x] = (x + 0.5f) / mWidth;
+
+    Columns columns{ uRow,
+                     mHeightProgram->EvalColumns(uRow.data(), mWidth),
+                     mColorProgram->EvalColumns(uRow.data(), mWidth) };
+
+    // The band buffers are reused in a ring. A band is only scheduled once
+    // the band that used its buffer before has been passed to the observer.
+    std::vector<std::vector<float>> bandBuffers(bandCount);
+
+    for (auto& bandBuffer : bandBuffers)
+      bandBuffer.resize(rowsPerBand * mWidth * 4);
+
+    // Bands complete in any order, but are waited on in the order they were
+    // scheduled, so that the observer sees the rows in order.
+    std::deque<std::future<void>> pending;
 
-        BuiltinVars builtinVars;
-        builtinVars.uCenter = (x + 0.5f) / mWidth;
-        builtinVars.vCenter = (y + 0.5f) / mHeight;
+    size_t scheduledRows = 0;
 
-        auto h = mHeightExpr->Eval(builtinVars);
+    size_t band = 0;
 
-        auto c = mColorExpr->Eval(builtinVars);
+    auto schedule = [&]() {
+      auto y = scheduledRows;
 
-        heightAndRgbBuffer[(x * 4) + 0] = h;
-        heightAndRgbBuffer[(x * 4) + 1] = Clamp(c(0) * 255.0f, 0.0f, 255.0f);
-        heightAndRgbBuffer[(x * 4) + 2] = Clamp(c(1) * 255.0f, 0.0f, 255.0f);
-        heightAndRgbBuffer[(x * 4) + 3] = Clamp(c(2) * 255.0f, 0.0f, 255.0f);
+      auto yEnd = std::min(y + rowsPerBand, mHeight);
+
+      auto* buffer = bandBuffers[band % bandCount].data();
+
+      auto task = [this, &columns, buffer, y, yEnd, token]() {
+        RenderBand(columns, y, yEnd, buffer, token);
+      };
+
+      pending.emplace_back(mThreadPool.submit(task));
+
+      scheduledRows = yEnd;
+
+      band++;
+    };
+
+    while ((scheduledRows < mHeight) && (pending.size() < bandCount))
+      schedule();
+
+    auto isCancelled = [token]() { return token && token->IsCancelled(); };
+
+    for (size_t y = 0; y < mHeight;) {
+
+      pending.front().wait();
+
+      pending.pop_front();
+
+      // A band may have stopped part way, so none of the bands that are
+      // done after cancelling are passed on. The ones still rendering
+      // reference the buffers and have to finish first.
+      if (isCancelled()) {
+
+        for (auto& task : pending)
+          task.wait();
+
+        return false;
       }
 
-      mLineObserver.Observe(heightAndRgbBuffer.data());
+      const auto* buffer = bandBuffers[(y / rowsPerBand) % bandCount].data();
+
+      auto yEnd = std::min(y + rowsPerBand, mHeight);
+
+      for (; y < yEnd; y++)
+        mLineObserver.Observe(buffer + ((y % rowsPerBand) * mWidth * 4));
+
+      mRowsObserved = y;
+
+      if (scheduledRows < mHeight)
+        schedule();
     }
 
     return true;
   }
 
+  size_t RowsObserved() const noexcept override { return mRowsObserved; }
+
+private:
+  /// The values that only depend on the column, shared by all bands.
+  struct Columns final
+  {
+    const std::vector<float>& u;
+
+    std::vector<float> height;
+
+    std::vector<float> color;
+  };
+
+  /// Renders rows into @p buffer, interleaving height and RGB as expected by
+  /// the line observer. Stops early if @p token is cancelled.
+  void RenderBand(const Columns& columns,
+                  size_t yBegin,
+                  size_t yEnd,
+                  float* buffer,
+                  const CancellationToken* token) const
+  {
+    std::vector<float> hRow(mWidth);
+    std::vector<impl::Vector<float, 3>> cRow(mWidth);
+
+    const auto* u = columns.u.data();
+
+    for (size_t y = yBegin; y < yEnd; y++) {
+
+      if (token && token->IsCancelled())
+        return;
+
+      auto v = (y + 0.5f) / mHeight;
+
+      mHeightProgram->EvalRow(u, v, columns.height, hRow.data(), mWidth);
+
+      mColorProgram->EvalRow(u, v, columns.color, cRow.data(), mWidth);
+
+      auto* line = buffer + ((y - yBegin) * mWidth * 4);
+
+      for (size_t x = 0; x < mWidth; x++) {
+
+        const auto& c = cRow[x];
+
+        line[(x * 4) + 0] = hRow[x];
+        line[(x * 4) + 1] = Clamp(c(0) * 255.0f, 0.0f, 255.0f);
+        line[(x * 4) + 2] = Clamp(c(1) * 255.0f, 0.0f, 255.0f);
+        line[(x * 4) + 3] = Clamp(c(2) * 255.0f, 0.0f, 255.0f);
+      }
+    }
+  }
+
 private:
   size_t mWidth;
 
@@ -451,9 +1500,16 @@ private:
 
   LineObserver& mLineObserver;
 
-  std::unique_ptr<impl::Expr<float>> mHeightExpr;
+  std::unique_ptr<Program<float>> mHeightProgram;
+
+  std::unique_ptr<Program<impl::Vector<float, 3>>> mColorProgram;
+
+  /// Zero picks a number based on the thread count.
+  size_t mRowsInFlight = 0;
+
+  size_t mRowsObserved = 0;
 
-  std::unique_ptr<impl::Expr<impl::Vector<float, 3>>> mColorExpr;
+  thread_pool& mThreadPool = GetSharedThreadPool();
 };
 
 } // namespace
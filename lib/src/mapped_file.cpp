@@ -0,0 +1,184 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace terra {
+
+#ifndef _WIN32
+
+namespace {
+
+bool
+Allocate(int file, size_t size)
+{
+#ifdef __APPLE__
+  fstore_t store{};
+
+  store.fst_flags = F_ALLOCATEALL;
+  store.fst_posmode = F_PEOFPOSMODE;
+  store.fst_length = off_t(size);
+
+  if (fcntl(file, F_PREALLOCATE, &store) == -1)
+    return false;
+
+  return ftruncate(file, off_t(size)) == 0;
+#else
+  return posix_fallocate(file, 0, off_t(size)) == 0;
+#endif
+}
+
+} // namespace
+
+#endif
+
+MappedFile::~MappedFile()
+{
+  Close();
+}
+
+#ifdef _WIN32
+
+bool
+MappedFile::Open(const char* path, size_t size)
+{
+  Close();
+
+  mFile = CreateFileA(path,
+                      GENERIC_READ | GENERIC_WRITE,
+                      0,
+                      nullptr,
+                      CREATE_ALWAYS,
+                      FILE_ATTRIBUTE_NORMAL,
+                      nullptr);
+
+  if (mFile == INVALID_HANDLE_VALUE) {
+    mFile = nullptr;
+    return false;
+  }
+
+  // Mapping an empty file fails, but there is nothing to write either.
+  if (size == 0)
+    return true;
+
+  LARGE_INTEGER end;
+
+  end.QuadPart = LONGLONG(size);
+
+  // Allocates the disk space, so that running out of it fails here rather
+  // than while writing to the mapping.
+  if (!SetFilePointerEx(mFile, end, nullptr, FILE_BEGIN) ||
+      !SetEndOfFile(mFile)) {
+    Close();
+    return false;
+  }
+
+  // Skips zeroing the file, which needs a privilege that processes usually
+  // do not have, so failing is fine. All of the file gets written anyway.
+  SetFileValidData(mFile, end.QuadPart);
+
+  auto high = DWORD(uint64_t(size) >> 32);
+  auto low = DWORD(uint64_t(size));
+
+  mMapping =
+    CreateFileMappingA(mFile, nullptr, PAGE_READWRITE, high, low, nullptr);
+
+  if (!mMapping) {
+    Close();
+    return false;
+  }
+
+  mData = (uint8_t*)MapViewOfFile(mMapping, FILE_MAP_WRITE, 0, 0, size);
+
+  if (!mData) {
+    Close();
+    return false;
+  }
+
+  mSize = size;
+
+  return true;
+}
+
+void
+MappedFile::Close() noexcept
+{
+  if (mData)
+    UnmapViewOfFile(mData);
+
+  if (mMapping)
+    CloseHandle(mMapping);
+
+  if (mFile)
+    CloseHandle(mFile);
+
+  mData = nullptr;
+  mMapping = nullptr;
+  mFile = nullptr;
+  mSize = 0;
+}
+
+#else
+
+bool
+MappedFile::Open(const char* path, size_t size)
+{
+  Close();
+
+  mFile = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (mFile < 0)
+    return false;
+
+  if (size == 0)
+    return true;
+
+  // Allocates the disk space rather than making a sparse file, so that
+  // running out of it fails here rather than raising SIGBUS while writing
+  // to the mapping.
+  if (!Allocate(mFile, size)) {
+    Close();
+    return false;
+  }
+
+  auto protection = PROT_READ | PROT_WRITE;
+
+  auto* data = mmap(nullptr, size, protection, MAP_SHARED, mFile, 0);
+
+  if (data == MAP_FAILED) {
+    Close();
+    return false;
+  }
+
+  mData = (uint8_t*)data;
+
+  mSize = size;
+
+  return true;
+}
+
+void
+MappedFile::Close() noexcept
+{
+  if (mData)
+    munmap(mData, mSize);
+
+  if (mFile >= 0)
+    close(mFile);
+
+  mData = nullptr;
+  mFile = -1;
+  mSize = 0;
+}
+
+#endif
+
+} // namespace terra
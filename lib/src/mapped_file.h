@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace terra {
+
+/// A file of a fixed size, mapped into memory for reading and writing.
+class MappedFile final
+{
+public:
+  MappedFile() = default;
+
+  MappedFile(const MappedFile&) = delete;
+
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  /// Unmaps and closes the file. The written pages are flushed to the file by
+  /// the operating system.
+  ~MappedFile();
+
+  /// Creates or truncates the file at @p path, allocates @p size bytes for
+  /// it and maps it.
+  ///
+  /// @return True on success, false on failure, including when there is not
+  /// enough disk space for the file.
+  bool Open(const char* path, size_t size);
+
+  /// Unmaps and closes the file early, for example to remove it.
+  void Close() noexcept;
+
+  auto GetData() noexcept -> uint8_t* { return mData; }
+
+  auto GetSize() const noexcept -> size_t { return mSize; }
+
+private:
+  uint8_t* mData = nullptr;
+
+  size_t mSize = 0;
+
+#ifdef _WIN32
+  void* mFile = nullptr;
+
+  void* mMapping = nullptr;
+#else
+  int mFile = -1;
+#endif
+};
+
+} // namespace terra
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace terra {
+
+/// A bounded, lock-free queue with any number of producers and a single
+/// consumer. Each slot has a sequence number that tells whether it is free to
+/// write or ready to read, so producers only contend on claiming a position.
+///
+/// @tparam Item Must be default constructible and nothrow move assignable.
+template<typename Item>
+class MpscQueue final
+{
+public:
+  /// @param capacity Rounded up to the next power of two.
+  explicit MpscQueue(size_t capacity)
+  {
+    size_t size = 1;
+
+    while (size < capacity)
+      size *= 2;
+
+    mCells.reset(new Cell[size]);
+
+    mMask = size - 1;
+
+    for (size_t i = 0; i < size; i++)
+      mCells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  /// Can be called from any thread.
+  ///
+  /// @return True if @p item was moved into the queue, false if the queue is
+  /// full, in which case @p item is left untouched.
+  bool TryPush(Item& item) noexcept
+  {
+    auto pos = mTail.load(std::memory_order_relaxed);
+
+    Cell* cell = nullptr;
+
+    for (;;) {
+
+      cell = &mCells[pos & mMask];
+
+      auto seq = cell->sequence.load(std::memory_order_acquire);
+
+      auto diff = intptr_t(seq) - intptr_t(pos);
+
+      if (diff == 0) {
+        auto order = std::memory_order_relaxed;
+        if (mTail.compare_exchange_weak(pos, pos + 1, order))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = mTail.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->item = std::move(item);
+
+    cell->sequence.store(pos + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  /// Must only be called from the consumer thread.
+  ///
+  /// @return True if an item was moved into @p item, false if the queue is
+  /// empty.
+  bool TryPop(Item& item) noexcept
+  {
+    auto& cell = mCells[mHead & mMask];
+
+    if (cell.sequence.load(std::memory_order_acquire) != (mHead + 1))
+      return false;
+
+    item = std::move(cell.item);
+
+    cell.sequence.store(mHead + mMask + 1, std::memory_order_release);
+
+    mHead++;
+
+    return true;
+  }
+
+  /// Must only be called from the consumer thread.
+  bool Empty() const noexcept
+  {
+    const auto& cell = mCells[mHead & mMask];
+
+    return cell.sequence.load(std::memory_order_acquire) != (mHead + 1);
+  }
+
+private:
+  /// Aligned to a cache line, so that producers writing to neighboring slots
+  /// do not invalidate each other's cache lines.
+  struct alignas(64) Cell final
+  {
+    std::atomic<size_t> sequence{ 0 };
+
+    Item item;
+  };
+
+  std::unique_ptr<Cell[]> mCells;
+
+  size_t mMask = 0;
+
+  alignas(64) std::atomic<size_t> mTail{ 0 };
+
+  alignas(64) size_t mHead = 0;
+};
+
+} // namespace terra
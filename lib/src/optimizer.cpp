@@ -0,0 +1,302 @@
+#include <terra/optimizer.h>
+
+#include <terra/expr_visitor.h>
+
+#include <terra/exprs/binary.h>
+#include <terra/exprs/casts.h>
+#include <terra/exprs/literals.h>
+#include <terra/exprs/unary.h>
+#include <terra/exprs/var_ref.h>
+#include <terra/exprs/vector_combiner.h>
+
+#include <limits>
+#include <optional>
+
+#include <math.h>
+#include <stdint.h>
+
+namespace terra {
+
+namespace {
+
+auto
+AsFloatLiteral(const Expr* expr) -> const FloatLiteralExpr*
+{
+  return dynamic_cast<const FloatLiteralExpr*>(expr);
+}
+
+auto
+AsIntLiteral(const Expr* expr) -> const IntLiteralExpr*
+{
+  return dynamic_cast<const IntLiteralExpr*>(expr);
+}
+
+bool
+IsFloatLiteral(const Expr* expr, float value)
+{
+  const auto* literal = AsFloatLiteral(expr);
+
+  return literal && (literal->GetValue() == value);
+}
+
+/// The functions here must match the ones used by the interpreter, so that
+/// folding does not change the result.
+float
+EvalUnary(UnaryExpr::ID id, float x)
+{
+  switch (id) {
+    case UnaryExpr::ID::Sine:
+      return sin(x);
+    case UnaryExpr::ID::Cosine:
+      return cos(x);
+    case UnaryExpr::ID::Tangent:
+      return tan(x);
+    case UnaryExpr::ID::Arcsine:
+      return asin(x);
+    case UnaryExpr::ID::Arccosine:
+      return acos(x);
+    case UnaryExpr::ID::Arctangent:
+      return atan(x);
+  }
+
+  return x;
+}
+
+float
+EvalBinary(BinaryExpr::ID id, float l, float r)
+{
+  switch (id) {
+    case BinaryExpr::ID::Add:
+      return l + r;
+    case BinaryExpr::ID::Sub:
+      return l - r;
+    case BinaryExpr::ID::Mul:
+      return l * r;
+    case BinaryExpr::ID::Div:
+      return l / r;
+  }
+
+  return l;
+}
+
+auto
+EvalBinary(BinaryExpr::ID id, int l, int r) -> std::optional<int>
+{
+  int64_t result = 0;
+
+  switch (id) {
+    case BinaryExpr::ID::Add:
+      result = int64_t(l) + r;
+      break;
+    case BinaryExpr::ID::Sub:
+      result = int64_t(l) - r;
+      break;
+    case BinaryExpr::ID::Mul:
+      result = int64_t(l) * r;
+      break;
+    case BinaryExpr::ID::Div:
+      if (r == 0)
+        return {};
+      result = int64_t(l) / r;
+      break;
+  }
+
+  if ((result < std::numeric_limits<int>::min()) ||
+      (result > std::numeric_limits<int>::max()))
+    return {};
+
+  return int(result);
+}
+
+class Simplifier final : public ExprVisitor
+{
+public:
+  auto Run(const Expr& expr) -> std::unique_ptr<Expr>
+  {
+    expr.Accept(*this);
+
+    return std::move(mResult);
+  }
+
+  void Visit(const VarRefExpr& expr) override
+  {
+    mResult.reset(new VarRefExpr(expr.GetID()));
+  }
+
+  void Visit(const IntLiteralExpr& expr) override
+  {
+    mResult.reset(new IntLiteralExpr(expr.GetValue()));
+  }
+
+  void Visit(const FloatLiteralExpr& expr) override
+  {
+    mResult.reset(new FloatLiteralExpr(expr.GetValue()));
+  }
+
+  void Visit(const FloatToIntExpr& expr) override
+  {
+    auto source = Run(expr.GetSourceExpr());
+
+    if (const auto* literal = AsFloatLiteral(source.get())) {
+
+      auto value = truncf(literal->GetValue());
+
+      // Converting values that do not fit is undefined, so they are left for
+      // the interpreter to deal with.
+      if ((value >= float(std::numeric_limits<int>::min())) &&
+          (value < -float(std::numeric_limits<int>::min()))) {
+        mResult.reset(new IntLiteralExpr(int(value)));
+        return;
+      }
+    }
+
+    mResult.reset(new FloatToIntExpr(std::move(source)));
+  }
+
+  void Visit(const IntToFloatExpr& expr) override
+  {
+    auto source = Run(expr.GetSourceExpr());
+
+    if (const auto* literal = AsIntLiteral(source.get()))
+      mResult.reset(new FloatLiteralExpr(float(literal->GetValue())));
+    else
+      mResult.reset(new IntToFloatExpr(std::move(source)));
+  }
+
+  void Visit(const UnaryExpr& expr) override
+  {
+    auto input = Run(expr.GetInputExpr());
+
+    if (const auto* literal = AsFloatLiteral(input.get())) {
+      auto value = EvalUnary(expr.GetID(), literal->GetValue());
+      mResult.reset(new FloatLiteralExpr(value));
+    } else {
+      mResult.reset(new UnaryExpr(expr.GetID(), std::move(input)));
+    }
+  }
+
+  void Visit(const BinaryExpr& expr) override
+  {
+    auto l = Run(expr.GetLeftExpr());
+    auto r = Run(expr.GetRightExpr());
+
+    mResult = SimplifyBinary(expr, std::move(l), std::move(r));
+  }
+
+  void Visit(const VectorCombiner<2>& expr) override { Combine(expr); }
+
+  void Visit(const VectorCombiner<3>& expr) override { Combine(expr); }
+
+  void Visit(const VectorCombiner<4>& expr) override { Combine(expr); }
+
+private:
+  enum class Operand
+  {
+    None,
+    Left,
+    Right
+  };
+
+  template<size_t Size>
+  void Combine(const VectorCombiner<Size>& expr)
+  {
+    std::array<std::shared_ptr<Expr>, Size> elements;
+
+    for (size_t i = 0; i < Size; i++)
+      elements[i] = Run(expr.GetElement(i));
+
+    mResult.reset(new VectorCombiner<Size>(std::move(elements)));
+  }
+
+  static auto SimplifyBinary(const BinaryExpr& expr,
+                             std::unique_ptr<Expr> l,
+                             std::unique_ptr<Expr> r) -> std::unique_ptr<Expr>
+  {
+    using Result = std::unique_ptr<Expr>;
+
+    auto id = expr.GetID();
+
+    const auto* lFloat = AsFloatLiteral(l.get());
+    const auto* rFloat = AsFloatLiteral(r.get());
+
+    if (lFloat && rFloat) {
+      auto value = EvalBinary(id, lFloat->GetValue(), rFloat->GetValue());
+      return Result(new FloatLiteralExpr(value));
+    }
+
+    const auto* lInt = AsIntLiteral(l.get());
+    const auto* rInt = AsIntLiteral(r.get());
+
+    if (lInt && rInt) {
+      if (auto value = EvalBinary(id, lInt->GetValue(), rInt->GetValue()))
+        return Result(new IntLiteralExpr(*value));
+    }
+
+    if (expr.GetType() == Type::Float) {
+      switch (IsIdentity(id, *l, *r)) {
+        case Operand::None:
+          break;
+        case Operand::Left:
+          return l;
+        case Operand::Right:
+          return r;
+      }
+    }
+
+    if ((id == BinaryExpr::ID::Div) && rFloat) {
+
+      auto reciprocal = 1.0f / rFloat->GetValue();
+
+      // Zero, infinite and subnormal reciprocals would change the result.
+      if (isnormal(reciprocal)) {
+        auto rExpr = std::make_shared<FloatLiteralExpr>(reciprocal);
+        return Result(new BinaryExpr(BinaryExpr::ID::Mul, std::move(l), rExpr));
+      }
+    }
+
+    return Result(new BinaryExpr(id, std::move(l), std::move(r)));
+  }
+
+  /// @return The operand that the binary expression reduces to, if any.
+  static auto IsIdentity(BinaryExpr::ID id, const Expr& l, const Expr& r)
+    -> Operand
+  {
+    switch (id) {
+      case BinaryExpr::ID::Add:
+        if (IsFloatLiteral(&l, 0.0f))
+          return Operand::Right;
+        if (IsFloatLiteral(&r, 0.0f))
+          return Operand::Left;
+        break;
+      case BinaryExpr::ID::Sub:
+        if (IsFloatLiteral(&r, 0.0f))
+          return Operand::Left;
+        break;
+      case BinaryExpr::ID::Mul:
+        if (IsFloatLiteral(&l, 1.0f))
+          return Operand::Right;
+        if (IsFloatLiteral(&r, 1.0f))
+          return Operand::Left;
+        break;
+      case BinaryExpr::ID::Div:
+        if (IsFloatLiteral(&r, 1.0f))
+          return Operand::Left;
+        break;
+    }
+
+    return Operand::None;
+  }
+
+private:
+  std::unique_ptr<Expr> mResult;
+};
+
+} // namespace
+
+auto
+Simplify(const Expr& expr) -> std::unique_ptr<Expr>
+{
+  return Simplifier().Run(expr);
+}
+
+} // namespace terra
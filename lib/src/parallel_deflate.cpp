@@ -0,0 +1,248 @@
+#include "parallel_deflate.h"
+
+#include <algorithm>
+
+#include <zlib.h>
+
+namespace terra {
+
+namespace {
+
+/// The size of the input of a block, as in pigz.
+constexpr size_t
+BlockSize() noexcept
+{
+  return 128 * 1024;
+}
+
+/// The size of the deflate window.
+constexpr size_t
+DictionarySize() noexcept
+{
+  return 32 * 1024;
+}
+
+} // namespace
+
+ParallelDeflate::ParallelDeflate(thread_pool& threadPool,
+                                 std::vector<Attempt> attempts,
+                                 Sink sink)
+  : mThreadPool(threadPool)
+  , mAttempts(std::move(attempts))
+  , mSink(std::move(sink))
+  , mMaxPending(size_t(threadPool.get_thread_count()) * 2)
+  , mAdler(adler32(0, Z_NULL, 0))
+{
+  mInput.reserve(BlockSize());
+}
+
+void
+ParallelDeflate::Write(const uint8_t* data, size_t size)
+{
+  while (size > 0) {
+
+    auto count = std::min(size, BlockSize() - mInput.size());
+
+    mInput.insert(mInput.end(), data, data + count);
+
+    data += count;
+
+    size -= count;
+
+    if (mInput.size() == BlockSize())
+      Submit(false);
+  }
+}
+
+bool
+ParallelDeflate::Finish()
+{
+  Submit(true);
+
+  while (!mPending.empty())
+    EmitOldest();
+
+  if (mFailed)
+    return false;
+
+  uint8_t trailer[4]{ uint8_t(mAdler >> 24),
+                      uint8_t(mAdler >> 16),
+                      uint8_t(mAdler >> 8),
+                      uint8_t(mAdler) };
+
+  mSink(trailer, sizeof(trailer));
+
+  return true;
+}
+
+void
+ParallelDeflate::Submit(bool last)
+{
+  if (mPending.size() >= mMaxPending)
+    EmitOldest();
+
+  auto block = std::make_shared<Block>();
+
+  block->input.swap(mInput);
+
+  block->dictionary = mDictionary;
+
+  block->last = last;
+
+  // The dictionary of the next block is the end of everything so far.
+  auto tailSize = std::min(block->input.size(), DictionarySize());
+
+  mDictionary.insert(
+    mDictionary.end(), block->input.end() - tailSize, block->input.end());
+
+  if (mDictionary.size() > DictionarySize()) {
+    auto excess = mDictionary.size() - DictionarySize();
+    mDictionary.erase(mDictionary.begin(), mDictionary.begin() + excess);
+  }
+
+  mInput.reserve(BlockSize());
+
+  auto task = [block, attempts = mAttempts]() {
+    return Compress(*block, attempts);
+  };
+
+  mPending.emplace_back(mThreadPool.submit(task));
+}
+
+void
+ParallelDeflate::EmitOldest()
+{
+  auto block = mPending.front().get();
+
+  mPending.pop_front();
+
+  if (!block.success)
+    mFailed = true;
+
+  if (mFailed)
+    return;
+
+  WriteHeader();
+
+  mSink(block.data.data(), block.data.size());
+
+  mAdler = adler32_combine(mAdler, block.adler, z_off_t(block.inputSize));
+}
+
+void
+ParallelDeflate::WriteHeader()
+{
+  if (mHeaderWritten)
+    return;
+
+  mHeaderWritten = true;
+
+  // A deflate stream with a 32 KiB window, and the level it was compressed
+  // with as a hint for decoders.
+  const auto& attempt = mAttempts.front();
+
+  unsigned levelFlags = 3;
+
+  if ((attempt.strategy >= Z_HUFFMAN_ONLY) || (attempt.level == 1))
+    levelFlags = 0;
+  else if ((attempt.level >= 0) && (attempt.level < 6))
+    levelFlags = 1;
+  else if ((attempt.level == 6) || (attempt.level == Z_DEFAULT_COMPRESSION))
+    levelFlags = 2;
+
+  unsigned header = (0x78 << 8) | (levelFlags << 6);
+
+  header += 31 - (header % 31);
+
+  uint8_t bytes[2]{ uint8_t(header >> 8), uint8_t(header) };
+
+  mSink(bytes, sizeof(bytes));
+}
+
+auto
+ParallelDeflate::Compress(const Block& block,
+                          const std::vector<Attempt>& attempts)
+  -> CompressedBlock
+{
+  CompressedBlock result;
+
+  result.inputSize = block.input.size();
+
+  result.adler = adler32(0, Z_NULL, 0);
+
+  result.adler = adler32_z(result.adler, block.input.data(), result.inputSize);
+
+  std::vector<uint8_t> data;
+
+  for (const auto& attempt : attempts) {
+
+    if (!Deflate(block, attempt, data))
+      return result;
+
+    if (!result.success || (data.size() < result.data.size()))
+      result.data.swap(data);
+
+    result.success = true;
+  }
+
+  return result;
+}
+
+bool
+ParallelDeflate::Deflate(const Block& block,
+                         const Attempt& attempt,
+                         std::vector<uint8_t>& output)
+{
+  z_stream stream{};
+
+  auto level = attempt.level;
+
+  auto strategy = attempt.strategy;
+
+  // A raw stream, the header and trailer are written separately.
+  if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, strategy) != Z_OK)
+    return false;
+
+  if (!block.dictionary.empty()) {
+    deflateSetDictionary(
+      &stream, block.dictionary.data(), uInt(block.dictionary.size()));
+  }
+
+  // Room for the flush marker, on top of the worst case expansion.
+  output.resize(deflateBound(&stream, uLong(block.input.size())) + 16);
+
+  stream.next_in = const_cast<Bytef*>(block.input.data());
+  stream.avail_in = uInt(block.input.size());
+
+  auto flush = block.last ? Z_FINISH : Z_FULL_FLUSH;
+
+  auto success = false;
+
+  for (;;) {
+
+    stream.next_out = output.data() + stream.total_out;
+    stream.avail_out = uInt(output.size() - stream.total_out);
+
+    auto ret = deflate(&stream, flush);
+
+    if (ret == Z_STREAM_ERROR)
+      break;
+
+    auto done = block.last ? (ret == Z_STREAM_END) : (stream.avail_out != 0);
+
+    if (done) {
+      success = true;
+      break;
+    }
+
+    output.resize(output.size() * 2);
+  }
+
+  output.resize(stream.total_out);
+
+  deflateEnd(&stream);
+
+  return success;
+}
+
+} // namespace terra
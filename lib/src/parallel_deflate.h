@@ -0,0 +1,118 @@
+#pragma once
+
+#include <thread_pool.hpp>
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace terra {
+
+/// @brief Produces a zlib stream, compressing blocks of the input on a
+/// thread pool.
+///
+/// @details Each block is compressed on its own, primed with the last 32 KiB
+/// of the block before it so that little ratio is lost, and ends on a full
+/// flush so that the compressed blocks can simply be concatenated. Each
+/// block may be compressed with several settings, keeping the smallest
+/// result, since no level or strategy is best for all data. The Adler-32
+/// checksums of the blocks are combined into the one of the whole stream.
+class ParallelDeflate final
+{
+public:
+  /// Called with the compressed data, in order.
+  using Sink = std::function<void(const uint8_t* data, size_t size)>;
+
+  /// A zlib compression level and strategy to compress blocks with.
+  struct Attempt final
+  {
+    int level;
+
+    int strategy;
+  };
+
+  /// @param attempts The settings to try, at least one. The first one is
+  /// the one the stream header names.
+  ParallelDeflate(thread_pool& threadPool,
+                  std::vector<Attempt> attempts,
+                  Sink sink);
+
+  /// Buffers @p data, compressing blocks as they fill up. Blocks that are
+  /// done are passed to the sink. Waits for the oldest block once too many
+  /// are being compressed.
+  void Write(const uint8_t* data, size_t size);
+
+  /// Compresses the remaining data and passes the rest of the stream to the
+  /// sink. Must be called exactly once, after the last call to @ref Write.
+  ///
+  /// @return False if a block failed to compress, in which case the stream
+  /// passed to the sink is incomplete.
+  bool Finish();
+
+private:
+  struct Block final
+  {
+    std::vector<uint8_t> input;
+
+    std::vector<uint8_t> dictionary;
+
+    bool last = false;
+  };
+
+  struct CompressedBlock final
+  {
+    std::vector<uint8_t> data;
+
+    uint32_t adler = 0;
+
+    size_t inputSize = 0;
+
+    bool success = false;
+  };
+
+  static auto Compress(const Block& block,
+                       const std::vector<Attempt>& attempts)
+    -> CompressedBlock;
+
+  /// Compresses the block into @p output as a raw deflate stream.
+  static bool Deflate(const Block& block,
+                      const Attempt& attempt,
+                      std::vector<uint8_t>& output);
+
+  void Submit(bool last);
+
+  /// Waits for the oldest block and passes it to the sink.
+  void EmitOldest();
+
+  void WriteHeader();
+
+private:
+  thread_pool& mThreadPool;
+
+  std::vector<Attempt> mAttempts;
+
+  Sink mSink;
+
+  /// The number of blocks compressed at once, which bounds the memory used.
+  size_t mMaxPending;
+
+  std::vector<uint8_t> mInput;
+
+  /// The end of the data of the last submitted block.
+  std::vector<uint8_t> mDictionary;
+
+  std::deque<std::future<CompressedBlock>> mPending;
+
+  uint32_t mAdler;
+
+  bool mHeaderWritten = false;
+
+  bool mFailed = false;
+};
+
+} // namespace terra
@@ -2,8 +2,13 @@
 
 #include <terra/tile.h>
 
+#include <thread_pool.hpp>
+
 #include <algorithm>
+#include <filesystem>
 #include <fstream>
+#include <limits>
+#include <string>
 #include <vector>
 
 #include <png.h>
@@ -12,6 +17,13 @@
 
 #include <iostream>
 
+#include <stdlib.h>
+
+#include "mapped_file.h"
+#include "parallel_deflate.h"
+#include "quantize.h"
+#include "shared_thread_pool.h"
+
 namespace terra {
 
 namespace {
@@ -22,12 +34,198 @@ enum class PngKind
   Color
 };
 
+/// The PNG filter types, as stored in front of each row.
+enum class FilterType : uint8_t
+{
+  None,
+  Sub,
+  Up,
+  Average,
+  Paeth
+};
+
+uint8_t
+PaethPredictor(int a, int b, int c) noexcept
+{
+  auto p = a + b - c;
+  auto pa = abs(p - a);
+  auto pb = abs(p - b);
+  auto pc = abs(p - c);
+
+  if ((pa <= pb) && (pa <= pc))
+    return uint8_t(a);
+
+  return uint8_t((pb <= pc) ? b : c);
+}
+
+/// @param prev The unfiltered row above, all zeros for the first row.
+///
+/// @param bpp The number of bytes per pixel.
+void
+FilterRow(FilterType type,
+          const uint8_t* row,
+          const uint8_t* prev,
+          size_t size,
+          size_t bpp,
+          uint8_t* out) noexcept
+{
+  for (size_t i = 0; i < size; i++) {
+
+    int a = (i >= bpp) ? row[i - bpp] : 0;
+    int b = prev[i];
+    int c = (i >= bpp) ? prev[i - bpp] : 0;
+
+    switch (type) {
+      case FilterType::None:
+        out[i] = row[i];
+        break;
+      case FilterType::Sub:
+        out[i] = uint8_t(row[i] - a);
+        break;
+      case FilterType::Up:
+        out[i] = uint8_t(row[i] - b);
+        break;
+      case FilterType::Average:
+        out[i] = uint8_t(row[i] - ((a + b) / 2));
+        break;
+      case FilterType::Paeth:
+        out[i] = uint8_t(row[i] - PaethPredictor(a, b, c));
+        break;
+    }
+  }
+}
+
+/// The heuristic libpng uses to pick a filter: the smallest sum of the
+/// filtered bytes, taken as signed values.
+auto
+FilterCost(const uint8_t* filtered, size_t size) noexcept -> size_t
+{
+  size_t cost = 0;
+
+  for (size_t i = 0; i < size; i++)
+    cost += size_t(abs(int(int8_t(filtered[i]))));
+
+  return cost;
+}
+
+/// How the filter of each row is chosen.
+enum class FilterSelection
+{
+  /// Always @ref CompressionSettings::filter.
+  Fixed,
+  /// The smallest @ref FilterCost, as in libpng.
+  MinimumSum,
+  /// The filter whose row compresses to the fewest bytes after the rows
+  /// before it, which also accounts for rows that repeat earlier data.
+  Trial
+};
+
+/// The settings a @ref PngProfile stands for.
+struct CompressionSettings final
+{
+  FilterSelection filterSelection = FilterSelection::MinimumSum;
+
+  FilterType filter = FilterType::None;
+
+  /// Each block of image data is compressed with each of these, keeping the
+  /// smallest result.
+  std::vector<ParallelDeflate::Attempt> attempts{
+    { Z_BEST_COMPRESSION, Z_DEFAULT_STRATEGY }
+  };
+};
+
+/// The settings differ between the kinds of images, since run-length
+/// encoding only works well on the 8-bit color, where filtered rows have
+/// long runs of equal bytes. On 16-bit heights it finds few matches, and
+/// the Sub filter does best on most terrains.
+auto
+GetCompressionSettings(PngProfile profile, PngKind kind) -> CompressionSettings
+{
+  auto isColor = (kind == PngKind::Color);
+
+  auto strategy = isColor ? Z_RLE : Z_DEFAULT_STRATEGY;
+
+  CompressionSettings settings;
+
+  switch (profile) {
+    case PngProfile::Fastest:
+      settings.filterSelection = FilterSelection::Fixed;
+      settings.filter = isColor ? FilterType::Paeth : FilterType::Sub;
+      settings.attempts = { { Z_BEST_SPEED, strategy } };
+      break;
+    case PngProfile::Balanced:
+      settings.filterSelection = FilterSelection::Fixed;
+      settings.filter = isColor ? FilterType::Paeth : FilterType::Sub;
+      settings.attempts = { { Z_DEFAULT_COMPRESSION, strategy } };
+      // The lowest level does better on some rough terrains, and trying it
+      // as well keeps this profile from being larger than the fastest one.
+      if (!isColor)
+        settings.attempts.push_back({ Z_BEST_SPEED, strategy });
+      break;
+    case PngProfile::Smallest:
+      if (isColor) {
+        settings.filterSelection = FilterSelection::Fixed;
+        settings.filter = FilterType::Paeth;
+      } else {
+        settings.filterSelection = FilterSelection::Trial;
+      }
+      // On rough terrains, the lower levels find matches the higher ones
+      // miss, since they do not defer matches.
+      settings.attempts = { { Z_BEST_COMPRESSION, strategy },
+                            { Z_BEST_COMPRESSION, Z_DEFAULT_STRATEGY },
+                            { 3, Z_DEFAULT_STRATEGY } };
+      break;
+    case PngProfile::Archival:
+      break;
+  }
+
+  return settings;
+}
+
+/// @brief Writes a PNG one row at a time.
+///
+/// @details The rows are filtered here and the image data is compressed on
+/// a thread pool, see @ref ParallelDeflate, since libpng compresses on the
+/// calling thread. libpng is still used to write the other chunks.
 class PngRowStream final
 {
 public:
-  PngRowStream(const char* path, size_t w, size_t h, PngKind kind)
-    : mFile(fopen(path, "wb"))
+  PngRowStream(thread_pool& threadPool,
+               const char* path,
+               size_t w,
+               size_t h,
+               PngKind kind,
+               const CompressionSettings& settings)
+    : mPath(path)
+    , mFile(fopen(path, "wb"))
+    , mHeight(h)
+    , mFilterSelection(settings.filterSelection)
+    , mFilter(settings.filter)
+    , mBytesPerPixel((kind == PngKind::Height) ? 2 : 3)
+    , mPrevRow(w * mBytesPerPixel)
+    , mFilteredRow(1 + (w * mBytesPerPixel))
+    , mCandidateRow(1 + (w * mBytesPerPixel))
+    , mDeflate(threadPool,
+               settings.attempts,
+               [this](const uint8_t* data, size_t size) {
+                 WriteImageData(data, size);
+               })
   {
+    if (mFilterSelection == FilterSelection::Trial) {
+
+      // The lower levels misjudge the smoothest terrains, where rows only
+      // compress to a few bytes.
+      auto ret = deflateInit2(&mTrialStream,
+                              Z_DEFAULT_COMPRESSION,
+                              Z_DEFLATED,
+                              -15,
+                              8,
+                              Z_DEFAULT_STRATEGY);
+
+      if (ret != Z_OK)
+        mFilterSelection = FilterSelection::MinimumSum;
+    }
+
     if (!mFile)
       return;
 
@@ -46,8 +244,6 @@ public:
 
     png_init_io(mPng, mFile);
 
-    png_set_compression_level(mPng, Z_BEST_COMPRESSION);
-
     auto bits = (kind == PngKind::Height) ? 16 : 8;
 
     auto colorType =
@@ -64,44 +260,214 @@ public:
                  PNG_FILTER_TYPE_DEFAULT);
 
     png_write_info(mPng, mPngInfo);
+
+    mGood = true;
   }
 
   ~PngRowStream()
   {
-    if (mFile && mPng && mPngInfo) {
-      EndWrite();
-    }
+    // Missing rows would decode as zeros, so an image is only completed
+    // once all of its rows are written.
+    auto complete = mGood && (mRowsWritten == mHeight) && EndWrite();
 
     if (mPng)
       png_destroy_write_struct(&mPng, &mPngInfo);
 
-    if (mFile)
+    if (mFilterSelection == FilterSelection::Trial)
+      deflateEnd(&mTrialStream);
+
+    if (mFile) {
+
       fclose(mFile);
+
+      if (!complete) {
+        std::error_code errorCode;
+        std::filesystem::remove(mPath, errorCode);
+      }
+    }
   }
 
   void WriteRow(const unsigned char* data)
   {
-    if (setjmp(png_jmpbuf(mPng)))
+    if (!mGood)
       return;
 
-    png_write_row(mPng, data);
+    auto size = mPrevRow.size();
+
+    const auto* prev = mPrevRow.data();
+
+    if (mFilterSelection == FilterSelection::Fixed) {
+      mFilteredRow[0] = uint8_t(mFilter);
+      FilterRow(mFilter, data, prev, size, mBytesPerPixel, &mFilteredRow[1]);
+    } else {
+      FilterAdaptive(data, size);
+    }
+
+    mDeflate.Write(mFilteredRow.data(), mFilteredRow.size());
+
+    if (mFilterSelection == FilterSelection::Trial)
+      AppendToWindow(mFilteredRow);
+
+    std::copy(data, data + size, mPrevRow.begin());
+
+    mRowsWritten++;
   }
 
 private:
-  void EndWrite()
+  /// Filters @p data with each filter type, keeping the best result in the
+  /// filtered row.
+  void FilterAdaptive(const unsigned char* data, size_t size)
   {
-    if (setjmp(png_jmpbuf(mPng)))
+    size_t bestCost = std::numeric_limits<size_t>::max();
+
+    for (auto type : { FilterType::None,
+                       FilterType::Sub,
+                       FilterType::Up,
+                       FilterType::Average,
+                       FilterType::Paeth }) {
+
+      auto* candidate = mCandidateRow.data();
+
+      const auto* prev = mPrevRow.data();
+
+      FilterRow(type, data, prev, size, mBytesPerPixel, candidate + 1);
+
+      auto cost = (mFilterSelection == FilterSelection::Trial)
+                    ? GetTrialCost(candidate, size + 1)
+                    : FilterCost(candidate + 1, size);
+
+      if (cost < bestCost) {
+        bestCost = cost;
+        candidate[0] = uint8_t(type);
+        mCandidateRow.swap(mFilteredRow);
+      }
+    }
+  }
+
+  /// @return The size of @p row once compressed, with the rows before it as
+  /// the dictionary.
+  auto GetTrialCost(const uint8_t* row, size_t size) -> size_t
+  {
+    deflateReset(&mTrialStream);
+
+    auto windowSize = std::min(mWindow.size(), WindowSize());
+
+    if (windowSize > 0) {
+      const auto* window = mWindow.data() + (mWindow.size() - windowSize);
+      deflateSetDictionary(&mTrialStream, window, uInt(windowSize));
+    }
+
+    mTrialOutput.resize(deflateBound(&mTrialStream, uLong(size)));
+
+    mTrialStream.next_in = const_cast<Bytef*>(row);
+    mTrialStream.avail_in = uInt(size);
+    mTrialStream.next_out = mTrialOutput.data();
+    mTrialStream.avail_out = uInt(mTrialOutput.size());
+
+    deflate(&mTrialStream, Z_FINISH);
+
+    return mTrialStream.total_out;
+  }
+
+  /// Keeps the end of the filtered data, for @ref GetTrialCost.
+  void AppendToWindow(const std::vector<uint8_t>& row)
+  {
+    mWindow.insert(mWindow.end(), row.begin(), row.end());
+
+    // Trimmed once it is twice as large as needed, so that the data is not
+    // moved for every row.
+    if (mWindow.size() > (WindowSize() * 2)) {
+      auto excess = mWindow.size() - WindowSize();
+      mWindow.erase(mWindow.begin(), mWindow.begin() + excess);
+    }
+  }
+
+  /// The size of the deflate window.
+  static constexpr size_t WindowSize() noexcept { return 32 * 1024; }
+
+  void WriteImageData(const uint8_t* data, size_t size)
+  {
+    mImageData.insert(mImageData.end(), data, data + size);
+
+    if (mImageData.size() >= MaxChunkSize())
+      FlushImageData();
+  }
+
+  void FlushImageData()
+  {
+    if (!mImageData.empty())
+      WriteChunk("IDAT", mImageData.data(), mImageData.size());
+
+    mImageData.clear();
+  }
+
+  void WriteChunk(const char* name, const uint8_t* data, size_t size)
+  {
+    if (setjmp(png_jmpbuf(mPng))) {
+      mGood = false;
       return;
+    }
 
-    png_write_end(mPng, mPngInfo);
+    png_write_chunk(mPng, (png_const_bytep)name, data, size);
   }
 
+  /// @return True if the image was written in full.
+  bool EndWrite()
+  {
+    if (!mDeflate.Finish())
+      return false;
+
+    FlushImageData();
+
+    WriteChunk("IEND", nullptr, 0);
+
+    return mGood;
+  }
+
+  static constexpr size_t MaxChunkSize() noexcept { return 1024 * 1024; }
+
 private:
+  std::string mPath;
+
   FILE* mFile = nullptr;
 
+  size_t mHeight;
+
+  size_t mRowsWritten = 0;
+
   png_structp mPng = nullptr;
 
   png_infop mPngInfo = nullptr;
+
+  FilterSelection mFilterSelection;
+
+  FilterType mFilter;
+
+  size_t mBytesPerPixel;
+
+  std::vector<uint8_t> mPrevRow;
+
+  /// The filter type followed by the filtered row, for the best filter so
+  /// far.
+  std::vector<uint8_t> mFilteredRow;
+
+  /// Same as the filtered row, for the filter being tried.
+  std::vector<uint8_t> mCandidateRow;
+
+  /// Compressed data waiting to be written in an IDAT chunk.
+  std::vector<uint8_t> mImageData;
+
+  /// Used to try out the filters of each row, see @ref GetTrialCost.
+  z_stream mTrialStream{};
+
+  std::vector<uint8_t> mTrialOutput;
+
+  /// The end of the filtered data so far.
+  std::vector<uint8_t> mWindow;
+
+  ParallelDeflate mDeflate;
+
+  bool mGood = false;
 };
 
 class PngWriterImpl final : public PngWriter
@@ -110,48 +476,148 @@ public:
   PngWriterImpl(size_t w,
                 size_t h,
                 const char* heightPath,
-                const char* colorPath)
+                const char* colorPath,
+                PngProfile profile)
     : mWidth(w)
     , mHeight(h)
-    , mHeightStream(heightPath, w, h, PngKind::Height)
-    , mColorStream(colorPath, w, h, PngKind::Color)
+    , mHeightStream(mThreadPool,
+                    heightPath,
+                    w,
+                    h,
+                    PngKind::Height,
+                    GetCompressionSettings(profile, PngKind::Height))
+    , mColorStream(mThreadPool,
+                   colorPath,
+                   w,
+                   h,
+                   PngKind::Color,
+                   GetCompressionSettings(profile, PngKind::Color))
     , mHeightBuffer16Bit(w * 2)
     , mColorBuffer(w * 3)
+    , mSpillPath(std::string(heightPath) + ".spill")
   {}
 
-  void Observe(const float* heightAndRgbData) override
+  ~PngWriterImpl()
   {
-    auto heightRange = mHeightMax - mHeightMin;
+    // The export was not completed, so the height file is removed along
+    // with the spill file.
+    if (mSpill) {
+      mSpill.reset();
+      std::error_code errorCode;
+      std::filesystem::remove(mSpillPath, errorCode);
+    }
+  }
 
+  void Observe(const float* heightAndRgbData) override
+  {
     for (size_t i = 0; i < mWidth; i++) {
-
-      auto height = (heightAndRgbData[i * 4] - mHeightMin) / heightRange;
-
-      auto height16 = uint16_t(height * std::numeric_limits<uint16_t>::max());
-
-      mHeightBuffer16Bit[(i * 2) + 0] = height16 >> 8;
-      mHeightBuffer16Bit[(i * 2) + 1] = height16 >> 0;
-
       mColorBuffer[(i * 3) + 0] = heightAndRgbData[(i * 4) + 1];
       mColorBuffer[(i * 3) + 1] = heightAndRgbData[(i * 4) + 2];
       mColorBuffer[(i * 3) + 2] = heightAndRgbData[(i * 4) + 3];
     }
 
-    mHeightStream.WriteRow(mHeightBuffer16Bit.data());
-
     mColorStream.WriteRow(mColorBuffer.data());
+
+    if (mSpill)
+      SpillHeights(heightAndRgbData);
+    else
+      WriteHeightRow(heightAndRgbData, 4);
+
+    mRowsObserved++;
+
+    if (mSpill && (mRowsObserved == mHeight))
+      WriteSpilledHeights();
   }
 
-  void SetHeightRange(float min, float max)
+  void SetHeightRange(float min, float max) override
   {
     mHeightMin = min;
     mHeightMax = max;
   }
 
+  bool EnableAutoHeightRange() override
+  {
+    if (mRowsObserved > 0)
+      return false;
+
+    auto spill = std::make_unique<MappedFile>();
+
+    if (!spill->Open(mSpillPath.c_str(), mWidth * mHeight * sizeof(float)))
+      return false;
+
+    mSpill = std::move(spill);
+
+    mObservedMin = std::numeric_limits<float>::infinity();
+
+    mObservedMax = -std::numeric_limits<float>::infinity();
+
+    return true;
+  }
+
 private:
-  static float Clamp(float x, float min, float max) noexcept
+  /// Quantizes a row of heights to 16 bits and writes it. Heights outside
+  /// of the range are clamped to it, and NaN maps to the bottom of it.
+  ///
+  /// @param stride The distance between consecutive heights in @p heights.
+  void WriteHeightRow(const float* heights, size_t stride)
   {
-    return std::min(std::max(x, min), max);
+    for (size_t i = 0; i < mWidth; i++) {
+
+      auto height16 =
+        QuantizeHeight(heights[i * stride], mHeightMin, mHeightMax);
+
+      mHeightBuffer16Bit[(i * 2) + 0] = height16 >> 8;
+      mHeightBuffer16Bit[(i * 2) + 1] = height16 >> 0;
+    }
+
+    mHeightStream.WriteRow(mHeightBuffer16Bit.data());
+  }
+
+  /// Keeps the heights of a row until the range is known, tracking the
+  /// smallest and largest height as rows come in.
+  void SpillHeights(const float* heightAndRgbData)
+  {
+    auto* dst = (float*)mSpill->GetData() + (mRowsObserved * mWidth);
+
+    auto min = mObservedMin;
+    auto max = mObservedMax;
+
+    for (size_t i = 0; i < mWidth; i++) {
+
+      auto height = heightAndRgbData[i * 4];
+
+      dst[i] = height;
+
+      // Comparisons with NaN are false, so NaN does not affect the range.
+      min = (height < min) ? height : min;
+      max = (height > max) ? height : max;
+    }
+
+    mObservedMin = min;
+    mObservedMax = max;
+  }
+
+  void WriteSpilledHeights()
+  {
+    if (mObservedMin < mObservedMax) {
+      mHeightMin = mObservedMin;
+      mHeightMax = mObservedMax;
+    } else if (mObservedMin == mObservedMax) {
+      // A flat terrain, which ends up at the bottom of the range.
+      mHeightMin = mObservedMin;
+      mHeightMax = mObservedMin + 1.0f;
+    }
+
+    const auto* heights = (const float*)mSpill->GetData();
+
+    for (size_t y = 0; y < mHeight; y++)
+      WriteHeightRow(heights + (y * mWidth), 1);
+
+    mSpill.reset();
+
+    std::error_code errorCode;
+
+    std::filesystem::remove(mSpillPath, errorCode);
   }
 
 private:
@@ -159,6 +625,10 @@ private:
 
   size_t mHeight;
 
+  /// Shared by both streams and with the line interpreter, so that an
+  /// export does not run more threads than there are cores.
+  thread_pool& mThreadPool = GetSharedThreadPool();
+
   PngRowStream mHeightStream;
 
   PngRowStream mColorStream;
@@ -170,6 +640,18 @@ private:
   std::vector<uint8_t> mHeightBuffer16Bit;
 
   std::vector<uint8_t> mColorBuffer;
+
+  size_t mRowsObserved = 0;
+
+  /// Where the heights are kept until the range is known. The spill file is
+  /// mapped, so the operating system can page it out for large exports.
+  std::string mSpillPath;
+
+  std::unique_ptr<MappedFile> mSpill;
+
+  float mObservedMin = 0;
+
+  float mObservedMax = 0;
 };
 
 } // namespace
@@ -178,11 +660,12 @@ auto
 PngWriter::Make(size_t w,
                 size_t h,
                 const char* heightPath,
-                const char* colorPath) -> std::unique_ptr<PngWriter>
+                const char* colorPath,
+                PngProfile profile) -> std::unique_ptr<PngWriter>
 {
   using Ret = std::unique_ptr<PngWriter>;
 
-  return Ret(new PngWriterImpl(w, h, heightPath, colorPath));
+  return Ret(new PngWriterImpl(w, h, heightPath, colorPath, profile));
 }
 
 } // namespace terra
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <limits>
+
+#include <math.h>
+#include <stdint.h>
+
+namespace terra {
+
+/// @brief Maps a height to a 16-bit value, with @p min mapping to zero and
+/// @p max to the largest value. Used by every writer of 16-bit heights, so
+/// that the formats of an export hold the same values.
+///
+/// @details Heights outside of the range are clamped and NaN maps to zero.
+/// The result is rounded to the nearest value.
+inline auto
+QuantizeHeight(float height, float min, float max) noexcept -> uint16_t
+{
+  auto t = (height - min) / (max - min);
+
+  // Also maps NaN to zero, since converting it is undefined.
+  t = (t > 0.0f) ? ((t < 1.0f) ? t : 1.0f) : 0.0f;
+
+  return uint16_t(lrintf(t * std::numeric_limits<uint16_t>::max()));
+}
+
+} // namespace terra
@@ -0,0 +1,169 @@
+#include <terra/raw_writer.h>
+
+#include <filesystem>
+#include <string>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mapped_file.h"
+#include "quantize.h"
+
+namespace terra {
+
+namespace {
+
+constexpr size_t
+Float32HeaderSize() noexcept
+{
+  return 16;
+}
+
+/// Stores @p value in little-endian byte order, whatever the byte order of
+/// the host is.
+void
+StoreLE16(uint8_t* dst, uint16_t value) noexcept
+{
+  dst[0] = uint8_t(value);
+  dst[1] = uint8_t(value >> 8);
+}
+
+void
+StoreLE32(uint8_t* dst, uint32_t value) noexcept
+{
+  dst[0] = uint8_t(value);
+  dst[1] = uint8_t(value >> 8);
+  dst[2] = uint8_t(value >> 16);
+  dst[3] = uint8_t(value >> 24);
+}
+
+class RawWriterImpl final : public RawWriter
+{
+public:
+  RawWriterImpl(size_t w, size_t h, RawFormat format)
+    : mWidth(w)
+    , mHeight(h)
+    , mFormat(format)
+  {}
+
+  ~RawWriterImpl()
+  {
+    // Rows that were never observed would read as zeros, so an export that
+    // was cancelled or failed does not leave a file that looks complete.
+    if (mPath.empty() || (mRow == mHeight))
+      return;
+
+    mFile.Close();
+
+    std::error_code errorCode;
+
+    std::filesystem::remove(mPath, errorCode);
+  }
+
+  /// @return True on success, false if the file could not be mapped.
+  bool Open(const char* path)
+  {
+    auto headerSize = (mFormat == RawFormat::Float32) ? Float32HeaderSize() : 0;
+
+    if (!mFile.Open(path, headerSize + (mHeight * GetRowSize())))
+      return false;
+
+    mPath = path;
+
+    if (mFormat == RawFormat::Float32) {
+      auto* header = mFile.GetData();
+      memcpy(header, "TRHM", 4);
+      StoreLE32(header + 4, 1);
+      StoreLE32(header + 8, uint32_t(mWidth));
+      StoreLE32(header + 12, uint32_t(mHeight));
+    }
+
+    return true;
+  }
+
+  void Observe(const float* heightAndRgbData) override
+  {
+    if (mRow >= mHeight)
+      return;
+
+    auto* dst = GetRowPtr(mRow);
+
+    if (mFormat == RawFormat::Float32) {
+      for (size_t x = 0; x < mWidth; x++) {
+        uint32_t bits = 0;
+        memcpy(&bits, &heightAndRgbData[x * 4], sizeof(bits));
+        StoreLE32(dst + (x * 4), bits);
+      }
+    } else {
+      for (size_t x = 0; x < mWidth; x++) {
+        auto height =
+          QuantizeHeight(heightAndRgbData[x * 4], mHeightMin, mHeightMax);
+        StoreLE16(dst + (x * 2), height);
+      }
+    }
+
+    mRow++;
+  }
+
+  void SetHeightRange(float min, float max) override
+  {
+    mHeightMin = min;
+    mHeightMax = max;
+  }
+
+private:
+  auto GetRowSize() const noexcept -> size_t
+  {
+    return mWidth * ((mFormat == RawFormat::Float32) ? 4 : 2);
+  }
+
+  auto GetRowPtr(size_t row) noexcept -> uint8_t*
+  {
+    switch (mFormat) {
+      case RawFormat::R16:
+        break;
+      case RawFormat::UnityRaw:
+        return mFile.GetData() + ((mHeight - 1 - row) * GetRowSize());
+      case RawFormat::Float32:
+        return mFile.GetData() + Float32HeaderSize() + (row * GetRowSize());
+    }
+
+    return mFile.GetData() + (row * GetRowSize());
+  }
+
+private:
+  size_t mWidth;
+
+  size_t mHeight;
+
+  RawFormat mFormat;
+
+  MappedFile mFile;
+
+  /// Set once the file is created, so that it can be removed if not all of
+  /// the rows are observed.
+  std::string mPath;
+
+  /// The index of the next row to be observed.
+  size_t mRow = 0;
+
+  float mHeightMin = 0;
+
+  float mHeightMax = 1;
+};
+
+} // namespace
+
+auto
+RawWriter::Make(size_t w, size_t h, const char* path, RawFormat format)
+  -> std::unique_ptr<RawWriter>
+{
+  std::unique_ptr<RawWriterImpl> writer(new RawWriterImpl(w, h, format));
+
+  if (!writer->Open(path))
+    return nullptr;
+
+  return writer;
+}
+
+} // namespace terra
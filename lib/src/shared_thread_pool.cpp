@@ -0,0 +1,13 @@
+#include "shared_thread_pool.h"
+
+namespace terra {
+
+auto
+GetSharedThreadPool() -> thread_pool&
+{
+  static thread_pool threadPool;
+
+  return threadPool;
+}
+
+} // namespace terra
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <thread_pool.hpp>
+
+namespace terra {
+
+/// @brief Gets the thread pool that the interpreters and writers run their
+/// tasks on, with one thread per hardware thread.
+///
+/// @details An export renders rows and compresses them at the same time, so
+/// sharing one pool keeps it from running more busy threads than there are
+/// cores. Tasks must never wait for other tasks of the pool, since those
+/// may be queued behind them.
+auto
+GetSharedThreadPool() -> thread_pool&;
+
+} // namespace terra
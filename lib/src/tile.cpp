@@ -2,10 +2,24 @@
 
 namespace terra {
 
+Tile::Tile(size_t offsetX,
+           size_t offsetY,
+           size_t width,
+           size_t height,
+           bool hasColor)
+  : mOffsetX(offsetX)
+  , mOffsetY(offsetY)
+  , mWidth(width)
+  , mHeight(height)
+{
+  if (hasColor)
+    mColorPlanes.reset(new ColorPlanes());
+}
+
 float
 Tile::GetHeightAt(size_t x, size_t y) const noexcept
 {
-  return mBuffer[((y * mWidth) + x) * 4];
+  return mHeightPlane[(y * mWidth) + x];
 }
 
 bool
@@ -0,0 +1,77 @@
+#include "tile_pool.h"
+
+#include <new>
+
+namespace terra {
+
+auto
+TilePool::Make(size_t maxFreeCount) -> std::shared_ptr<TilePool>
+{
+  return std::shared_ptr<TilePool>(new TilePool(maxFreeCount));
+}
+
+TilePool::TilePool(size_t maxFreeCount)
+  : mMaxFreeCount(maxFreeCount)
+{
+  mFree.reserve(maxFreeCount);
+}
+
+TilePool::~TilePool()
+{
+  for (auto* storage : mFree)
+    Free(storage);
+}
+
+auto
+TilePool::Acquire(size_t offsetX, size_t offsetY, size_t width, size_t height)
+  -> std::shared_ptr<Tile>
+{
+  void* storage = nullptr;
+
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (!mFree.empty()) {
+      storage = mFree.back();
+      mFree.pop_back();
+    }
+  }
+
+  if (!storage)
+    storage = ::operator new(sizeof(Tile), std::align_val_t(alignof(Tile)));
+
+  // Constructing a tile does not touch its buffer, so recycled pages stay
+  // resident and new ones are only faulted in when they are rendered to.
+  auto* tile = new (storage) Tile(offsetX, offsetY, width, height);
+
+  auto pool = shared_from_this();
+
+  return std::shared_ptr<Tile>(tile, [pool](Tile* t) { pool->Release(t); });
+}
+
+void
+TilePool::Release(Tile* tile) noexcept
+{
+  tile->~Tile();
+
+  void* storage = tile;
+
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    if (mFree.size() < mMaxFreeCount) {
+      mFree.emplace_back(storage);
+      return;
+    }
+  }
+
+  Free(storage);
+}
+
+void
+TilePool::Free(void* storage) noexcept
+{
+  ::operator delete(storage, std::align_val_t(alignof(Tile)));
+}
+
+} // namespace terra
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <terra/tile.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <stddef.h>
+
+namespace terra {
+
+/// Recycles the memory of tiles, so that the planes of a tile do not have to
+/// be allocated (and page faulted in) again for every tile.
+class TilePool final : public std::enable_shared_from_this<TilePool>
+{
+public:
+  /// @param maxFreeCount The number of unused tiles kept for reuse. Tiles
+  /// released beyond that are freed.
+  static auto Make(size_t maxFreeCount) -> std::shared_ptr<TilePool>;
+
+  ~TilePool();
+
+  /// @return A tile with an uninitialized buffer. Once the last reference to
+  /// it is dropped, its memory returns to the pool. The pool is kept alive
+  /// until then.
+  auto Acquire(size_t offsetX, size_t offsetY, size_t width, size_t height)
+    -> std::shared_ptr<Tile>;
+
+private:
+  TilePool(size_t maxFreeCount);
+
+  void Release(Tile* tile) noexcept;
+
+  static void Free(void* storage) noexcept;
+
+private:
+  size_t mMaxFreeCount;
+
+  std::mutex mMutex;
+
+  /// Storage for tiles that are not in use.
+  std::vector<void*> mFree;
+};
+
+} // namespace terra
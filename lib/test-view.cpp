@@ -202,9 +202,9 @@ public:
     : mTerrainView(terrainView)
   {}
 
-  void Observe(const terra::Tile& tile) override
+  void Observe(const std::shared_ptr<const terra::Tile>& tile) override
   {
-    mTerrainView.RenderTile(tile);
+    mTerrainView.RenderTile(*tile);
   }
 
 private:
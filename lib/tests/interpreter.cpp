@@ -0,0 +1,274 @@
+#include <gtest/gtest.h>
+
+#include <terra/cancellation_token.h>
+#include <terra/interpreter.h>
+#include <terra/line_observer.h>
+#include <terra/tile.h>
+#include <terra/tile_observer.h>
+
+#include <terra/exprs/binary.h>
+#include <terra/exprs/literals.h>
+#include <terra/exprs/unary.h>
+#include <terra/exprs/var_ref.h>
+#include <terra/exprs/vector_combiner.h>
+
+#include <array>
+#include <limits>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <stddef.h>
+
+namespace {
+
+using SharedExprPtr = std::shared_ptr<terra::Expr>;
+
+/// Not a multiple of the tile size, so that the tiles on the right and
+/// bottom edges are partial.
+const size_t gWidth = 600;
+
+const size_t gHeight = 400;
+
+/// @return sin(u * 3) * cos(v * 3)
+auto
+MakeHeightExpr() -> SharedExprPtr
+{
+  using ID = terra::BinaryExpr::ID;
+
+  using UnaryID = terra::UnaryExpr::ID;
+
+  SharedExprPtr u(new terra::VarRefExpr(terra::VarRefExpr::ID::CenterU));
+  SharedExprPtr v(new terra::VarRefExpr(terra::VarRefExpr::ID::CenterV));
+
+  SharedExprPtr three(new terra::LiteralExpr<float>(3));
+
+  SharedExprPtr u3(new terra::BinaryExpr(ID::Mul, u, three));
+  SharedExprPtr v3(new terra::BinaryExpr(ID::Mul, v, three));
+
+  SharedExprPtr sinU(new terra::UnaryExpr(UnaryID::Sine, u3));
+  SharedExprPtr cosV(new terra::UnaryExpr(UnaryID::Cosine, v3));
+
+  return SharedExprPtr(new terra::BinaryExpr(ID::Mul, sinU, cosV));
+}
+
+/// Keeps the heights of the tiles of level zero, and the order of the
+/// levels each part of the image was observed at.
+class ImageObserver final : public terra::TileObserver
+{
+public:
+  void Observe(const std::shared_ptr<const terra::Tile>& tile) override
+  {
+    auto offset = std::make_pair(tile->GetOffsetX(), tile->GetOffsetY());
+
+    mLevels[offset].emplace_back(tile->GetLevel());
+
+    if (tile->GetLevel() != 0)
+      return;
+
+    for (size_t y = 0; y < tile->GetHeight(); y++) {
+
+      const auto* line = tile->GetHeightLinePtr(y);
+
+      auto* dst = &mImage[((tile->GetOffsetY() + y) * gWidth)];
+
+      for (size_t x = 0; x < tile->GetWidth(); x++)
+        dst[tile->GetOffsetX() + x] = line[x];
+    }
+  }
+
+  auto GetImage() const noexcept -> const std::vector<float>&
+  {
+    return mImage;
+  }
+
+  auto GetLevels() const noexcept
+    -> const std::map<std::pair<size_t, size_t>, std::vector<size_t>>&
+  {
+    return mLevels;
+  }
+
+private:
+  /// NaN never compares equal, so images with missing values never do.
+  std::vector<float> mImage = std::vector<float>(
+    gWidth * gHeight,
+    std::numeric_limits<float>::quiet_NaN());
+
+  std::map<std::pair<size_t, size_t>, std::vector<size_t>> mLevels;
+};
+
+auto
+RenderFrame(bool progressive) -> std::shared_ptr<ImageObserver>
+{
+  auto observer = std::make_shared<ImageObserver>();
+
+  auto interpreter = terra::TileInterpreter::Make();
+
+  interpreter->AddTileObserver(observer);
+
+  EXPECT_TRUE(interpreter->SetHeightExpr(*MakeHeightExpr()));
+
+  interpreter->SetResolution(gWidth, gHeight);
+
+  interpreter->SetProgressive(progressive);
+
+  EXPECT_TRUE(interpreter->BeginFrame());
+
+  while (interpreter->TilesRemaining() > 0)
+    interpreter->PollTiles(10);
+
+  EXPECT_EQ(interpreter->TilesSkipped(), 0);
+
+  EXPECT_TRUE(interpreter->EndFrame());
+
+  return observer;
+}
+
+/// Odd, so that the rows do not split evenly into bands.
+const size_t gLineWidth = 37;
+
+const size_t gLineHeight = 101;
+
+/// @return v + (sin(u * 3) * cos(v * 3) / 4), which grows with v in every
+/// column, so rows observed out of order are noticed.
+auto
+MakeLineHeightExpr() -> SharedExprPtr
+{
+  using ID = terra::BinaryExpr::ID;
+
+  SharedExprPtr v(new terra::VarRefExpr(terra::VarRefExpr::ID::CenterV));
+
+  SharedExprPtr quarter(new terra::LiteralExpr<float>(0.25f));
+
+  SharedExprPtr wave(new terra::BinaryExpr(ID::Mul, MakeHeightExpr(), quarter));
+
+  return SharedExprPtr(new terra::BinaryExpr(ID::Add, v, wave));
+}
+
+auto
+MakeColorExpr() -> SharedExprPtr
+{
+  std::array<SharedExprPtr, 3> elements;
+
+  for (auto& element : elements)
+    element.reset(new terra::LiteralExpr<float>(0.5f));
+
+  return SharedExprPtr(new terra::VectorCombiner<3>(std::move(elements)));
+}
+
+/// Keeps every row it observes, and cancels a token after a number of rows.
+class RowObserver final : public terra::LineObserver
+{
+public:
+  void Observe(const float* heightAndRgbData) override
+  {
+    mRows.emplace_back(heightAndRgbData, heightAndRgbData + (gLineWidth * 4));
+
+    if (mToken && (mRows.size() == mCancelAfter))
+      mToken->Cancel();
+  }
+
+  void CancelAfter(size_t rowCount, terra::CancellationToken& token)
+  {
+    mCancelAfter = rowCount;
+
+    mToken = &token;
+  }
+
+  auto GetRows() const noexcept -> const std::vector<std::vector<float>>&
+  {
+    return mRows;
+  }
+
+private:
+  std::vector<std::vector<float>> mRows;
+
+  size_t mCancelAfter = 0;
+
+  terra::CancellationToken* mToken = nullptr;
+};
+
+auto
+MakeLineInterpreter(RowObserver& observer, size_t rowsInFlight)
+  -> std::unique_ptr<terra::LineInterpreter>
+{
+  auto interpreter =
+    terra::LineInterpreter::Make(gLineWidth, gLineHeight, observer);
+
+  EXPECT_TRUE(interpreter->SetHeightExpr(*MakeLineHeightExpr()));
+
+  EXPECT_TRUE(interpreter->SetColorExpr(*MakeColorExpr()));
+
+  interpreter->SetRowsInFlight(rowsInFlight);
+
+  return interpreter;
+}
+
+} // namespace
+
+TEST(TileInterpreter, ProgressiveLevelZeroMatchesFullFrame)
+{
+  auto full = RenderFrame(false);
+
+  auto progressive = RenderFrame(true);
+
+  EXPECT_EQ(full->GetLevels().size(), progressive->GetLevels().size());
+
+  // Exactly equal, since the values each pass computes are computed the
+  // same way as in a frame that is not progressive.
+  EXPECT_EQ(full->GetImage(), progressive->GetImage());
+}
+
+TEST(TileInterpreter, ProgressiveTilesGoFromCoarseToFine)
+{
+  auto progressive = RenderFrame(true);
+
+  std::vector<size_t> expected{ 2, 1, 0 };
+
+  for (const auto& entry : progressive->GetLevels())
+    EXPECT_EQ(entry.second, expected);
+}
+
+TEST(LineInterpreter, RowsArriveInOrderAndMatchOneRowAtATime)
+{
+  RowObserver single;
+
+  EXPECT_TRUE(MakeLineInterpreter(single, 1)->Execute());
+
+  RowObserver banded;
+
+  auto interpreter = MakeLineInterpreter(banded, 3);
+
+  EXPECT_TRUE(interpreter->Execute());
+
+  EXPECT_EQ(interpreter->RowsObserved(), gLineHeight);
+
+  ASSERT_EQ(banded.GetRows().size(), gLineHeight);
+
+  EXPECT_EQ(banded.GetRows(), single.GetRows());
+
+  const auto& rows = banded.GetRows();
+
+  for (size_t y = 1; y < gLineHeight; y++) {
+    for (size_t x = 0; x < gLineWidth; x++)
+      EXPECT_LT(rows[y - 1][x * 4], rows[y][x * 4]) << "x=" << x << " y=" << y;
+  }
+}
+
+TEST(LineInterpreter, CancelStopsExecute)
+{
+  terra::CancellationToken token;
+
+  RowObserver observer;
+
+  observer.CancelAfter(10, token);
+
+  auto interpreter = MakeLineInterpreter(observer, 3);
+
+  EXPECT_FALSE(interpreter->Execute(&token));
+
+  EXPECT_LT(interpreter->RowsObserved(), gLineHeight);
+
+  EXPECT_EQ(interpreter->RowsObserved(), observer.GetRows().size());
+}
@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+
+#include "mpsc_queue.h"
+
+#include <thread>
+#include <vector>
+
+#include <stddef.h>
+
+namespace {
+
+struct Item final
+{
+  size_t producer = 0;
+
+  size_t index = 0;
+};
+
+} // namespace
+
+TEST(MpscQueue, PopsInPushOrder)
+{
+  terra::MpscQueue<int> queue(3);
+
+  // The capacity is rounded up to four.
+  for (int i = 0; i < 4; i++)
+    ASSERT_TRUE(queue.TryPush(i));
+
+  int rejected = 4;
+
+  EXPECT_FALSE(queue.TryPush(rejected));
+
+  EXPECT_EQ(rejected, 4);
+
+  for (int i = 0; i < 4; i++) {
+    int item = -1;
+    ASSERT_TRUE(queue.TryPop(item));
+    EXPECT_EQ(item, i);
+  }
+
+  int item = -1;
+
+  EXPECT_FALSE(queue.TryPop(item));
+
+  EXPECT_TRUE(queue.Empty());
+}
+
+TEST(MpscQueue, LosesNoItemUnderContention)
+{
+  const size_t producerCount = 4;
+
+  const size_t itemsPerProducer = 100000;
+
+  // Small enough that the producers often find the queue full.
+  terra::MpscQueue<Item> queue(16);
+
+  std::vector<std::thread> producers;
+
+  for (size_t p = 0; p < producerCount; p++) {
+    producers.emplace_back([&queue, p]() {
+      for (size_t i = 0; i < itemsPerProducer; i++) {
+        Item item{ p, i };
+        while (!queue.TryPush(item))
+          std::this_thread::yield();
+      }
+    });
+  }
+
+  std::vector<Item> items;
+
+  items.reserve(producerCount * itemsPerProducer);
+
+  while (items.size() < (producerCount * itemsPerProducer)) {
+
+    Item item;
+
+    if (queue.TryPop(item))
+      items.emplace_back(item);
+    else
+      std::this_thread::yield();
+  }
+
+  for (auto& producer : producers)
+    producer.join();
+
+  EXPECT_TRUE(queue.Empty());
+
+  // Items of one producer come out in the order it pushed them.
+  std::vector<size_t> nextIndices(producerCount, 0);
+
+  for (const auto& item : items) {
+
+    ASSERT_LT(item.producer, producerCount);
+
+    ASSERT_EQ(item.index, nextIndices[item.producer]);
+
+    nextIndices[item.producer]++;
+  }
+
+  for (auto nextIndex : nextIndices)
+    EXPECT_EQ(nextIndex, itemsPerProducer);
+}
@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include "parallel_deflate.h"
+
+#include <random>
+#include <vector>
+
+#include <zlib.h>
+
+namespace {
+
+/// Random bytes, repeated within the 32 KiB window so that matches cross
+/// the boundaries of blocks.
+auto
+MakeInput(size_t size) -> std::vector<uint8_t>
+{
+  std::mt19937 rng(1234);
+
+  std::vector<uint8_t> pattern(20 * 1024);
+
+  for (auto& byte : pattern)
+    byte = uint8_t(rng() % 16);
+
+  std::vector<uint8_t> input(size);
+
+  for (size_t i = 0; i < size; i++)
+    input[i] = pattern[i % pattern.size()];
+
+  return input;
+}
+
+auto
+Compress(const std::vector<uint8_t>& input,
+         std::vector<terra::ParallelDeflate::Attempt> attempts)
+  -> std::vector<uint8_t>
+{
+  thread_pool threadPool(4);
+
+  std::vector<uint8_t> output;
+
+  terra::ParallelDeflate deflate(
+    threadPool, std::move(attempts), [&output](const uint8_t* data, size_t n) {
+      output.insert(output.end(), data, data + n);
+    });
+
+  // Writes of varying sizes, so that blocks fill up part way through them.
+  size_t offset = 0;
+
+  for (size_t n = 1; offset < input.size(); n = (n * 7) % 100003) {
+    auto size = std::min(n, input.size() - offset);
+    deflate.Write(input.data() + offset, size);
+    offset += size;
+  }
+
+  EXPECT_TRUE(deflate.Finish());
+
+  return output;
+}
+
+auto
+Uncompress(const std::vector<uint8_t>& compressed, size_t size)
+  -> std::vector<uint8_t>
+{
+  // One more byte than expected, to catch streams that decode to too much.
+  std::vector<uint8_t> output(size + 1);
+
+  auto outputSize = uLongf(output.size());
+
+  auto ret = uncompress(
+    output.data(), &outputSize, compressed.data(), uLong(compressed.size()));
+
+  EXPECT_EQ(ret, Z_OK);
+
+  output.resize(outputSize);
+
+  return output;
+}
+
+} // namespace
+
+TEST(ParallelDeflate, RoundTripsManyBlocks)
+{
+  // Several blocks of 128 KiB, and a partial one.
+  auto input = MakeInput((9 * 128 * 1024) + 1000);
+
+  auto compressed = Compress(input, { { 6, Z_DEFAULT_STRATEGY } });
+
+  // Far smaller than the random bytes alone, so blocks do match the data
+  // of the blocks before them.
+  EXPECT_LT(compressed.size(), input.size() / 50);
+
+  EXPECT_EQ(Uncompress(compressed, input.size()), input);
+}
+
+TEST(ParallelDeflate, RoundTripsWithSeveralAttempts)
+{
+  auto input = MakeInput((5 * 128 * 1024) + 1);
+
+  auto compressed = Compress(input,
+                             { { Z_BEST_COMPRESSION, Z_DEFAULT_STRATEGY },
+                               { Z_BEST_SPEED, Z_RLE },
+                               { 3, Z_FILTERED } });
+
+  EXPECT_EQ(Uncompress(compressed, input.size()), input);
+}
+
+TEST(ParallelDeflate, RoundTripsEmptyInput)
+{
+  std::vector<uint8_t> input;
+
+  auto compressed = Compress(input, { { 6, Z_DEFAULT_STRATEGY } });
+
+  EXPECT_EQ(Uncompress(compressed, 0), input);
+}
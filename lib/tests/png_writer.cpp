@@ -0,0 +1,294 @@
+#include <gtest/gtest.h>
+
+#include <terra/png_writer.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <math.h>
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace {
+
+namespace fs = std::filesystem;
+
+/// Not a multiple of any block size, so that partial blocks are written.
+const size_t gWidth = 301;
+
+const size_t gHeight = 257;
+
+/// The rows of a decoded image, as stored in the file, along with its format.
+struct Image final
+{
+  png_uint_32 w = 0;
+
+  png_uint_32 h = 0;
+
+  int bitDepth = 0;
+
+  int colorType = 0;
+
+  std::vector<uint8_t> data;
+
+  /// @return The 16-bit gray value at @p x and @p y.
+  auto GetGray16(size_t x, size_t y) const -> uint16_t
+  {
+    const auto* pixel = &data[((y * w) + x) * 2];
+
+    return uint16_t((pixel[0] << 8) | pixel[1]);
+  }
+};
+
+/// Decodes @p path without any transformation, so that the values are the
+/// ones that were written.
+auto
+ReadPng(const fs::path& path) -> Image
+{
+  Image image;
+
+  auto* file = fopen(path.string().c_str(), "rb");
+
+  EXPECT_NE(file, nullptr) << path;
+
+  if (!file)
+    return image;
+
+  auto* png =
+    png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+
+  auto* info = png_create_info_struct(png);
+
+  if (setjmp(png_jmpbuf(png))) {
+    ADD_FAILURE() << "libpng failed to decode " << path;
+    png_destroy_read_struct(&png, &info, nullptr);
+    fclose(file);
+    return Image();
+  }
+
+  png_init_io(png, file);
+
+  png_read_png(png, info, PNG_TRANSFORM_IDENTITY, nullptr);
+
+  image.w = png_get_image_width(png, info);
+
+  image.h = png_get_image_height(png, info);
+
+  image.bitDepth = png_get_bit_depth(png, info);
+
+  image.colorType = png_get_color_type(png, info);
+
+  auto rowSize = png_get_rowbytes(png, info);
+
+  auto** rows = png_get_rows(png, info);
+
+  for (png_uint_32 y = 0; y < image.h; y++)
+    image.data.insert(image.data.end(), rows[y], rows[y] + rowSize);
+
+  png_destroy_read_struct(&png, &info, nullptr);
+
+  fclose(file);
+
+  return image;
+}
+
+/// Makes a terrain that is smooth in places and noisy in others, so that the
+/// profiles pick different filters for different rows.
+auto
+MakeRows(float scale, float offset) -> std::vector<std::vector<float>>
+{
+  std::mt19937 rng(1234);
+
+  std::uniform_real_distribution<float> noise(-0.05f, 0.05f);
+
+  std::vector<std::vector<float>> rows(gHeight);
+
+  for (size_t y = 0; y < gHeight; y++) {
+
+    rows[y].resize(gWidth * 4);
+
+    for (size_t x = 0; x < gWidth; x++) {
+
+      auto u = (x + 0.5f) / gWidth;
+      auto v = (y + 0.5f) / gHeight;
+
+      auto height = sinf(u * 7.0f) * cosf(v * 5.0f);
+
+      if (x > (gWidth / 2))
+        height += noise(rng);
+
+      rows[y][(x * 4) + 0] = offset + (height * scale);
+      rows[y][(x * 4) + 1] = u;
+      rows[y][(x * 4) + 2] = v;
+      rows[y][(x * 4) + 3] = 0.5f;
+    }
+  }
+
+  return rows;
+}
+
+class PngWriterTest : public ::testing::Test
+{
+protected:
+  void TearDown() override
+  {
+    std::error_code errorCode;
+    fs::remove(mHeightPath, errorCode);
+    fs::remove(mColorPath, errorCode);
+  }
+
+  /// @param autoRange Whether to use the range of the heights, rather than
+  /// a range of [-1, 1].
+  ///
+  /// @param rowCount The number of rows to observe, all of them by default.
+  void Write(const std::vector<std::vector<float>>& rows,
+             terra::PngProfile profile,
+             bool autoRange,
+             size_t rowCount = gHeight)
+  {
+    auto writer = terra::PngWriter::Make(gWidth,
+                                         gHeight,
+                                         mHeightPath.string().c_str(),
+                                         mColorPath.string().c_str(),
+                                         profile);
+
+    ASSERT_NE(writer, nullptr);
+
+    if (autoRange)
+      ASSERT_TRUE(writer->EnableAutoHeightRange());
+    else
+      writer->SetHeightRange(-1.0f, 1.0f);
+
+    for (size_t y = 0; y < rowCount; y++) {
+
+      writer->Observe(rows[y].data());
+
+      // The heights are kept until the last row is observed.
+      if (y == 0) {
+        EXPECT_EQ(fs::exists(GetSpillPath()), autoRange);
+      }
+    }
+  }
+
+  auto GetSpillPath() const -> fs::path
+  {
+    return fs::path(mHeightPath).concat(".spill");
+  }
+
+protected:
+  fs::path mHeightPath = fs::temp_directory_path() / "terra_png_height.png";
+
+  fs::path mColorPath = fs::temp_directory_path() / "terra_png_color.png";
+};
+
+} // namespace
+
+TEST_F(PngWriterTest, ProfilesProduceTheSameImage)
+{
+  auto rows = MakeRows(1.0f, 0.0f);
+
+  Write(rows, terra::PngProfile::Archival, false);
+
+  auto expectedHeights = ReadPng(mHeightPath);
+
+  auto expectedColors = ReadPng(mColorPath);
+
+  ASSERT_EQ(expectedHeights.w, gWidth);
+  ASSERT_EQ(expectedHeights.h, gHeight);
+  EXPECT_EQ(expectedHeights.bitDepth, 16);
+  EXPECT_EQ(expectedHeights.colorType, PNG_COLOR_TYPE_GRAY);
+
+  ASSERT_EQ(expectedColors.w, gWidth);
+  ASSERT_EQ(expectedColors.h, gHeight);
+  EXPECT_EQ(expectedColors.colorType, PNG_COLOR_TYPE_RGB);
+
+  for (auto profile : { terra::PngProfile::Fastest,
+                        terra::PngProfile::Balanced,
+                        terra::PngProfile::Smallest }) {
+
+    SCOPED_TRACE(int(profile));
+
+    Write(rows, profile, false);
+
+    EXPECT_EQ(ReadPng(mHeightPath).data, expectedHeights.data);
+
+    EXPECT_EQ(ReadPng(mColorPath).data, expectedColors.data);
+  }
+}
+
+TEST_F(PngWriterTest, AutoRangeMapsMinAndMaxToFullRange)
+{
+  auto rows = MakeRows(4.0f, 1.0f);
+
+  Write(rows, terra::PngProfile::Fastest, true);
+
+  EXPECT_FALSE(fs::exists(GetSpillPath()));
+
+  auto image = ReadPng(mHeightPath);
+
+  ASSERT_EQ(image.w, gWidth);
+  ASSERT_EQ(image.h, gHeight);
+
+  size_t minPos = 0;
+  size_t maxPos = 0;
+
+  uint16_t minValue = 0xffff;
+  uint16_t maxValue = 0;
+
+  for (size_t i = 0; i < (gWidth * gHeight); i++) {
+
+    auto height = rows[i / gWidth][(i % gWidth) * 4];
+
+    if (height < rows[minPos / gWidth][(minPos % gWidth) * 4])
+      minPos = i;
+
+    if (height > rows[maxPos / gWidth][(maxPos % gWidth) * 4])
+      maxPos = i;
+
+    auto value = image.GetGray16(i % gWidth, i / gWidth);
+
+    minValue = std::min(minValue, value);
+    maxValue = std::max(maxValue, value);
+  }
+
+  EXPECT_EQ(image.GetGray16(minPos % gWidth, minPos / gWidth), 0);
+
+  EXPECT_EQ(image.GetGray16(maxPos % gWidth, maxPos / gWidth), 0xffff);
+
+  EXPECT_EQ(minValue, 0);
+
+  EXPECT_EQ(maxValue, 0xffff);
+}
+
+TEST_F(PngWriterTest, AutoRangeOfFlatTerrainIsZero)
+{
+  auto rows = MakeRows(0.0f, 3.0f);
+
+  Write(rows, terra::PngProfile::Fastest, true);
+
+  EXPECT_FALSE(fs::exists(GetSpillPath()));
+
+  auto image = ReadPng(mHeightPath);
+
+  ASSERT_EQ(image.data.size(), gWidth * gHeight * 2);
+
+  EXPECT_TRUE(std::all_of(
+    image.data.begin(), image.data.end(), [](uint8_t b) { return b == 0; }));
+}
+
+TEST_F(PngWriterTest, IncompleteExportRemovesFiles)
+{
+  auto rows = MakeRows(1.0f, 0.0f);
+
+  Write(rows, terra::PngProfile::Balanced, true, gHeight / 2);
+
+  EXPECT_FALSE(fs::exists(mHeightPath));
+
+  EXPECT_FALSE(fs::exists(mColorPath));
+
+  EXPECT_FALSE(fs::exists(GetSpillPath()));
+}
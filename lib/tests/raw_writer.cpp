@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+
+#include <terra/raw_writer.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+#include <string.h>
+
+namespace {
+
+const size_t gWidth = 3;
+
+const size_t gHeight = 2;
+
+/// Writes two rows of heights in @p format, with a height range of [0, 2].
+///
+/// @return The contents of the file.
+auto
+WriteRows(terra::RawFormat format) -> std::vector<uint8_t>
+{
+  auto nan = std::numeric_limits<float>::quiet_NaN();
+
+  const float heights[gHeight][gWidth]{ { 0.0f, 1.0f, 2.0f },
+                                        { 3.0f, -1.0f, nan } };
+
+  auto path = std::filesystem::temp_directory_path() / "terra_raw_test.raw";
+
+  {
+    auto writer =
+      terra::RawWriter::Make(gWidth, gHeight, path.string().c_str(), format);
+
+    EXPECT_NE(writer, nullptr);
+
+    if (!writer)
+      return {};
+
+    writer->SetHeightRange(0.0f, 2.0f);
+
+    for (size_t y = 0; y < gHeight; y++) {
+
+      // The color is ignored.
+      std::vector<float> row(gWidth * 4, 0.5f);
+
+      for (size_t x = 0; x < gWidth; x++)
+        row[x * 4] = heights[y][x];
+
+      writer->Observe(row.data());
+    }
+  }
+
+  std::ifstream file(path, std::ios::binary);
+
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+
+  file.close();
+
+  std::filesystem::remove(path);
+
+  return data;
+}
+
+} // namespace
+
+TEST(RawWriter, WritesR16RowsTopToBottom)
+{
+  // Little-endian, with heights outside of the range and NaN clamped.
+  std::vector<uint8_t> expected{ 0x00, 0x00, 0x00, 0x80, 0xff, 0xff,
+                                 0xff, 0xff, 0x00, 0x00, 0x00, 0x00 };
+
+  EXPECT_EQ(WriteRows(terra::RawFormat::R16), expected);
+}
+
+TEST(RawWriter, WritesUnityRawRowsBottomToTop)
+{
+  std::vector<uint8_t> expected{ 0xff, 0xff, 0x00, 0x00, 0x00, 0x00,
+                                 0x00, 0x00, 0x00, 0x80, 0xff, 0xff };
+
+  EXPECT_EQ(WriteRows(terra::RawFormat::UnityRaw), expected);
+}
+
+TEST(RawWriter, WritesFloat32WithHeader)
+{
+  auto data = WriteRows(terra::RawFormat::Float32);
+
+  ASSERT_EQ(data.size(), 16 + (gWidth * gHeight * 4));
+
+  std::vector<uint8_t> header{ 'T', 'R', 'H', 'M', 1, 0, 0, 0,
+                               3,   0,   0,   0,   2, 0, 0, 0 };
+
+  EXPECT_TRUE(std::equal(header.begin(), header.end(), data.begin()));
+
+  // 1.0f and -1.0f, which are written without the height range applied.
+  std::vector<uint8_t> one{ 0x00, 0x00, 0x80, 0x3f };
+  std::vector<uint8_t> minusOne{ 0x00, 0x00, 0x80, 0xbf };
+
+  EXPECT_TRUE(std::equal(one.begin(), one.end(), data.begin() + 16 + 4));
+
+  EXPECT_TRUE(
+    std::equal(minusOne.begin(), minusOne.end(), data.begin() + 16 + 16));
+
+  float last = 0;
+
+  memcpy(&last, &data[16 + 20], sizeof(last));
+
+  EXPECT_TRUE(last != last);
+}
+
+TEST(RawWriter, FailsOnInvalidPath)
+{
+  auto path = std::filesystem::temp_directory_path() / "missing" / "a.raw";
+
+  auto writer = terra::RawWriter::Make(
+    gWidth, gHeight, path.string().c_str(), terra::RawFormat::R16);
+
+  EXPECT_EQ(writer, nullptr);
+}
+
+TEST(RawWriter, RemovesIncompleteFile)
+{
+  auto path = std::filesystem::temp_directory_path() / "terra_raw_cut.raw";
+
+  {
+    auto writer = terra::RawWriter::Make(
+      gWidth, gHeight, path.string().c_str(), terra::RawFormat::R16);
+
+    ASSERT_NE(writer, nullptr);
+
+    std::vector<float> row(gWidth * 4, 0.5f);
+
+    // One row short, as if the export was cancelled.
+    writer->Observe(row.data());
+
+    EXPECT_TRUE(std::filesystem::exists(path));
+  }
+
+  EXPECT_FALSE(std::filesystem::exists(path));
+}
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include "tile_pool.h"
+
+TEST(TilePool, ReusesReleasedTiles)
+{
+  auto pool = terra::TilePool::Make(1);
+
+  auto tile = pool->Acquire(0, 0, 16, 8);
+
+  const auto* storage = tile.get();
+
+  tile->SetLevel(3);
+
+  tile.reset();
+
+  tile = pool->Acquire(256, 512, 32, 4);
+
+  EXPECT_EQ(tile.get(), storage);
+
+  // The recycled tile is constructed again.
+  EXPECT_EQ(tile->GetOffsetX(), 256);
+  EXPECT_EQ(tile->GetOffsetY(), 512);
+  EXPECT_EQ(tile->GetWidth(), 32);
+  EXPECT_EQ(tile->GetHeight(), 4);
+  EXPECT_EQ(tile->GetLevel(), 0);
+}
+
+TEST(TilePool, DoesNotReuseTilesInUse)
+{
+  auto pool = terra::TilePool::Make(2);
+
+  auto first = pool->Acquire(0, 0, 16, 16);
+
+  auto second = pool->Acquire(0, 0, 16, 16);
+
+  EXPECT_NE(first.get(), second.get());
+
+  const auto* storage = first.get();
+
+  first.reset();
+
+  auto third = pool->Acquire(0, 0, 16, 16);
+
+  EXPECT_EQ(third.get(), storage);
+}
+
+TEST(TilePool, TilesKeepThePoolAlive)
+{
+  auto pool = terra::TilePool::Make(1);
+
+  std::weak_ptr<terra::TilePool> weakPool = pool;
+
+  auto tile = pool->Acquire(0, 0, 16, 16);
+
+  pool.reset();
+
+  EXPECT_FALSE(weakPool.expired());
+
+  tile.reset();
+
+  EXPECT_TRUE(weakPool.expired());
+}
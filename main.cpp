@@ -1,5 +1,6 @@
 #include <QApplication>
 #include <QMainWindow>
+#include <QSurfaceFormat>
 #include <QVBoxLayout>
 
 #include "core/Backend.h"
@@ -16,6 +17,14 @@
 int
 main(int argc, char** argv)
 {
+  // The shaders of the scene view need OpenGL 3.0. The default format is
+  // set before the application, so that it applies to every context.
+  auto format = QSurfaceFormat::defaultFormat();
+
+  format.setVersion(3, 0);
+
+  QSurfaceFormat::setDefaultFormat(format);
+
   QApplication app(argc, argv);
 
   QMainWindow mainWindow;
@@ -38,7 +47,11 @@ main(int argc, char** argv)
 
   std::shared_ptr<Backend> backend;
 
-  backend.reset(Backend::MakeCpuBackend().release());
+  // The JIT backend needs a C compiler at run time, so it is opt-in.
+  if (app.arguments().contains("--jit"))
+    backend.reset(Backend::MakeJitBackend().release());
+  else
+    backend.reset(Backend::MakeCpuBackend().release());
 
   backend->Resize(2, 2);
 
@@ -52,7 +65,8 @@ main(int argc, char** argv)
 
   menuBar->AddObserver(editor->MakeMenuBarObserver());
 
-  backend->AddHeightMapObserver(sceneView->MakeHeightMapUpdater());
+  backend->AddHeightMapObserver(
+    sceneView->MakeHeightMapUpdater(backend->GetHeightMapExchange()));
 
   workspace->AddWidget(editor->GetWidget());
 
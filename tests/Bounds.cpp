@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+
+#include "core/Bounds.h"
+#include "core/IR.h"
+#include "core/Program.h"
+#include "core/ProgramBuilder.h"
+
+#include <vector>
+
+#include <math.h>
+
+namespace {
+
+using ID = ir::BinaryExpr::ID;
+
+using TrigID = ir::UnaryTrigExpr::ID;
+
+/// Checks that the bounds, both of the expression and of the program built
+/// from it, contain the values of the program at a grid of points in the
+/// rectangle, including its corners.
+void
+ExpectContainsSamples(const ir::Expr& expr,
+                      const ir::Interval& u,
+                      const ir::Interval& v)
+{
+  auto program = BuildProgram(expr);
+
+  ASSERT_TRUE(program);
+
+  auto bounds = ir::BoundsAnalysis(expr, u, v).GetBounds(expr);
+
+  auto programBounds = program->EvalBounds(u, v);
+
+  auto registers = program->MakeRegisters();
+
+  const int steps = 64;
+
+  for (int i = 0; i <= steps; i++) {
+
+    for (int j = 0; j <= steps; j++) {
+
+      auto uValue = u.min + ((u.max - u.min) * i) / steps;
+      auto vValue = v.min + ((v.max - v.min) * j) / steps;
+
+      auto value = program->Eval(uValue, vValue, registers.data());
+
+      if (isnan(value)) {
+        EXPECT_TRUE(bounds.mayBeNaN);
+        EXPECT_TRUE(programBounds.mayBeNaN);
+        continue;
+      }
+
+      EXPECT_LE(bounds.min, value) << "at " << uValue << ", " << vValue;
+      EXPECT_GE(bounds.max, value) << "at " << uValue << ", " << vValue;
+
+      EXPECT_LE(programBounds.min, value) << "at " << uValue << ", " << vValue;
+      EXPECT_GE(programBounds.max, value) << "at " << uValue << ", " << vValue;
+    }
+  }
+}
+
+} // namespace
+
+TEST(Bounds, ContainsSampledValues)
+{
+  ir::VarRefExpr u(ir::VarRefExpr::ID::CenterUCoord);
+  ir::VarRefExpr v(ir::VarRefExpr::ID::CenterVCoord);
+  ir::FloatLiteralExpr seven(7.0f);
+  ir::FloatLiteralExpr one(1.0f);
+  ir::BinaryExpr u7(ID::Mul, u, seven);
+  ir::BinaryExpr v7(ID::Mul, v, seven);
+  ir::UnaryTrigExpr sinU(TrigID::Sine, u7);
+  ir::UnaryTrigExpr cosV(TrigID::Cosine, v7);
+  ir::BinaryExpr waves(ID::Mul, sinU, cosV);
+  ir::BinaryExpr vPlusOne(ID::Add, v, one);
+  ir::BinaryExpr ratio(ID::Div, u, vPlusOne);
+  ir::UnaryTrigExpr atanRatio(TrigID::Arctangent, ratio);
+  ir::BinaryExpr expr(ID::Sub, waves, atanRatio);
+
+  ExpectContainsSamples(expr, { 0, 1 }, { 0, 1 });
+
+  ExpectContainsSamples(expr, { 0.25f, 0.3125f }, { 0.5f, 0.5625f });
+
+  ExpectContainsSamples(expr, { -3, 2 }, { 4, 9 });
+}
+
+TEST(Bounds, TrigExtremesInsideRange)
+{
+  ir::VarRefExpr u(ir::VarRefExpr::ID::CenterUCoord);
+  ir::UnaryTrigExpr sinU(TrigID::Sine, u);
+
+  // Contains pi/2, but not -pi/2 + 2 pi.
+  auto bounds = ir::BoundsAnalysis(sinU, { 1, 4 }, { 0, 1 }).GetBounds(sinU);
+
+  EXPECT_EQ(bounds.max, 1.0f);
+  EXPECT_LE(bounds.min, sinf(4.0f));
+  EXPECT_GT(bounds.min, -1.0f);
+  EXPECT_FALSE(bounds.mayBeNaN);
+}
+
+TEST(Bounds, DetectsConstantExpressions)
+{
+  ir::VarRefExpr v(ir::VarRefExpr::ID::CenterVCoord);
+  ir::FloatLiteralExpr zero(0.0f);
+  ir::FloatLiteralExpr half(0.5f);
+  ir::BinaryExpr flat(ID::Mul, v, zero);
+  ir::BinaryExpr expr(ID::Add, flat, half);
+
+  auto bounds = ir::BoundsAnalysis(expr, { 0, 1 }, { 0, 1 }).GetBounds(expr);
+
+  EXPECT_TRUE(bounds.IsConstant());
+  EXPECT_EQ(bounds.min, 0.5f);
+}
+
+TEST(Bounds, DivisionByRangeWithZero)
+{
+  ir::VarRefExpr u(ir::VarRefExpr::ID::CenterUCoord);
+  ir::VarRefExpr v(ir::VarRefExpr::ID::CenterVCoord);
+  ir::BinaryExpr expr(ID::Div, u, v);
+
+  auto bounds = ir::BoundsAnalysis(expr, { 0, 1 }, { -1, 1 }).GetBounds(expr);
+
+  EXPECT_TRUE(isinf(bounds.min));
+  EXPECT_TRUE(isinf(bounds.max));
+  EXPECT_TRUE(bounds.mayBeNaN);
+}
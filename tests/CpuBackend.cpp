@@ -1,9 +1,18 @@
 #include <gtest/gtest.h>
 
 #include "core/Backend.h"
+#include "core/HeightMapObserver.h"
+#include "core/IR.h"
+#include "core/Program.h"
+#include "core/ProgramBuilder.h"
 
 #include "ExprTests.h"
 
+#include <terra/cancellation_token.h>
+
+#include <memory>
+#include <vector>
+
 TEST(CpuBackend, ExprTests)
 {
   auto exprTests = ExprTests::All();
@@ -17,3 +26,110 @@ TEST(CpuBackend, ExprTests)
     exprTest->Run(*cpuEngine);
   }
 }
+
+TEST(CpuBackend, ThreadCountDoesNotChangeResult)
+{
+  using ID = ir::BinaryExpr::ID;
+
+  ir::VarRefExpr u(ir::VarRefExpr::ID::CenterUCoord);
+  ir::VarRefExpr v(ir::VarRefExpr::ID::CenterVCoord);
+  ir::FloatLiteralExpr seven(7.0f);
+  ir::BinaryExpr scaledU(ID::Mul, u, seven);
+  ir::UnaryTrigExpr sinU(ir::UnaryTrigExpr::ID::Sine, scaledU);
+  ir::BinaryExpr heightExpr(ID::Mul, sinU, v);
+
+  // Odd sizes, so that the bands do not divide the rows evenly.
+  const size_t w = 257;
+  const size_t h = 131;
+
+  auto computeWithThreads = [&](size_t threadCount) {
+    auto backend = Backend::MakeCpuBackend();
+    backend->SetThreadCount(threadCount);
+    backend->Resize(w, h);
+    backend->UpdateHeightExpr(&heightExpr);
+    backend->ComputeHeightMap();
+    std::vector<float> heightMap(w * h);
+    backend->ReadHeightMap(heightMap.data());
+    return heightMap;
+  };
+
+  EXPECT_EQ(computeWithThreads(1), computeWithThreads(8));
+}
+
+TEST(CpuBackend, ConstantBlocksMatchProgram)
+{
+  using ID = ir::BinaryExpr::ID;
+
+  // Steps of a staircase in u, scaled by v, so that some blocks are provably
+  // flat and the others are not.
+  ir::VarRefExpr u(ir::VarRefExpr::ID::CenterUCoord);
+  ir::FloatLiteralExpr three(3.0f);
+  auto scaledU =
+    std::unique_ptr<ir::Expr>(new ir::BinaryExpr(ID::Mul, u, three));
+  auto steps = std::unique_ptr<ir::Expr>(
+    new ir::FloatToIntExpr(std::move(scaledU)));
+  ir::IntToFloatExpr stepsFloat(std::move(steps));
+  ir::VarRefExpr v(ir::VarRefExpr::ID::CenterVCoord);
+  ir::BinaryExpr heightExpr(ID::Mul, stepsFloat, v);
+
+  const size_t w = 257;
+  const size_t h = 131;
+
+  auto backend = Backend::MakeCpuBackend();
+  backend->Resize(w, h);
+  backend->UpdateHeightExpr(&heightExpr);
+  backend->ComputeHeightMap();
+
+  std::vector<float> heightMap(w * h);
+  backend->ReadHeightMap(heightMap.data());
+
+  auto program = BuildProgram(heightExpr);
+
+  ASSERT_TRUE(program);
+
+  auto registers = program->MakeRegisters();
+
+  for (size_t y = 0; y < h; y++) {
+    for (size_t x = 0; x < w; x++) {
+      auto expected =
+        program->Eval((x + 0.5f) / w, (y + 0.5f) / h, registers.data());
+      ASSERT_EQ(heightMap[(y * w) + x], expected) << "at " << x << ", " << y;
+    }
+  }
+}
+
+TEST(CpuBackend, CancelledComputationIsNotObserved)
+{
+  class CountingObserver final : public HeightMapObserver
+  {
+  public:
+    CountingObserver(size_t& count)
+      : mCount(count)
+    {}
+
+    void Observe(const float*, size_t, size_t) override { mCount++; }
+
+  private:
+    size_t& mCount;
+  };
+
+  size_t observeCount = 0;
+
+  ir::VarRefExpr u(ir::VarRefExpr::ID::CenterUCoord);
+
+  auto backend = Backend::MakeCpuBackend();
+  backend->AddHeightMapObserver(
+    std::unique_ptr<HeightMapObserver>(new CountingObserver(observeCount)));
+  backend->Resize(64, 64);
+  backend->UpdateHeightExpr(&u);
+
+  CancellationToken token;
+
+  EXPECT_TRUE(backend->ComputeHeightMap(&token));
+  EXPECT_EQ(observeCount, 1);
+
+  token.Cancel();
+
+  EXPECT_FALSE(backend->ComputeHeightMap(&token));
+  EXPECT_EQ(observeCount, 1);
+}
@@ -5,6 +5,8 @@
 
 #include <gtest/gtest.h>
 
+#include <cmath>
+
 namespace {
 
 constexpr size_t w = 4;
@@ -47,6 +49,32 @@ public:
       EXPECT_NEAR(hMap[(rowIndex * w) + i], row[i], bias);
     }
   }
+
+protected:
+  /// Creates an expression that lives as long as the test, since expressions
+  /// only hold references to their operands.
+  template<typename ExprType, typename... Args>
+  const ir::Expr& MakeOperand(Args&&... args) const
+  {
+    auto* expr = new ExprType(std::forward<Args>(args)...);
+
+    mOperands.emplace_back(expr);
+
+    return *expr;
+  }
+
+  const ir::Expr& MakeU() const
+  {
+    return MakeOperand<ir::VarRefExpr>(ir::VarRefExpr::ID::CenterUCoord);
+  }
+
+  const ir::Expr& MakeV() const
+  {
+    return MakeOperand<ir::VarRefExpr>(ir::VarRefExpr::ID::CenterVCoord);
+  }
+
+private:
+  mutable std::vector<std::unique_ptr<ir::Expr>> mOperands;
 };
 
 class UCoordTest final : public ExprTestBase
@@ -87,6 +115,166 @@ public:
   }
 };
 
+class ArithTest final : public ExprTestBase
+{
+public:
+  const char* GetName() const noexcept override { return "ArithTest"; }
+
+  void CheckHeightMap(const HeightMap& heightMap) const override
+  {
+    // (u * 2) - (v / 4) + 1
+    ExpectRow(heightMap, 0, { 1.21875, 1.71875, 2.21875, 2.71875 });
+    ExpectRow(heightMap, 1, { 1.15625, 1.65625, 2.15625, 2.65625 });
+    ExpectRow(heightMap, 2, { 1.09375, 1.59375, 2.09375, 2.59375 });
+    ExpectRow(heightMap, 3, { 1.03125, 1.53125, 2.03125, 2.53125 });
+  }
+
+  ir::Expr* BuildExpr() const override
+  {
+    using ID = ir::BinaryExpr::ID;
+
+    const auto& two = MakeOperand<ir::FloatLiteralExpr>(2.0f);
+    const auto& four = MakeOperand<ir::FloatLiteralExpr>(4.0f);
+    const auto& one = MakeOperand<ir::FloatLiteralExpr>(1.0f);
+
+    const auto& uTerm = MakeOperand<ir::BinaryExpr>(ID::Mul, MakeU(), two);
+    const auto& vTerm = MakeOperand<ir::BinaryExpr>(ID::Div, MakeV(), four);
+    const auto& diff = MakeOperand<ir::BinaryExpr>(ID::Sub, uTerm, vTerm);
+
+    return new ir::BinaryExpr(ID::Add, diff, one);
+  }
+};
+
+class TrigTest final : public ExprTestBase
+{
+public:
+  const char* GetName() const noexcept override { return "TrigTest"; }
+
+  void CheckHeightMap(const HeightMap& heightMap) const override
+  {
+    for (size_t y = 0; y < h; y++) {
+
+      Row row;
+
+      for (size_t x = 0; x < w; x++) {
+        float u = (x + 0.5f) / w;
+        float v = (y + 0.5f) / h;
+        row[x] = std::sin(u) * std::atan(v);
+      }
+
+      ExpectRow(heightMap, y, row);
+    }
+  }
+
+  ir::Expr* BuildExpr() const override
+  {
+    using TrigID = ir::UnaryTrigExpr::ID;
+
+    const auto& sinU = MakeOperand<ir::UnaryTrigExpr>(TrigID::Sine, MakeU());
+
+    const auto& atanV =
+      MakeOperand<ir::UnaryTrigExpr>(TrigID::Arctangent, MakeV());
+
+    return new ir::BinaryExpr(ir::BinaryExpr::ID::Mul, sinU, atanV);
+  }
+};
+
+/// Mixes subexpressions that only depend on u, only on v and on both.
+class SeparableTest final : public ExprTestBase
+{
+public:
+  const char* GetName() const noexcept override { return "SeparableTest"; }
+
+  void CheckHeightMap(const HeightMap& heightMap) const override
+  {
+    for (size_t y = 0; y < h; y++) {
+
+      Row row;
+
+      for (size_t x = 0; x < w; x++) {
+        float u = (x + 0.5f) / w;
+        float v = (y + 0.5f) / h;
+        row[x] = ((std::sin(u * 3) + std::cos(v * 2)) * (u - v)) + std::tan(v);
+      }
+
+      ExpectRow(heightMap, y, row);
+    }
+  }
+
+  ir::Expr* BuildExpr() const override
+  {
+    using ID = ir::BinaryExpr::ID;
+
+    using TrigID = ir::UnaryTrigExpr::ID;
+
+    const auto& three = MakeOperand<ir::FloatLiteralExpr>(3.0f);
+    const auto& two = MakeOperand<ir::FloatLiteralExpr>(2.0f);
+    const auto& u3 = MakeOperand<ir::BinaryExpr>(ID::Mul, MakeU(), three);
+    const auto& v2 = MakeOperand<ir::BinaryExpr>(ID::Mul, MakeV(), two);
+    const auto& sinU = MakeOperand<ir::UnaryTrigExpr>(TrigID::Sine, u3);
+    const auto& cosV = MakeOperand<ir::UnaryTrigExpr>(TrigID::Cosine, v2);
+    const auto& tanV = MakeOperand<ir::UnaryTrigExpr>(TrigID::Tangent, MakeV());
+    const auto& sum = MakeOperand<ir::BinaryExpr>(ID::Add, sinU, cosV);
+    const auto& diff = MakeOperand<ir::BinaryExpr>(ID::Sub, MakeU(), MakeV());
+    const auto& product = MakeOperand<ir::BinaryExpr>(ID::Mul, sum, diff);
+
+    return new ir::BinaryExpr(ID::Add, product, tanV);
+  }
+};
+
+/// An expression that only depends on v, so it is evaluated once per row.
+class RowTest final : public ExprTestBase
+{
+public:
+  const char* GetName() const noexcept override { return "RowTest"; }
+
+  void CheckHeightMap(const HeightMap& heightMap) const override
+  {
+    for (size_t y = 0; y < h; y++) {
+      float v = (y + 0.5f) / h;
+      float height = std::cos(v) * 2;
+      ExpectRow(heightMap, y, { height, height, height, height });
+    }
+  }
+
+  ir::Expr* BuildExpr() const override
+  {
+    using TrigID = ir::UnaryTrigExpr::ID;
+
+    const auto& two = MakeOperand<ir::FloatLiteralExpr>(2.0f);
+    const auto& cosV = MakeOperand<ir::UnaryTrigExpr>(TrigID::Cosine, MakeV());
+
+    return new ir::BinaryExpr(ir::BinaryExpr::ID::Mul, cosV, two);
+  }
+};
+
+class CastTest final : public ExprTestBase
+{
+public:
+  const char* GetName() const noexcept override { return "CastTest"; }
+
+  void CheckHeightMap(const HeightMap& heightMap) const override
+  {
+    ExpectRow(heightMap, 0, { 0, 1, 2, 3 });
+    ExpectRow(heightMap, 1, { 0, 1, 2, 3 });
+    ExpectRow(heightMap, 2, { 0, 1, 2, 3 });
+    ExpectRow(heightMap, 3, { 0, 1, 2, 3 });
+  }
+
+  ir::Expr* BuildExpr() const override
+  {
+    const auto& four = MakeOperand<ir::FloatLiteralExpr>(4.0f);
+
+    auto scaledU = std::unique_ptr<ir::Expr>(
+      new ir::BinaryExpr(ir::BinaryExpr::ID::Mul, MakeU(), four));
+
+    auto toInt = std::unique_ptr<ir::Expr>(
+      new ir::FloatToIntExpr(std::move(scaledU)));
+
+    return new ir::IntToFloatExpr(std::move(toInt));
+  }
+};
+
 } // namespace
 
 auto
@@ -96,6 +284,11 @@ ExprTests::All() -> std::vector<std::unique_ptr<ExprTest>>
 
   tests.emplace_back(new UCoordTest());
   tests.emplace_back(new VCoordTest());
+  tests.emplace_back(new ArithTest());
+  tests.emplace_back(new TrigTest());
+  tests.emplace_back(new CastTest());
+  tests.emplace_back(new SeparableTest());
+  tests.emplace_back(new RowTest());
 
   return tests;
 }
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+
+#include "core/HeightMapExchange.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+void
+Produce(HeightMapExchange& exchange, float value)
+{
+  auto& heightMap = exchange.GetBackBuffer();
+
+  heightMap.Resize(4, 3);
+
+  std::fill(heightMap.data.begin(), heightMap.data.end(), value);
+
+  exchange.Publish();
+}
+
+} // namespace
+
+TEST(HeightMapExchange, AcquiresLatestPublished)
+{
+  HeightMapExchange exchange;
+
+  EXPECT_FALSE(exchange.Acquire());
+
+  EXPECT_TRUE(exchange.GetFrontBuffer().data.empty());
+
+  Produce(exchange, 1.0f);
+  Produce(exchange, 2.0f);
+
+  EXPECT_EQ(exchange.GetPublished().data[0], 2.0f);
+
+  ASSERT_TRUE(exchange.Acquire());
+
+  EXPECT_EQ(exchange.GetFrontBuffer().w, 4);
+  EXPECT_EQ(exchange.GetFrontBuffer().h, 3);
+  EXPECT_EQ(exchange.GetFrontBuffer().data[0], 2.0f);
+
+  EXPECT_FALSE(exchange.Acquire());
+
+  // Producing does not touch the front buffer.
+  Produce(exchange, 3.0f);
+
+  EXPECT_EQ(exchange.GetFrontBuffer().data[0], 2.0f);
+
+  ASSERT_TRUE(exchange.Acquire());
+
+  EXPECT_EQ(exchange.GetFrontBuffer().data[0], 3.0f);
+}
+
+TEST(HeightMapExchange, ConsumerOnlySeesCompleteHeightMaps)
+{
+  HeightMapExchange exchange;
+
+  const int count = 20000;
+
+  std::thread producer([&exchange]() {
+    for (int i = 1; i <= count; i++)
+      Produce(exchange, float(i));
+  });
+
+  float last = 0;
+
+  while (last < count) {
+
+    if (!exchange.Acquire())
+      continue;
+
+    const auto& data = exchange.GetFrontBuffer().data;
+
+    EXPECT_EQ(data.size(), 12);
+
+    auto value = data.empty() ? float(count) : data[0];
+
+    EXPECT_GT(value, last);
+
+    EXPECT_EQ(std::count(data.begin(), data.end(), value), 12);
+
+    last = value;
+  }
+
+  producer.join();
+}
+
+TEST(HeightMapExchange, VersionsChangedTiles)
+{
+  HeightMapExchange exchange;
+
+  auto produce = [&exchange](size_t w, size_t h, size_t changedX) {
+    auto& heightMap = exchange.GetBackBuffer();
+    heightMap.Resize(w, h);
+    std::fill(heightMap.data.begin(), heightMap.data.end(), 0.0f);
+    heightMap.data[changedX] = 1.0f;
+    exchange.Publish();
+    return exchange.GetPublished().tileVersions;
+  };
+
+  auto versions = produce(100, 70, 0);
+
+  ASSERT_EQ(versions.size(), 4);
+
+  EXPECT_EQ(std::count(versions.begin(), versions.end(), 1), 4);
+
+  // Only the tile of the value that moved, and the one it moved to.
+  versions = produce(100, 70, 70);
+
+  EXPECT_EQ(versions, std::vector<uint64_t>({ 2, 2, 1, 1 }));
+
+  versions = produce(100, 70, 70);
+
+  EXPECT_EQ(versions, std::vector<uint64_t>({ 2, 2, 1, 1 }));
+
+  versions = produce(70, 100, 70);
+
+  EXPECT_EQ(versions, std::vector<uint64_t>({ 4, 4, 4, 4 }));
+}
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+
+#include "core/IR.h"
+#include "core/JitBackend.h"
+
+#include "ExprTests.h"
+
+TEST(JitBackend, ExprTests)
+{
+  if (!JitBackend::HasCompiler())
+    GTEST_SKIP() << "No C compiler to compile the expressions with.";
+
+  auto exprTests = ExprTests::All();
+
+  for (const auto& exprTest : exprTests) {
+
+    SCOPED_TRACE(exprTest->GetName());
+
+    std::unique_ptr<JitBackend> jitEngine(JitBackend::Make());
+
+    exprTest->Run(*jitEngine);
+
+    EXPECT_TRUE(jitEngine->WaitForCompile());
+  }
+}
+
+TEST(JitBackend, MatchesCpuBackend)
+{
+  if (!JitBackend::HasCompiler())
+    GTEST_SKIP() << "No C compiler to compile the expressions with.";
+
+  using ID = ir::BinaryExpr::ID;
+
+  using TrigID = ir::UnaryTrigExpr::ID;
+
+  ir::VarRefExpr u(ir::VarRefExpr::ID::CenterUCoord);
+  ir::VarRefExpr v(ir::VarRefExpr::ID::CenterVCoord);
+  ir::FloatLiteralExpr seven(7.0f);
+  ir::FloatLiteralExpr third(1.0f / 3.0f);
+  ir::BinaryExpr scaledU(ID::Mul, u, seven);
+  ir::BinaryExpr scaledV(ID::Div, v, third);
+  ir::UnaryTrigExpr sinU(TrigID::Sine, scaledU);
+  ir::UnaryTrigExpr cosV(TrigID::Cosine, scaledV);
+  ir::BinaryExpr uv(ID::Mul, u, v);
+  ir::UnaryTrigExpr atanUV(TrigID::Arctangent, uv);
+  ir::BinaryExpr sum(ID::Add, sinU, cosV);
+  ir::BinaryExpr heightExpr(ID::Sub, sum, atanUV);
+
+  const size_t w = 257;
+  const size_t h = 131;
+
+  auto compute = [&](Backend& backend) {
+    backend.Resize(w, h);
+    backend.UpdateHeightExpr(&heightExpr);
+    backend.ComputeHeightMap();
+    std::vector<float> heightMap(w * h);
+    backend.ReadHeightMap(heightMap.data());
+    return heightMap;
+  };
+
+  auto cpuBackend = Backend::MakeCpuBackend();
+
+  std::unique_ptr<JitBackend> jitBackend(JitBackend::Make());
+
+  auto cpuHeightMap = compute(*cpuBackend);
+
+  // The first computation falls back to the CPU backend while the kernel
+  // is compiled.
+  EXPECT_EQ(cpuHeightMap, compute(*jitBackend));
+
+  EXPECT_TRUE(jitBackend->WaitForCompile());
+
+  jitBackend->ComputeHeightMap();
+
+  std::vector<float> jitHeightMap(w * h);
+
+  jitBackend->ReadHeightMap(jitHeightMap.data());
+
+  EXPECT_EQ(cpuHeightMap, jitHeightMap);
+}
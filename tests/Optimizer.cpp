@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include "core/IR.h"
+#include "core/Optimizer.h"
+
+#include <cmath>
+
+namespace {
+
+using ID = ir::BinaryExpr::ID;
+
+auto
+AsFloatLiteral(const ir::Expr& expr) -> const ir::FloatLiteralExpr*
+{
+  return dynamic_cast<const ir::FloatLiteralExpr*>(&expr);
+}
+
+} // namespace
+
+TEST(Optimizer, FoldsLiterals)
+{
+  ir::FloatLiteralExpr half(0.5f);
+  ir::FloatLiteralExpr two(2.0f);
+  ir::UnaryTrigExpr sinHalf(ir::UnaryTrigExpr::ID::Sine, half);
+  ir::BinaryExpr expr(ID::Mul, sinHalf, two);
+
+  ir::ExprArena arena;
+
+  const auto* literal = AsFloatLiteral(ir::Simplify(expr, arena));
+
+  ASSERT_NE(literal, nullptr);
+
+  EXPECT_EQ(literal->GetValue(), std::sin(0.5f) * 2.0f);
+}
+
+TEST(Optimizer, RemovesIdentities)
+{
+  ir::VarRefExpr u(ir::VarRefExpr::ID::CenterUCoord);
+  ir::FloatLiteralExpr zero(0.0f);
+  ir::FloatLiteralExpr one(1.0f);
+  ir::BinaryExpr mulOne(ID::Mul, one, u);
+  ir::BinaryExpr divOne(ID::Div, mulOne, one);
+  ir::BinaryExpr addZero(ID::Add, divOne, zero);
+  ir::BinaryExpr subZero(ID::Sub, addZero, zero);
+
+  ir::ExprArena arena;
+
+  EXPECT_EQ(&ir::Simplify(subZero, arena), &u);
+}
+
+TEST(Optimizer, DivisionByConstantBecomesMultiplication)
+{
+  ir::VarRefExpr u(ir::VarRefExpr::ID::CenterUCoord);
+  ir::FloatLiteralExpr two(2.0f);
+  ir::FloatLiteralExpr four(4.0f);
+  ir::BinaryExpr sum(ID::Add, two, two);
+  ir::BinaryExpr expr(ID::Div, u, sum);
+
+  ir::ExprArena arena;
+
+  const auto* result =
+    dynamic_cast<const ir::BinaryExpr*>(&ir::Simplify(expr, arena));
+
+  ASSERT_NE(result, nullptr);
+
+  EXPECT_EQ(result->GetID(), ID::Mul);
+
+  EXPECT_EQ(&result->GetLeftExpr(), &u);
+
+  const auto* reciprocal = AsFloatLiteral(result->GetRightExpr());
+
+  ASSERT_NE(reciprocal, nullptr);
+
+  EXPECT_EQ(reciprocal->GetValue(), 0.25f);
+}
+
+TEST(Optimizer, KeepsDivisionByZero)
+{
+  ir::VarRefExpr u(ir::VarRefExpr::ID::CenterUCoord);
+  ir::FloatLiteralExpr zero(0.0f);
+  ir::BinaryExpr expr(ID::Div, u, zero);
+
+  ir::ExprArena arena;
+
+  EXPECT_EQ(&ir::Simplify(expr, arena), &expr);
+}
+
+TEST(Optimizer, InternsEqualSubexpressions)
+{
+  ir::VarRefExpr u1(ir::VarRefExpr::ID::CenterUCoord);
+  ir::VarRefExpr u2(ir::VarRefExpr::ID::CenterUCoord);
+  ir::UnaryTrigExpr sin1(ir::UnaryTrigExpr::ID::Sine, u1);
+  ir::UnaryTrigExpr sin2(ir::UnaryTrigExpr::ID::Sine, u2);
+  ir::BinaryExpr expr(ID::Mul, sin1, sin2);
+
+  ir::ExprArena arena;
+
+  const auto* result =
+    dynamic_cast<const ir::BinaryExpr*>(&ir::Intern(expr, arena));
+
+  ASSERT_NE(result, nullptr);
+
+  EXPECT_EQ(&result->GetLeftExpr(), &sin1);
+
+  EXPECT_EQ(&result->GetRightExpr(), &sin1);
+}
+
+TEST(Optimizer, InternKeepsDistinctSubexpressions)
+{
+  ir::VarRefExpr u(ir::VarRefExpr::ID::CenterUCoord);
+  ir::VarRefExpr v(ir::VarRefExpr::ID::CenterVCoord);
+  ir::BinaryExpr uv(ID::Sub, u, v);
+  ir::BinaryExpr vu(ID::Sub, v, u);
+  ir::BinaryExpr expr(ID::Add, uv, vu);
+
+  ir::ExprArena arena;
+
+  EXPECT_EQ(&ir::Intern(expr, arena), &expr);
+}
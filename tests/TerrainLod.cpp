@@ -0,0 +1,254 @@
+#include <gtest/gtest.h>
+
+#include "core/HeightMapExchange.h"
+#include "core/TerrainLod.h"
+
+#include <algorithm>
+
+#include <math.h>
+
+namespace {
+
+auto
+MakeHills(size_t w, size_t h) -> HeightMap
+{
+  HeightMap heightMap;
+
+  heightMap.Resize(w, h);
+
+  for (size_t y = 0; y < h; y++) {
+    for (size_t x = 0; x < w; x++) {
+      auto value = sinf(float(x) * 0.05f) * cosf(float(y) * 0.07f) * 0.2f;
+      heightMap.data[(y * w) + x] = value;
+    }
+  }
+
+  return heightMap;
+}
+
+float
+Sample(const HeightMap& heightMap, size_t x, size_t y)
+{
+  x = std::min(x, heightMap.w - 1);
+  y = std::min(y, heightMap.h - 1);
+  return heightMap.data[(y * heightMap.w) + x];
+}
+
+/// @return The height of the triangles of @p node at a height sample.
+float
+Interpolate(const HeightMap& heightMap, const LodNode& node, size_t x, size_t y)
+{
+  auto stride = TerrainLod::Stride(node.level);
+
+  auto x0 = node.x + (((x - node.x) / stride) * stride);
+  auto y0 = node.y + (((y - node.y) / stride) * stride);
+
+  auto tx = float(x - x0) / float(stride);
+  auto ty = float(y - y0) / float(stride);
+
+  auto h00 = Sample(heightMap, x0, y0);
+  auto h10 = Sample(heightMap, x0 + stride, y0);
+  auto h01 = Sample(heightMap, x0, y0 + stride);
+  auto h11 = Sample(heightMap, x0 + stride, y0 + stride);
+
+  if ((tx + ty) <= 1.0f)
+    return h00 + (tx * (h10 - h00)) + (ty * (h01 - h00));
+
+  return h11 + ((1.0f - tx) * (h01 - h11)) + ((1.0f - ty) * (h10 - h11));
+}
+
+/// @return The level of the selected node covering each cell, or -1 where
+/// the cell is covered more than once.
+auto
+GetCellLevels(const HeightMap& heightMap,
+              const TerrainLod& lod,
+              const std::vector<LodSelection>& selection) -> std::vector<int>
+{
+  auto cellsX = heightMap.w - 1;
+  auto cellsY = heightMap.h - 1;
+
+  std::vector<int> levels(cellsX * cellsY, 0);
+  std::vector<int> counts(cellsX * cellsY, 0);
+
+  for (const auto& selected : selection) {
+
+    const auto& node = lod.GetNodes()[selected.node];
+
+    auto size = (TerrainLod::NodeSize() - 1) * TerrainLod::Stride(node.level);
+
+    for (auto y = node.y; y < std::min(node.y + size, cellsY); y++) {
+      for (auto x = node.x; x < std::min(node.x + size, cellsX); x++) {
+        levels[(y * cellsX) + x] = int(node.level);
+        counts[(y * cellsX) + x]++;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < levels.size(); i++) {
+    if (counts[i] != 1)
+      levels[i] = -1;
+  }
+
+  return levels;
+}
+
+} // namespace
+
+TEST(TerrainLod, ErrorBoundsDistanceToHeightMap)
+{
+  auto heightMap = MakeHills(600, 300);
+
+  TerrainLod lod;
+
+  lod.Build(heightMap);
+
+  ASSERT_EQ(lod.GetNodes().back().level, 2);
+
+  for (const auto& node : lod.GetNodes()) {
+
+    auto size = (TerrainLod::NodeSize() - 1) * TerrainLod::Stride(node.level);
+
+    auto lastX = std::min(node.x + size, heightMap.w - 1);
+    auto lastY = std::min(node.y + size, heightMap.h - 1);
+
+    for (auto y = node.y; y <= lastY; y++) {
+      for (auto x = node.x; x <= lastX; x++) {
+
+        auto actual = Sample(heightMap, x, y);
+
+        EXPECT_LE(actual, node.maxHeight);
+        EXPECT_GE(actual, node.minHeight);
+
+        auto distance = fabsf(actual - Interpolate(heightMap, node, x, y));
+
+        ASSERT_LE(distance, node.error + 1.0e-5f);
+      }
+    }
+  }
+}
+
+TEST(TerrainLod, SelectsNodesByDistance)
+{
+  auto heightMap = MakeHills(1000, 700);
+
+  TerrainLod lod;
+
+  lod.Build(heightMap);
+
+  LodView view;
+
+  view.eye = { { -1.0f, 0.1f, 1.0f } };
+
+  view.pixelsPerUnit = 100.0f;
+
+  std::vector<LodSelection> selection;
+
+  lod.Select(view, selection);
+
+  auto levels = GetCellLevels(heightMap, lod, selection);
+
+  auto cellsX = heightMap.w - 1;
+
+  EXPECT_EQ(levels.front(), 0);
+
+  EXPECT_GT(levels.back(), 0);
+
+  for (size_t i = 0; i < levels.size(); i++) {
+
+    ASSERT_NE(levels[i], -1);
+
+    if ((i % cellsX) > 0) {
+      ASSERT_LE(abs(levels[i] - levels[i - 1]), 1);
+    }
+
+    if (i >= cellsX) {
+      ASSERT_LE(abs(levels[i] - levels[i - cellsX]), 1);
+    }
+  }
+
+  for (const auto& selected : selection)
+    EXPECT_LT(selected.morphStart, selected.morphEnd);
+}
+
+TEST(TerrainLod, DistantViewSelectsRoot)
+{
+  auto heightMap = MakeHills(1000, 700);
+
+  TerrainLod lod;
+
+  lod.Build(heightMap);
+
+  LodView view;
+
+  view.eye = { { 0.0f, 1000.0f, 0.0f } };
+
+  std::vector<LodSelection> selection;
+
+  lod.Select(view, selection);
+
+  ASSERT_EQ(selection.size(), 1);
+
+  EXPECT_EQ(selection[0].node, lod.GetNodes().size() - 1);
+}
+
+TEST(TerrainLod, SelectsNoNodeBelowMinLevel)
+{
+  auto heightMap = MakeHills(1000, 700);
+
+  TerrainLod lod;
+
+  lod.Build(heightMap);
+
+  LodView view;
+
+  view.eye = { { -1.0f, 0.1f, 1.0f } };
+
+  view.pixelsPerUnit = 100.0f;
+
+  view.minLevel = 1;
+
+  std::vector<LodSelection> selection;
+
+  lod.Select(view, selection);
+
+  auto levels = GetCellLevels(heightMap, lod, selection);
+
+  EXPECT_EQ(levels.front(), 1);
+
+  for (auto level : levels)
+    ASSERT_GE(level, 1);
+}
+
+TEST(TerrainLod, UpdateMatchesBuild)
+{
+  auto heightMap = MakeHills(600, 300);
+
+  TerrainLod lod;
+
+  lod.Build(heightMap);
+
+  // Changes a single value, at the edge of a tile.
+  heightMap.data[(200 * heightMap.w) + 320] = 5.0f;
+
+  std::vector<bool> dirtyTiles(heightMap.TilesPerRow() *
+                               heightMap.TilesPerColumn());
+
+  dirtyTiles[((200 / 64) * heightMap.TilesPerRow()) + (320 / 64)] = true;
+
+  lod.Update(heightMap, dirtyTiles);
+
+  TerrainLod expected;
+
+  expected.Build(heightMap);
+
+  ASSERT_EQ(lod.GetNodes().size(), expected.GetNodes().size());
+
+  for (size_t i = 0; i < lod.GetNodes().size(); i++) {
+
+    const auto& node = lod.GetNodes()[i];
+
+    EXPECT_EQ(node.minHeight, expected.GetNodes()[i].minHeight);
+    EXPECT_EQ(node.maxHeight, expected.GetNodes()[i].maxHeight);
+    EXPECT_EQ(node.error, expected.GetNodes()[i].error);
+  }
+}